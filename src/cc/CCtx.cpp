@@ -234,28 +234,83 @@ void SetCCtxids(std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex
     }
 }
 
+/*
+ CC helpers ask for the same handful of contract addresses over and over, so the unspent outputs of each address are kept in a view keyed by its (hash160,type) index key. The address unspent index only changes when blocks are connected or disconnected, and ConnectBlock/DisconnectBlock call CCaddress_cache_invalidate for every address they touched right after writing it.
+ */
+
+struct CCaddress_view
+{
+    int64_t balance;
+    std::map<std::pair<uint256,int32_t>,int64_t> utxos;
+};
+
+#define CC_ADDRESS_CACHE_MAX 4096
+
+static CCriticalSection cs_CCaddress_cache;
+static std::map<std::pair<uint160,int>,CCaddress_view> CCaddress_cache;
+
+static bool CCaddress_indexkey(std::pair<uint160,int> &key,char *coinaddr)
+{
+    int type = 0; uint160 hashBytes;
+    CBitcoinAddress address(coinaddr);
+    if ( address.GetIndexKey(hashBytes,type) == 0 )
+        return(false);
+    key = std::make_pair(hashBytes,type);
+    return(true);
+}
+
+// cs_CCaddress_cache must be held. The index read happens under the lock so an invalidation that follows a concurrent index write always removes what was loaded here.
+static CCaddress_view *CCaddress_view_find(char *coinaddr)
+{
+    std::pair<uint160,int> key; std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    if ( CCaddress_indexkey(key,coinaddr) == 0 )
+        return(0);
+    std::map<std::pair<uint160,int>,CCaddress_view>::iterator it = CCaddress_cache.find(key);
+    if ( it != CCaddress_cache.end() )
+        return(&it->second);
+    if ( GetAddressUnspent(key.first,key.second,unspentOutputs) == 0 )
+        return(0);
+    if ( CCaddress_cache.size() >= CC_ADDRESS_CACHE_MAX )
+        CCaddress_cache.clear();
+    CCaddress_view &view = CCaddress_cache[key];
+    view.balance = 0;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator uit=unspentOutputs.begin(); uit!=unspentOutputs.end(); uit++)
+    {
+        view.utxos[std::make_pair(uit->first.txhash,(int32_t)uit->first.index)] = uit->second.satoshis;
+        view.balance += uit->second.satoshis;
+    }
+    return(&view);
+}
+
+void CCaddress_cache_invalidate(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex)
+{
+    LOCK(cs_CCaddress_cache);
+    if ( CCaddress_cache.empty() != 0 )
+        return;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=addressUnspentIndex.begin(); it!=addressUnspentIndex.end(); it++)
+        CCaddress_cache.erase(std::make_pair(it->first.hashBytes,(int)it->first.type));
+}
+
 int64_t CCutxovalue(char *coinaddr,uint256 utxotxid,int32_t utxovout)
 {
-    uint256 txid; std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-    SetCCunspents(unspentOutputs,coinaddr);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
+    CCaddress_view *view;
+    LOCK(cs_CCaddress_cache);
+    if ( (view= CCaddress_view_find(coinaddr)) != 0 )
     {
-        txid = it->first.txhash;
-        if ( txid == utxotxid && utxovout == it->first.index )
-            return(it->second.satoshis);
+        std::map<std::pair<uint256,int32_t>,int64_t>::const_iterator it = view->utxos.find(std::make_pair(utxotxid,utxovout));
+        if ( it != view->utxos.end() )
+            return(it->second);
     }
     return(0);
 }
 
 int64_t CCaddress_balance(char *coinaddr)
 {
-    int64_t sum = 0; std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-    SetCCunspents(unspentOutputs,coinaddr);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
-    {
-        sum += it->second.satoshis;
-    }
-    return(sum);
+    CCaddress_view *view;
+    LOCK(cs_CCaddress_cache);
+    if ( (view= CCaddress_view_find(coinaddr)) != 0 )
+        return(view->balance);
+    return(0);
 }
 
 int64_t CCfullsupply(uint256 tokenid)
@@ -274,17 +329,25 @@ int64_t CCfullsupply(uint256 tokenid)
 int64_t CCtoken_balance(char *coinaddr,uint256 tokenid)
 {
     int64_t price,sum = 0; int32_t numvouts; CTransaction tx; uint256 assetid,assetid2,txid,hashBlock; std::vector<uint8_t> origpubkey;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-    SetCCunspents(unspentOutputs,coinaddr);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
+    std::vector<std::pair<uint256,int64_t> > utxos; CCaddress_view *view;
     {
-        txid = it->first.txhash;
+        // GetTransaction takes cs_main, which block connection holds while invalidating, so work from a copy
+        LOCK(cs_CCaddress_cache);
+        if ( (view= CCaddress_view_find(coinaddr)) == 0 )
+            return(0);
+        utxos.reserve(view->utxos.size());
+        for (std::map<std::pair<uint256,int32_t>,int64_t>::const_iterator it=view->utxos.begin(); it!=view->utxos.end(); it++)
+            utxos.push_back(std::make_pair(it->first.first,it->second));
+    }
+    for (std::vector<std::pair<uint256,int64_t> >::const_iterator it=utxos.begin(); it!=utxos.end(); it++)
+    {
+        txid = it->first;
         if ( GetTransaction(txid,tx,hashBlock,false) != 0 && (numvouts= tx.vout.size()) > 0 )
         {
-            char str[65]; fprintf(stderr,"check %s %.8f\n",uint256_str(str,txid),(double)it->second.satoshis/COIN);
+            char str[65]; fprintf(stderr,"check %s %.8f\n",uint256_str(str,txid),(double)it->second/COIN);
             if ( DecodeAssetOpRet(tx.vout[numvouts-1].scriptPubKey,assetid,assetid2,price,origpubkey) != 0 && assetid == tokenid )
             {
-                sum += it->second.satoshis;
+                sum += it->second;
             }
         }
     }
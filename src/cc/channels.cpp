@@ -401,12 +401,14 @@ int64_t AddChannelsInputs(struct CCcontract_info *cp,CMutableTransaction &mtx, C
     {
         txid=zeroid;
         int32_t mindepth=CHANNELS_MAXPAYMENTS;
-        for (const CTxMemPoolEntry &e : mempool.mapTx)
+        std::vector<COutPoint> outputs;
+        mempool.getAddressOutputs(coinaddr,outputs);
+        for (const COutPoint &output : outputs)
         {
-            const CTransaction &txmempool = e.GetTx();
-            const uint256 &hash = txmempool.GetHash();
+            CTransaction txmempool;
+            const uint256 &hash = output.hash;
 
-            if ((numvouts=txmempool.vout.size()) > 0 && DecodeChannelsOpRet(txmempool.vout[numvouts-1].scriptPubKey,tmp_txid,srcpub,destpub,param1,param2,param3) != 0 &&
+            if (output.n == 0 && mempool.lookup(hash,txmempool) != 0 && (numvouts=txmempool.vout.size()) > 0 && DecodeChannelsOpRet(txmempool.vout[numvouts-1].scriptPubKey,tmp_txid,srcpub,destpub,param1,param2,param3) != 0 &&
               tmp_txid==openTx.GetHash() && param1 < mindepth)
             {
                 txid=hash;
@@ -29,15 +29,39 @@
 
 
 Eval* EVAL_TEST = 0;
-struct CCcontract_info CCinfos[0x100];
 extern pthread_mutex_t SAFECOIN_CC_mutex;
 
+/*
+ * Contracts ConnectBlock's script check threads can run side by side. Assets, faucet and rewards
+ * only read the transactions they are given, the chain, the mempool and the indexes; oracles
+ * also reads its price index, which has its own lock. Their only function statics are the
+ * never written zero hashes. The other listed validators reject before touching anything.
+ * Channels and gateways read the notarisation state, dice queues its own finishing transactions
+ * and the imports go through the notarisation state too, so those still run one at a time
+ * under SAFECOIN_CC_mutex.
+ */
+static bool CCEvalIsConcurrent(uint8_t ecode)
+{
+    switch ( ecode )
+    {
+        case EVAL_ASSETS: case EVAL_FAUCET: case EVAL_REWARDS: case EVAL_ORACLES:
+        case EVAL_FSM: case EVAL_AUCTION: case EVAL_LOTTO: case EVAL_HEIR: case EVAL_PRICES:
+        case EVAL_PEGS: case EVAL_TRIGGERS: case EVAL_PAYMENTS:
+            return(true);
+        default:
+            return(false);
+    }
+}
+
 bool RunCCEval(const CC *cond, const CTransaction &tx, unsigned int nIn)
 {
     EvalRef eval;
-    pthread_mutex_lock(&SAFECOIN_CC_mutex);
+    bool fSerial = cond->codeLength == 0 || !CCEvalIsConcurrent(cond->code[0]);
+    if ( fSerial )
+        pthread_mutex_lock(&SAFECOIN_CC_mutex);
     bool out = eval->Dispatch(cond, tx, nIn);
-    pthread_mutex_unlock(&SAFECOIN_CC_mutex);
+    if ( fSerial )
+        pthread_mutex_unlock(&SAFECOIN_CC_mutex);
     //fprintf(stderr,"out %d vs %d isValid\n",(int32_t)out,(int32_t)eval->state.IsValid());
     assert(eval->state.IsValid() == out);
 
@@ -59,17 +83,13 @@ bool RunCCEval(const CC *cond, const CTransaction &tx, unsigned int nIn)
  */
 bool Eval::Dispatch(const CC *cond, const CTransaction &txTo, unsigned int nIn)
 {
-    struct CCcontract_info *cp;
+    struct CCcontract_info *cp,C = {}; // zeroed like the old static table, for codes CCinit does not know
     if (cond->codeLength == 0)
         return Invalid("empty-eval");
 
     uint8_t ecode = cond->code[0];
-    cp = &CCinfos[(int32_t)ecode];
-    if ( cp->didinit == 0 )
-    {
-        CCinit(cp,ecode);
-        cp->didinit = 1;
-    }
+    // a fresh copy per call, the validators use it as scratch space
+    cp = CCinit(&C,ecode);
     std::vector<uint8_t> vparams(cond->code+1, cond->code+cond->codeLength);
     switch ( ecode )
     {
@@ -363,23 +363,11 @@ bool GatewaysExactAmounts(struct CCcontract_info *cp,Eval* eval,const CTransacti
 
 static int32_t myIs_coinaddr_inmempoolvout(char *coinaddr)
 {
-    int32_t i,n; char destaddr[64];
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
+    std::vector<COutPoint> outputs;
+    if ( mempool.getAddressOutputs(coinaddr,outputs) != 0 && outputs.size() > 0 )
     {
-        const CTransaction &tx = e.GetTx();
-        if ( (n= tx.vout.size()) > 0 )
-        {
-            const uint256 &txid = tx.GetHash();
-            for (i=0; i<n; i++)
-            {
-                Getscriptaddress(destaddr,tx.vout[i].scriptPubKey);
-                if ( strcmp(destaddr,coinaddr) == 0 )
-                {
-                    fprintf(stderr,"found (%s) vout in mempool\n",coinaddr);
-                    return(1);
-                }
-            }
-        }
+        fprintf(stderr,"found (%s) vout in mempool\n",coinaddr);
+        return(1);
     }
     return(0);
 }
@@ -1216,12 +1204,13 @@ UniValue GatewaysMultisig(char *cctxidaddr)
         }
     }
     
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
+    // partial signings in the mempool pay their marker to cctxidaddr like the confirmed ones
+    std::vector<COutPoint> outputs;
+    mempool.getAddressOutputs(cctxidaddr,outputs);
+    for (const COutPoint &output : outputs)
     {
-        const CTransaction &txmempool = e.GetTx();
-        const uint256 &hash = txmempool.GetHash();
-
-        if ((numvouts=txmempool.vout.size()) > 0 && DecodeGatewaysPartialOpRet(txmempool.vout[numvouts-1].scriptPubKey,K,signerpk,refcoin,hex) == 'P' && K>maxK)
+        CTransaction txmempool;
+        if (mempool.lookup(output.hash,txmempool) != 0 && (numvouts=txmempool.vout.size()) > 0 && DecodeGatewaysPartialOpRet(txmempool.vout[numvouts-1].scriptPubKey,K,signerpk,refcoin,hex) == 'P' && K>maxK)
         {
             maxK=K;
             parthex=hex;
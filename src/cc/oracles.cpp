@@ -15,6 +15,7 @@
 
 #include "CCOracles.h"
 #include <secp256k1.h>
+#include <deque>
 
 /*
  An oracles CC has the purpose of converting offchain data into onchain data
@@ -243,15 +244,11 @@ int64_t OracleDatafee(CScript &scriptPubKey,uint256 oracletxid,CPubKey publisher
 
 static uint256 myIs_baton_spentinmempool(uint256 batontxid,int32_t batonvout)
 {
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
+    uint256 txid; uint32_t nIn;
+    if ( mempool.getSpender(COutPoint(batontxid,batonvout),txid,nIn) != 0 && nIn == 1 )
     {
-        const CTransaction &tx = e.GetTx();
-        if ( tx.vout.size() > 0 && tx.vin.size() > 1 && batontxid == tx.vin[1].prevout.hash && batonvout == tx.vin[1].prevout.n )
-        {
-            const uint256 &txid = tx.GetHash();
-            //char str[65]; fprintf(stderr,"found baton spent in mempool %s\n",uint256_str(str,txid));
-            return(txid);
-        }
+        //char str[65]; fprintf(stderr,"found baton spent in mempool %s\n",uint256_str(str,txid));
+        return(txid);
     }
     return(batontxid);
 }
@@ -294,8 +291,8 @@ uint256 OracleBatonUtxo(uint64_t txfee,struct CCcontract_info *cp,uint256 refora
             }
         }
     }
-    while ( myIsutxo_spentinmempool(batontxid,1) != 0 )
-        batontxid = myIs_baton_spentinmempool(batontxid,1);
+    while ( (txid= myIs_baton_spentinmempool(batontxid,1)) != batontxid )
+        batontxid = txid;
     return(batontxid);
 }
 
@@ -463,69 +460,193 @@ int64_t OracleCorrelatedPrice(int32_t height,std::vector <int64_t> origprices)
     return(price);
 }
 
-int32_t oracleprice_add(std::vector<struct oracleprice_info> &publishers,CPubKey pk,int32_t height,std::vector <uint8_t> data,int32_t maxheight)
+/*
+ Prices and samples are read from a per oracle index instead of from transactions. An oracle is loaded on first use from its marker and baton utxos, walking each publisher's baton chain back for its most recent ORACLES_MAXSAMPLES data points. From then on ConnectBlock adds the registrations and data of each new block, newest first, and DisconnectTip drops the oracles a block touched so they are loaded again. Loading reads transactions, which takes cs_main while block connection holds cs_main and then cs_oracles_index, so it runs without the lock and its result is only kept if no oracle tx was connected or disconnected meanwhile.
+ */
+
+#define ORACLES_MAXSAMPLES 256
+
+struct oracles_sample
 {
-    struct oracleprice_info item; int32_t flag = 0;
-    for (std::vector<struct oracleprice_info>::iterator it=publishers.begin(); it!=publishers.end(); it++)
+    uint256 txid,prevbatontxid;
+    std::vector<uint8_t> data;
+};
+
+struct oracles_publisher
+{
+    int32_t regheight;
+    int64_t datafee;
+    std::deque<struct oracles_sample> samples;
+};
+
+struct oracles_index
+{
+    std::string format;
+    std::map<CPubKey,struct oracles_publisher> publishers;
+};
+
+static CCriticalSection cs_oracles_index;
+static std::map<uint256,struct oracles_index> Oracles_index;
+static uint64_t Oracles_index_generation;
+
+static bool oracles_index_load(struct oracles_index &index,uint256 reforacletxid)
+{
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs,batonOutputs;
+    CTransaction tx; uint256 hashBlock,txid,oracletxid,batontxid,btxid; CPubKey pk,batonpk; int64_t datafee; int32_t ht,dheight,numvouts; char markeraddr[64],batonaddr[64]; std::string name,description; std::vector<uint8_t> data; struct oracles_sample sample;
+    if ( GetTransaction(reforacletxid,tx,hashBlock,false) == 0 || (numvouts= tx.vout.size()) <= 0 || DecodeOraclesCreateOpRet(tx.vout[numvouts-1].scriptPubKey,name,description,index.format) != 'C' )
+        return(false);
+    CCtxidaddr(markeraddr,reforacletxid);
+    SetCCunspents(unspentOutputs,markeraddr);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
-        if ( pk == it->pk )
+        txid = it->first.txhash;
+        ht = (int32_t)it->second.blockHeight;
+        if ( GetTransaction(txid,tx,hashBlock,false) == 0 || (numvouts= tx.vout.size()) < 2 || DecodeOraclesOpRet(tx.vout[numvouts-1].scriptPubKey,oracletxid,pk,datafee) != 'R' || oracletxid != reforacletxid )
+            continue;
+        if ( index.publishers.count(pk) != 0 )
         {
-            flag = 1;
-            if ( height > it->height )
+            struct oracles_publisher &pub = index.publishers[pk];
+            if ( ht > pub.regheight )
             {
-                it->height = height;
-                it->data = data;
-                return(height);
+                pub.regheight = ht;
+                pub.datafee = datafee;
             }
+            continue;
+        }
+        struct oracles_publisher &pub = index.publishers[pk];
+        pub.regheight = ht;
+        pub.datafee = datafee;
+        // the latest data point is the highest unspent data baton, from there the batons link back
+        Getscriptaddress(batonaddr,tx.vout[1].scriptPubKey);
+        batonOutputs.clear();
+        SetCCunspents(batonOutputs,batonaddr);
+        batontxid = zeroid;
+        dheight = 0;
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator bt=batonOutputs.begin(); bt!=batonOutputs.end(); bt++)
+        {
+            if ( bt->second.satoshis != 10000 || (int32_t)bt->second.blockHeight <= dheight )
+                continue;
+            if ( GetTransaction(bt->first.txhash,tx,hashBlock,false) != 0 && (numvouts= tx.vout.size()) > 0 && DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,btxid,batonpk,data) == 'D' && oracletxid == reforacletxid && batonpk == pk )
+            {
+                dheight = (int32_t)bt->second.blockHeight;
+                batontxid = bt->first.txhash;
+            }
+        }
+        while ( batontxid != zeroid && pub.samples.size() < ORACLES_MAXSAMPLES && GetTransaction(batontxid,tx,hashBlock,false) != 0 && (numvouts= tx.vout.size()) > 0 && DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,btxid,batonpk,data) == 'D' && oracletxid == reforacletxid )
+        {
+            sample.txid = batontxid;
+            sample.prevbatontxid = btxid;
+            sample.data = data;
+            pub.samples.push_back(sample);
+            batontxid = btxid;
         }
     }
-    if ( flag == 0 )
+    return(true);
+}
+
+// makes sure the oracle is indexed, tmp gets the loaded index when it could not be kept
+static bool oracles_index_prepare(uint256 reforacletxid,struct oracles_index &tmp)
+{
+    uint64_t generation;
     {
-        item.pk = pk;
-        item.data = data;
-        item.height = height;
-        publishers.push_back(item);
-        return(height);
-    } else return(0);
+        LOCK(cs_oracles_index);
+        if ( Oracles_index.count(reforacletxid) != 0 )
+            return(true);
+        generation = Oracles_index_generation;
+    }
+    if ( oracles_index_load(tmp,reforacletxid) == 0 )
+        return(false);
+    LOCK(cs_oracles_index);
+    if ( generation == Oracles_index_generation )
+        Oracles_index[reforacletxid] = tmp;
+    return(true);
 }
 
-int64_t OraclePrice(int32_t height,uint256 reforacletxid,char *markeraddr,char *format)
+// cs_oracles_index must be held. Null if a disconnect dropped the oracle since oracles_index_prepare
+static const struct oracles_index *oracles_index_find(uint256 reforacletxid,const struct oracles_index &tmp)
 {
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-    CTransaction regtx; uint256 hash,txid,oracletxid,batontxid; CPubKey pk; int32_t i,ht,maxheight=0; int64_t datafee,price; char batonaddr[64]; std::vector <uint8_t> data; struct CCcontract_info *cp,C; std::vector <struct oracleprice_info> publishers; std::vector <int64_t> prices;
-    if ( format[0] != 'L' )
-        return(0);
-    cp = CCinit(&C,EVAL_ORACLES);
-    SetCCunspents(unspentOutputs,markeraddr);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
+    std::map<uint256,struct oracles_index>::const_iterator it = Oracles_index.find(reforacletxid);
+    if ( it != Oracles_index.end() )
+        return(&it->second);
+    if ( tmp.format.size() > 0 )
+        return(&tmp);
+    return(0);
+}
+
+void OraclesIndexUpdate(const CBlock &block,int32_t height,int32_t connectflag)
+{
+    uint256 oracletxid,btxid; CPubKey pk; int64_t datafee; int32_t numvouts; uint8_t funcid; std::vector<uint8_t> data; struct oracles_sample sample;
+    LOCK(cs_oracles_index);
+    for (const CTransaction &tx : block.vtx)
     {
-        txid = it->first.txhash;
-        ht = (int32_t)it->second.blockHeight;
-        if ( myGetTransaction(txid,regtx,hash) != 0 )
+        if ( (numvouts= tx.vout.size()) < 2 )
+            continue;
+        const CScript &opret = tx.vout[numvouts-1].scriptPubKey;
+        if ( (funcid= DecodeOraclesData(opret,oracletxid,btxid,pk,data)) != 'D' && (funcid= DecodeOraclesOpRet(opret,oracletxid,pk,datafee)) != 'R' )
+            continue;
+        Oracles_index_generation++;
+        std::map<uint256,struct oracles_index>::iterator it = Oracles_index.find(oracletxid);
+        if ( it == Oracles_index.end() )
+            continue;
+        if ( connectflag == 0 )
         {
-            if ( regtx.vout.size() > 0 && DecodeOraclesOpRet(regtx.vout[regtx.vout.size()-1].scriptPubKey,oracletxid,pk,datafee) == 'R' && oracletxid == reforacletxid )
-            {
-                Getscriptaddress(batonaddr,regtx.vout[1].scriptPubKey);
-                batontxid = OracleBatonUtxo(10000,cp,oracletxid,batonaddr,pk,data);
-                if ( batontxid != zeroid && (ht= oracleprice_add(publishers,pk,ht,data,maxheight)) > maxheight )
-                    maxheight = ht;
-            }
+            Oracles_index.erase(it);
+            continue;
+        }
+        if ( funcid == 'R' )
+        {
+            struct oracles_publisher &pub = it->second.publishers[pk];
+            pub.regheight = height;
+            pub.datafee = datafee;
+            continue;
         }
+        std::map<CPubKey,struct oracles_publisher>::iterator pt = it->second.publishers.find(pk);
+        if ( pt == it->second.publishers.end() )
+            continue;
+        std::deque<struct oracles_sample> &samples = pt->second.samples;
+        // VerifyDB reconnects blocks that are already indexed
+        if ( samples.empty() == 0 && samples.front().txid == tx.GetHash() )
+            continue;
+        sample.txid = tx.GetHash();
+        sample.prevbatontxid = btxid;
+        sample.data = data;
+        samples.push_front(sample);
+        if ( samples.size() > ORACLES_MAXSAMPLES )
+            samples.pop_back();
     }
-    if ( maxheight > 10 )
+}
+
+// newest confirmed sample of each recent registrant. OracleBatonUtxo also followed the baton through
+// the mempool, but the data it returned was always the confirmed baton's, and a price that validation
+// may use must not depend on this node's mempool
+int64_t OraclePrice(int32_t height,uint256 reforacletxid,char *markeraddr,char *format)
+{
+    struct oracles_index tmp; const struct oracles_index *index; uint256 hash; int32_t maxheight=0; int64_t price; std::vector <int64_t> prices;
+    if ( format[0] != 'L' )
+        return(0);
+    if ( oracles_index_prepare(reforacletxid,tmp) == 0 )
+        return(0);
     {
-        for (std::vector<struct oracleprice_info>::const_iterator it=publishers.begin(); it!=publishers.end(); it++)
+        LOCK(cs_oracles_index);
+        if ( (index= oracles_index_find(reforacletxid,tmp)) == 0 )
+            return(0);
+        for (std::map<CPubKey,struct oracles_publisher>::const_iterator it=index->publishers.begin(); it!=index->publishers.end(); it++)
+            if ( it->second.regheight > maxheight )
+                maxheight = it->second.regheight;
+        if ( maxheight <= 10 )
+            return(0);
+        for (std::map<CPubKey,struct oracles_publisher>::const_iterator it=index->publishers.begin(); it!=index->publishers.end(); it++)
         {
-            if ( it->height >= maxheight-10 )
+            if ( it->second.regheight >= maxheight-10 && it->second.samples.empty() == 0 )
             {
-                oracle_format(&hash,&price,0,'L',(uint8_t *)it->data.data(),0,(int32_t)it->data.size());
+                const std::vector<uint8_t> &data = it->second.samples.front().data;
+                oracle_format(&hash,&price,0,'L',(uint8_t *)data.data(),0,(int32_t)data.size());
                 if ( price != 0 )
                     prices.push_back(price);
             }
         }
-        return(OracleCorrelatedPrice(height,prices));
     }
-    return(0);
+    return(OracleCorrelatedPrice(height,prices));
 }
 
 int64_t IsOraclesvout(struct CCcontract_info *cp,const CTransaction& tx,int32_t v)
@@ -855,25 +976,46 @@ UniValue OracleFormat(uint8_t *data,int32_t datalen,char *format,int32_t formatl
 
 UniValue OracleDataSamples(uint256 reforacletxid,uint256 batontxid,int32_t num)
 {
-    UniValue result(UniValue::VOBJ),a(UniValue::VARR); CTransaction tx,oracletx; uint256 hashBlock,btxid,oracletxid; CPubKey pk; std::string name,description,format; int32_t numvouts,n=0; std::vector<uint8_t> data; char *formatstr = 0;
+    UniValue result(UniValue::VOBJ),a(UniValue::VARR); CTransaction tx; uint256 hashBlock,btxid,oracletxid; CPubKey pk; std::string format; int32_t numvouts,n=0; std::vector<uint8_t> data; char *formatstr = 0; struct oracles_index tmp; const struct oracles_index *index;
     result.push_back(Pair("result","success"));
-    if ( GetTransaction(reforacletxid,oracletx,hashBlock,false) != 0 && (numvouts=oracletx.vout.size()) > 0 )
+    if ( oracles_index_prepare(reforacletxid,tmp) != 0 )
     {
-        if ( DecodeOraclesCreateOpRet(oracletx.vout[numvouts-1].scriptPubKey,name,description,format) == 'C' )
+        LOCK(cs_oracles_index);
+        if ( (index= oracles_index_find(reforacletxid,tmp)) != 0 )
         {
-            while ( GetTransaction(batontxid,tx,hashBlock,false) != 0 && (numvouts=tx.vout.size()) > 0 )
+            format = index->format;
+            if ( (formatstr= (char *)format.c_str()) == 0 )
+                formatstr = (char *)"";
+            // serve as much of the chain as the publisher's recent samples hold
+            for (std::map<CPubKey,struct oracles_publisher>::const_iterator it=index->publishers.begin(); it!=index->publishers.end() && n == 0; it++)
             {
-                if ( DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,btxid,pk,data) == 'D' && reforacletxid == oracletxid )
+                const std::deque<struct oracles_sample> &samples = it->second.samples;
+                for (std::deque<struct oracles_sample>::const_iterator st=samples.begin(); st!=samples.end() && n < num; st++)
                 {
-                    if ( (formatstr= (char *)format.c_str()) == 0 )
-                        formatstr = (char *)"";
-                    a.push_back(OracleFormat((uint8_t *)data.data(),(int32_t)data.size(),formatstr,(int32_t)format.size()));
-                    batontxid = btxid;
-                    if ( ++n >= num )
+                    if ( n == 0 && st->txid != batontxid )
+                        continue;
+                    else if ( st->txid != batontxid )
                         break;
-                } else break;
+                    a.push_back(OracleFormat((uint8_t *)st->data.data(),(int32_t)st->data.size(),formatstr,(int32_t)format.size()));
+                    batontxid = st->prevbatontxid;
+                    n++;
+                }
             }
         }
+        else format.clear();
+    }
+    if ( format.size() > 0 && n < num )
+    {
+        while ( GetTransaction(batontxid,tx,hashBlock,false) != 0 && (numvouts=tx.vout.size()) > 0 )
+        {
+            if ( DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,btxid,pk,data) == 'D' && reforacletxid == oracletxid )
+            {
+                a.push_back(OracleFormat((uint8_t *)data.data(),(int32_t)data.size(),formatstr,(int32_t)format.size()));
+                batontxid = btxid;
+                if ( ++n >= num )
+                    break;
+            } else break;
+        }
     }
     result.push_back(Pair("samples",a));
     return(result);
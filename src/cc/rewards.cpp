@@ -298,15 +298,18 @@ bool RewardsValidate(struct CCcontract_info *cp,Eval* eval,const CTransaction &t
     return(true);
 }
 
-static uint64_t myIs_unlockedtx_inmempool(uint256 &txid,int32_t &vout,uint64_t refsbits,uint256 reffundingtxid,uint64_t needed)
+static uint64_t myIs_unlockedtx_inmempool(uint256 &txid,int32_t &vout,char *coinaddr,uint64_t refsbits,uint256 reffundingtxid,uint64_t needed)
 {
-    uint8_t funcid; uint64_t sbits,nValue; uint256 fundingtxid; char str[65];
+    uint8_t funcid; uint64_t sbits,nValue; uint256 fundingtxid; char str[65]; CTransaction tx; std::vector<COutPoint> outputs;
     memset(&txid,0,sizeof(txid));
     vout = -1;
     nValue = 0;
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
+    // the unlock change goes back to the rewards CC address in vout.0
+    mempool.getAddressOutputs(coinaddr,outputs);
+    for (const COutPoint &output : outputs)
     {
-        const CTransaction &tx = e.GetTx();
+        if ( output.n != 0 || mempool.lookup(output.hash,tx) == 0 )
+            continue;
         if ( tx.vout.size() > 0 && tx.vout[0].nValue >= needed )
         {
             const uint256 &hash = tx.GetHash();
@@ -376,7 +379,7 @@ int64_t AddRewardsInputs(CScript &scriptPubKey,uint64_t maxseconds,struct CCcont
     if ( maxseconds == 0 && totalinputs < total && (maxinputs == 0 || n < maxinputs-1) )
     {
         fprintf(stderr,"search mempool for unlocked and unspent CC rewards output for %.8f\n",(double)(total-totalinputs)/COIN);
-        if ( (nValue= myIs_unlockedtx_inmempool(txid,vout,refsbits,reffundingtxid,total-totalinputs)) > 0 )
+        if ( (nValue= myIs_unlockedtx_inmempool(txid,vout,coinaddr,refsbits,reffundingtxid,total-totalinputs)) > 0 )
         {
             mtx.vin.push_back(CTxIn(txid,vout,CScript()));
             fprintf(stderr,"added mempool vout for %.8f\n",(double)nValue/COIN);
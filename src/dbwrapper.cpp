@@ -82,7 +82,12 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
-CDBIterator::~CDBIterator() { delete piter; }
+CDBIterator::~CDBIterator()
+{
+    delete piter;
+    if (psnapshot != NULL)
+        parent.pdb->ReleaseSnapshot(psnapshot);
+}
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::SeekToLast() { piter->SeekToLast(); }
@@ -85,15 +85,17 @@ class CDBIterator
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
+    const leveldb::Snapshot *psnapshot;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
      * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _psnapshot       Read snapshot owned by this iterator, released on destruction (may be NULL).
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter, const leveldb::Snapshot *_psnapshot = NULL) :
+        parent(_parent), piter(_piter), psnapshot(_psnapshot) { };
     ~CDBIterator();
 
     bool Valid();
@@ -156,6 +158,7 @@ public:
 
 class CDBWrapper
 {
+    friend class CDBIterator;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -267,6 +270,19 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /**
+     * Return an iterator over a consistent point-in-time view of the database.
+     * Writes made after this call are not visible through it, so callers can
+     * walk large ranges without holding the locks that serialize writers.
+     */
+    CDBIterator *NewSnapshotIterator()
+    {
+        const leveldb::Snapshot *psnapshot = pdb->GetSnapshot();
+        leveldb::ReadOptions snapoptions = iteroptions;
+        snapoptions.snapshot = psnapshot;
+        return new CDBIterator(*this, pdb->NewIterator(snapoptions), psnapshot);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
@@ -8,11 +8,16 @@
 #include "primitives/transaction.h"
 #include "txmempool.h"
 #include "policy/fees.h"
+#include "random.h"
+#include "script/standard.h"
 #include "util.h"
 
 // Implementation is in test_checktransaction.cpp
 extern CMutableTransaction GetValidTransaction();
 
+extern uint32_t ASSETCHAINS_CC;
+bool Getscriptaddress(char *destaddr,const CScript &scriptPubKey);
+
 // Fake the input of transaction 5295156213414ed77f6e538e7e8ebe14492156906b9fe995b242477818789364
 // - 532639cc6bebed47c1c69ae36dd498c68a012e74ad12729adbd3dbb56f8f3f4a, 0
 class FakeCoinsViewDB : public CCoinsView {
@@ -285,3 +290,129 @@ TEST(Mempool, SproutNegativeVersionTxWhenOverwinterActive) {
     // Revert to default
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
+
+static CKeyID RandomKeyID()
+{
+    std::vector<unsigned char> vch(20);
+    GetRandBytes(vch.data(), vch.size());
+    return CKeyID(uint160(vch));
+}
+
+static CTransaction AddressOutputsTx(const COutPoint &prevout, const CScript &scriptPubKey, int nOutputs)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = prevout;
+    for (int i = 0; i < nOutputs; i++) {
+        mtx.vout.push_back(CTxOut(1000 + i, scriptPubKey));
+    }
+    return CTransaction(mtx);
+}
+
+static void AddToPool(CTxMemPool &pool, const CTransaction &tx)
+{
+    CTxMemPoolEntry entry(tx, 0, 0, 0.0, 1, false, false, SPROUT_BRANCH_ID);
+    pool.addUnchecked(tx.GetHash(), entry);
+}
+
+static std::vector<COutPoint> PoolAddressOutputs(const CTxMemPool &pool, const std::string &coinaddr)
+{
+    std::vector<COutPoint> outputs;
+    if (!pool.getAddressOutputs(coinaddr, outputs)) {
+        EXPECT_TRUE(outputs.empty());
+    }
+    std::sort(outputs.begin(), outputs.end());
+    return outputs;
+}
+
+static bool PoolSpender(const CTxMemPool &pool, const COutPoint &outpoint, uint256 &spender)
+{
+    uint32_t nIn = 0xffffffff;
+    if (!pool.getSpender(outpoint, spender, nIn))
+        return false;
+    EXPECT_EQ(0U, nIn);
+    return true;
+}
+
+TEST(Mempool, SpenderAndAddressOutputs) {
+    SelectParams(CBaseChainParams::REGTEST);
+    uint32_t prevCC = ASSETCHAINS_CC;
+    ASSETCHAINS_CC = 1;
+
+    CScript script1 = GetScriptForDestination(RandomKeyID());
+    CScript script2 = GetScriptForDestination(RandomKeyID());
+    char addr1[64], addr2[64];
+    ASSERT_TRUE(Getscriptaddress(addr1, script1));
+    ASSERT_TRUE(Getscriptaddress(addr2, script2));
+
+    COutPoint funding(GetRandHash(), 3);
+    CTransaction parent = AddressOutputsTx(funding, script1, 2);
+    CTransaction child = AddressOutputsTx(COutPoint(parent.GetHash(), 0), script2, 1);
+
+    std::vector<COutPoint> parentOutputs;
+    parentOutputs.push_back(COutPoint(parent.GetHash(), 0));
+    parentOutputs.push_back(COutPoint(parent.GetHash(), 1));
+    std::sort(parentOutputs.begin(), parentOutputs.end());
+    std::vector<COutPoint> childOutputs;
+    childOutputs.push_back(COutPoint(child.GetHash(), 0));
+    std::vector<COutPoint> none;
+
+    CTxMemPool pool(CFeeRate(0));
+    std::list<CTransaction> removed;
+    uint256 spender;
+
+    // Add the parent, then its child
+    AddToPool(pool, parent);
+    EXPECT_TRUE(PoolSpender(pool, funding, spender));
+    EXPECT_EQ(parent.GetHash(), spender);
+    EXPECT_FALSE(PoolSpender(pool, COutPoint(parent.GetHash(), 0), spender));
+    EXPECT_EQ(parentOutputs, PoolAddressOutputs(pool, addr1));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr2));
+
+    AddToPool(pool, child);
+    EXPECT_TRUE(PoolSpender(pool, COutPoint(parent.GetHash(), 0), spender));
+    EXPECT_EQ(child.GetHash(), spender);
+    EXPECT_FALSE(PoolSpender(pool, COutPoint(parent.GetHash(), 1), spender));
+    EXPECT_EQ(parentOutputs, PoolAddressOutputs(pool, addr1));
+    EXPECT_EQ(childOutputs, PoolAddressOutputs(pool, addr2));
+
+    // Remove the child on its own, the parent's entries stay
+    pool.remove(child, removed, false);
+    EXPECT_EQ(1U, removed.size());
+    EXPECT_FALSE(PoolSpender(pool, COutPoint(parent.GetHash(), 0), spender));
+    EXPECT_TRUE(PoolSpender(pool, funding, spender));
+    EXPECT_EQ(parent.GetHash(), spender);
+    EXPECT_EQ(parentOutputs, PoolAddressOutputs(pool, addr1));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr2));
+
+    // Remove the parent recursively, which takes the child with it
+    AddToPool(pool, child);
+    removed.clear();
+    pool.remove(parent, removed, true);
+    EXPECT_EQ(2U, removed.size());
+    EXPECT_EQ(0U, pool.size());
+    EXPECT_FALSE(PoolSpender(pool, funding, spender));
+    EXPECT_FALSE(PoolSpender(pool, COutPoint(parent.GetHash(), 0), spender));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr1));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr2));
+
+    // Clear the pool
+    AddToPool(pool, parent);
+    AddToPool(pool, child);
+    EXPECT_EQ(childOutputs, PoolAddressOutputs(pool, addr2));
+    pool.clear();
+    EXPECT_FALSE(PoolSpender(pool, funding, spender));
+    EXPECT_FALSE(PoolSpender(pool, COutPoint(parent.GetHash(), 0), spender));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr1));
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr2));
+
+    // Without ASSETCHAINS_CC only the spenders are indexed
+    ASSETCHAINS_CC = 0;
+    AddToPool(pool, parent);
+    EXPECT_TRUE(PoolSpender(pool, funding, spender));
+    EXPECT_EQ(parent.GetHash(), spender);
+    EXPECT_EQ(none, PoolAddressOutputs(pool, addr1));
+    pool.clear();
+
+    ASSETCHAINS_CC = prevCC;
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include "random.h"
+#include "uint256.h"
+#include "safecoin_structs.h"
+
+#include <algorithm>
+
+void safecoin_notarized_update(struct safecoin_state *sp,int32_t nHeight,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid,uint256 MoM,int32_t MoMdepth);
+struct notarized_checkpoint *safecoin_npptr_scan(struct safecoin_state *sp,int32_t height,int *idx);
+struct notarized_checkpoint *safecoin_npptr_search(struct safecoin_state *sp,int32_t height,int *idx);
+
+static void ExpectSearchMatchesScan(struct safecoin_state *sp, int32_t maxHeight)
+{
+    for (int32_t height = -1; height <= maxHeight; height++) {
+        int idxScan = -2, idxSearch = -2;
+        struct notarized_checkpoint *npScan = safecoin_npptr_scan(sp, height, &idxScan);
+        struct notarized_checkpoint *npSearch = safecoin_npptr_search(sp, height, &idxSearch);
+        EXPECT_EQ(idxScan, idxSearch) << "height " << height;
+        EXPECT_EQ(npScan, npSearch) << "height " << height;
+    }
+}
+
+static void FreeState(struct safecoin_state *sp)
+{
+    free(sp->NPOINTS);
+    free(sp->MoMPOINTS);
+}
+
+TEST(Notary, NpptrSearchMatchesScan)
+{
+    struct safecoin_state sp;
+    memset(&sp, 0, sizeof(sp));
+    uint256 MoM = uint256S("01");
+
+    // Regular checkpoints with overlapping depths
+    for (int32_t i = 1; i <= 20; i++) {
+        safecoin_notarized_update(&sp, i * 10 + 5, i * 10, GetRandHash(), GetRandHash(), MoM, 5 + (i % 4) * 10);
+    }
+    // Equal notarized heights with different depths, the latest one must win
+    safecoin_notarized_update(&sp, 210, 200, GetRandHash(), GetRandHash(), MoM, 3);
+    safecoin_notarized_update(&sp, 211, 200, GetRandHash(), GetRandHash(), MoM, 50);
+    safecoin_notarized_update(&sp, 212, 200, GetRandHash(), GetRandHash(), MoM, 7);
+    // Out of order heights, as after a reorg, and a deep one reaching back over many points
+    safecoin_notarized_update(&sp, 220, 150, GetRandHash(), GetRandHash(), MoM, 20);
+    safecoin_notarized_update(&sp, 221, 95, GetRandHash(), GetRandHash(), MoM, 2);
+    safecoin_notarized_update(&sp, 222, 180, GetRandHash(), GetRandHash(), MoM, 170);
+    safecoin_notarized_update(&sp, 223, 120, GetRandHash(), GetRandHash(), MoM, 1);
+    // No MoM depth, and flag bits above the depth
+    safecoin_notarized_update(&sp, 230, 225, GetRandHash(), GetRandHash(), uint256(), 0);
+    safecoin_notarized_update(&sp, 231, 226, GetRandHash(), GetRandHash(), MoM, 0x10000 | 4);
+    safecoin_notarized_update(&sp, 232, 227, GetRandHash(), GetRandHash(), MoM, 0x20000);
+    // Rejected, notarized height not below the block height
+    safecoin_notarized_update(&sp, 240, 240, GetRandHash(), GetRandHash(), MoM, 10);
+
+    ASSERT_EQ(30, sp.NUM_NPOINTS);
+    ASSERT_EQ(170, sp.MAX_MoMDEPTH);
+    ExpectSearchMatchesScan(&sp, 260);
+
+    // the deep out of order point covers up to 180, above that the deepest of the points at 200 wins
+    int idx;
+    EXPECT_EQ(&sp.NPOINTS[21], safecoin_npptr_search(&sp, 190, &idx));
+    EXPECT_EQ(21, idx);
+    EXPECT_EQ(&sp.NPOINTS[25], safecoin_npptr_search(&sp, 30, &idx));
+    EXPECT_EQ(25, idx);
+    EXPECT_TRUE(safecoin_npptr_search(&sp, 227, &idx) == NULL);
+    EXPECT_EQ(-1, idx);
+
+    FreeState(&sp);
+}
+
+TEST(Notary, NpptrSearchMatchesScanRandom)
+{
+    for (int round = 0; round < 20; round++) {
+        struct safecoin_state sp;
+        memset(&sp, 0, sizeof(sp));
+        uint256 MoM = uint256S("01");
+        int32_t maxHeight = 0;
+        for (int i = 0; i < 200; i++) {
+            int32_t notarized_height = 1 + GetRand(1000);
+            int32_t depth = GetRand(8) == 0 ? 0 : 1 + GetRand(GetRand(4) == 0 ? 300 : 30);
+            if (GetRand(10) == 0) {
+                depth |= 0x10000;
+            }
+            safecoin_notarized_update(&sp, notarized_height + 1 + GetRand(10), notarized_height, GetRandHash(), GetRandHash(), MoM, depth);
+            maxHeight = std::max(maxHeight, notarized_height);
+        }
+        ExpectSearchMatchesScan(&sp, maxHeight + 2);
+        FreeState(&sp);
+    }
+}
@@ -158,6 +158,76 @@ TEST(noteencryption, NotePlaintext)
     ASSERT_TRUE(bar.rcm == pt.rcm);
 }
 
+TEST(noteencryption, SaplingTrialDecrypt)
+{
+    using namespace libzcash;
+    std::vector<SaplingIncomingViewingKey> ivks;
+    for (int i = 0; i < 4; i++) {
+        ivks.push_back(SaplingSpendingKey::random().expanded_spending_key().full_viewing_key().in_viewing_key());
+    }
+    SaplingPaymentAddress addr = *ivks[2].address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    for (size_t i = 0; i < ZC_MEMO_SIZE; i++) {
+        // Fill the message with dummy data
+        memo[i] = (unsigned char) i;
+    }
+
+    SaplingNote note(addr, 39393);
+    uint256 cmu = note.cm().get();
+    SaplingNotePlaintext pt(note, memo);
+    auto res = pt.encrypt(addr.pk_d);
+    ASSERT_TRUE(static_cast<bool>(res));
+    auto ct = res->first;
+    auto epk = res->second.get_epk();
+    size_t ivkIndex;
+
+    // The first of several keys that decrypts is reported
+    std::vector<SaplingIncomingViewingKey> ivksTwice(ivks);
+    ivksTwice.push_back(ivks[2]);
+    auto found = SaplingNotePlaintext::trial_decrypt(ct, ivksTwice, epk, cmu, ivkIndex);
+    ASSERT_TRUE(static_cast<bool>(found));
+    EXPECT_EQ(2u, ivkIndex);
+    EXPECT_EQ(pt.value(), found->value());
+    EXPECT_TRUE(pt.memo() == found->memo());
+    EXPECT_TRUE(pt.d == found->d);
+    EXPECT_TRUE(pt.rcm == found->rcm);
+
+    // It matches decrypt with that key
+    auto single = SaplingNotePlaintext::decrypt(ct, ivks[2], epk, cmu);
+    ASSERT_TRUE(static_cast<bool>(single));
+    EXPECT_EQ(single->value(), found->value());
+    EXPECT_TRUE(single->rcm == found->rcm);
+
+    // None of the other keys decrypts, every one of them is tried
+    std::vector<SaplingIncomingViewingKey> ivksOther {ivks[0], ivks[1], ivks[3]};
+    EXPECT_FALSE(SaplingNotePlaintext::trial_decrypt(ct, ivksOther, epk, cmu, ivkIndex));
+    EXPECT_EQ(ivksOther.size(), ivkIndex);
+
+    // The right key with the wrong commitment is not a match either
+    EXPECT_FALSE(SaplingNotePlaintext::trial_decrypt(ct, ivks, epk, uint256(), ivkIndex));
+    EXPECT_EQ(ivks.size(), ivkIndex);
+
+    // No keys
+    EXPECT_FALSE(SaplingNotePlaintext::trial_decrypt(ct, std::vector<SaplingIncomingViewingKey>(), epk, cmu, ivkIndex));
+    EXPECT_EQ(0u, ivkIndex);
+
+    // An epk that is not a Jubjub point fails key agreement on the first key and skips the rest
+    uint256 badEpk = uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    bool fInvalidEpk = false;
+    EXPECT_FALSE(AttemptSaplingEncDecryption(ct, ivks[2], badEpk, fInvalidEpk));
+    EXPECT_TRUE(fInvalidEpk);
+    EXPECT_FALSE(SaplingNotePlaintext::trial_decrypt(ct, ivks, badEpk, cmu, ivkIndex));
+    EXPECT_EQ(0u, ivkIndex);
+
+    // A valid epk that is not the output's leaves fInvalidEpk unset and tries every key
+    auto other = *SaplingNoteEncryption::FromDiversifier(addr.d);
+    EXPECT_FALSE(AttemptSaplingEncDecryption(ct, ivks[2], other.get_epk(), fInvalidEpk));
+    EXPECT_FALSE(fInvalidEpk);
+    EXPECT_FALSE(SaplingNotePlaintext::trial_decrypt(ct, ivks, other.get_epk(), cmu, ivkIndex));
+    EXPECT_EQ(ivks.size(), ivkIndex);
+}
+
 TEST(noteencryption, SaplingApi)
 {
     using namespace libzcash;
@@ -24,6 +24,7 @@
 #include "notarisationdb.h"
 #include "net.h"
 #include "pow.h"
+#include "scheduler.h"
 #include "script/interpreter.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -78,6 +79,8 @@ int32_t safecoin_block2pubkey33(uint8_t *pubkey33,CBlock *block);
 void safecoin_broadcast(CBlock *pblock,int32_t limit);
 bool Getscriptaddress(char *destaddr,const CScript &scriptPubKey);
 void safecoin_setactivation(int32_t height);
+void CCaddress_cache_invalidate(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex);
+void OraclesIndexUpdate(const CBlock &block,int32_t height,int32_t connectflag);
 
 BlockMap mapBlockIndex;
 CChain chainActive;
@@ -93,6 +96,7 @@ bool fTxIndex = false;
 bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
+bool fAddressBalanceIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
@@ -112,7 +116,6 @@ unsigned int expiryDelta = DEFAULT_TX_EXPIRY_DELTA;
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 
 CTxMemPool mempool(::minRelayTxFee);
-CTxMemPool tmpmempool(::minRelayTxFee);
 
 struct COrphanTx {
     CTransaction tx;
@@ -630,15 +633,15 @@ CBlockTreeDB *pblocktree = NULL;
 #define SAFECOIN_ZCASH
 #include "safecoin.h"
 
-UniValue safecoin_snapshot(int top)
+UniValue safecoin_snapshot(int top,const std::string &exportfile)
 {
-    LOCK(cs_main);
+    // CBlockTreeDB::Snapshot only takes cs_main long enough to pin a LevelDB read snapshot
     int64_t total = -1;
     UniValue result(UniValue::VOBJ);
 
     if (fAddressIndex) {
 	    if ( pblocktree != 0 ) {
-		result = pblocktree->Snapshot(top);
+		result = pblocktree->Snapshot(top,exportfile);
 	    } else {
 		fprintf(stderr,"null pblocktree start with -addressindex=1\n");
 	    }
@@ -1987,6 +1990,92 @@ bool GetAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
+bool GetAddressIndex(uint160 addressHash, int type,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                     int start, int end, const CAddressIndexKey *pafter, size_t limit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, pafter, limit))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressUnspent(uint160 addressHash, int type,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       const CAddressUnspentKey *pafter, size_t limit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs, pafter, limit))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    if (!fAddressBalanceIndex)
+        return error("address balance index not enabled");
+
+    if (!pblocktree->ReadAddressBalanceIndex(addressHash, type, value))
+        return error("unable to get balance for address");
+
+    return true;
+}
+
+/**
+ * Adds the address index entries of a block to the running per address totals, or takes them
+ * back off when it is disconnected. The totals remember which block they are at, so a block
+ * VerifyDB connects again below the tip is not counted twice. Any other mismatch, e.g. a block
+ * reorged out after an unclean shutdown without being disconnected, rebuilds the totals from
+ * the address index, which already has this block's entries written or erased.
+ */
+static bool UpdateAddressBalances(const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, const CBlockIndex *pindex, bool fConnect)
+{
+    AssertLockHeld(cs_main);
+    uint256 hashBest;
+    pblocktree->ReadAddressBalanceBestBlock(hashBest);
+    const uint256 hashExpected = fConnect ? (pindex->pprev != NULL ? pindex->pprev->GetBlockHash() : uint256()) : pindex->GetBlockHash();
+    const uint256 hashAfter = fConnect ? pindex->GetBlockHash() : pindex->pprev->GetBlockHash();
+    if (hashBest != hashExpected && !(fConnect && hashBest.IsNull())) {
+        if (fConnect) {
+            BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+            if (mi != mapBlockIndex.end() && mi->second->GetAncestor(pindex->GetHeight()) == pindex)
+                return true; // already counted, VerifyDB connecting a block below the tip again
+        }
+        LogPrintf("%s: address balances are at block %s, expected %s, rebuilding them from the address index\n", __func__, hashBest.ToString(), hashExpected.ToString());
+        return pblocktree->RebuildAddressBalanceIndex(hashAfter);
+    }
+
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> deltas;
+    std::set<std::pair<std::pair<unsigned int, uint160>, uint256> > txids;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
+        std::pair<unsigned int, uint160> address(it->first.type, it->first.hashBytes);
+        CAddressBalanceValue &delta = deltas[address];
+        delta.balance += it->second;
+        if (it->second > 0)
+            delta.received += it->second;
+        if (txids.insert(std::make_pair(address, it->first.txhash)).second)
+            delta.txcount++;
+    }
+
+    int sign = fConnect ? 1 : -1;
+    std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> > balances;
+    for (std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue>::const_iterator it=deltas.begin(); it!=deltas.end(); it++) {
+        CAddressBalanceValue value;
+        pblocktree->ReadAddressBalanceIndex(it->first.second, it->first.first, value);
+        value.balance += sign * it->second.balance;
+        value.received += sign * it->second.received;
+        value.txcount += sign * it->second.txcount;
+        balances.push_back(std::make_pair(CAddressIndexIteratorKey(it->first.first, it->first.second), value));
+    }
+    return pblocktree->UpdateAddressBalanceIndex(balances, hashAfter);
+}
+
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
 {
@@ -2022,10 +2111,83 @@ bool myAddtomempool(CTransaction &tx, CValidationState *pstate, bool fSkipExpiry
     else return(true);
 }
 
+/**
+ * Looked up before ConnectBlock's script checks start, so CC validators read the spent transactions
+ * from memory instead of each going to the mempool and disk. Per thread: each CScriptCheck carries
+ * the snapshot of the thread that created it and sets it while it runs, CC RPCs never see one.
+ * The snapshot outlives the checks, ConnectBlock declares it before the check queue control.
+ */
+static thread_local const CCInputsSnapshot *pCCInputsSnapshot = NULL;
+
+const CCInputsSnapshot *CCInputsSnapshotCurrent()
+{
+    return(pCCInputsSnapshot);
+}
+
+class CCInputsSnapshotScope
+{
+    const CCInputsSnapshot *prev;
+public:
+    CCInputsSnapshotScope(const CCInputsSnapshot *snapshot) : prev(pCCInputsSnapshot) { pCCInputsSnapshot = snapshot; }
+    ~CCInputsSnapshotScope() { pCCInputsSnapshot = prev; }
+};
+
+static thread_local const CCBlockOverlay *pCCBlockOverlay = NULL;
+
+const CCBlockOverlay *CCBlockOverlayCurrent()
+{
+    return(pCCBlockOverlay);
+}
+
+class CCBlockOverlayScope
+{
+    const CCBlockOverlay *prev;
+public:
+    CCBlockOverlayScope(const CCBlockOverlay *overlay) : prev(pCCBlockOverlay) { pCCBlockOverlay = overlay; }
+    ~CCBlockOverlayScope() { pCCBlockOverlay = prev; }
+};
+
+CCBlockOverlay::CCBlockOverlay(const CBlock &block)
+{
+    for (int32_t i=0; i<block.vtx.size(); i++)
+    {
+        const CTransaction &tx = block.vtx[i];
+        // the same txs that used to be readmitted to the mempool for CC checking
+        if ( tx.IsCoinBase() || (!tx.vjoinsplit.empty() && !tx.vShieldedSpend.empty()) || ((i == (block.vtx.size() - 1)) && (ASSETCHAINS_STAKED && safecoin_isPoS((CBlock *)&block) != 0)) )
+            continue;
+        mapTx[tx.GetHash()] = &tx;
+        for (const CTxIn &txin : tx.vin)
+            mapSpent[txin.prevout] = tx.GetHash();
+    }
+}
+
 bool myGetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock)
 {
     memset(&hashBlock,0,sizeof(hashBlock));
+    const CCInputsSnapshot *snapshot = pCCInputsSnapshot;
+    if ( snapshot != 0 )
+    {
+        CCInputsSnapshot::const_iterator it = snapshot->find(hash);
+        if ( it != snapshot->end() )
+        {
+            txOut = it->second.first;
+            hashBlock = it->second.second;
+            return true;
+        }
+    }
+    const CCBlockOverlay *overlay = pCCBlockOverlay;
+    if ( overlay != 0 )
+    {
+        std::map<uint256, const CTransaction*>::const_iterator it = overlay->mapTx.find(hash);
+        if ( it != overlay->mapTx.end() )
+        {
+            txOut = *it->second;
+            return true;
+        }
+    }
     // need a GetTransaction without lock so the validation code for assets can run without deadlock
+    // a block being connected is checked against itself and the chain only, never this node's mempool
+    if ( overlay == 0 )
     {
         //fprintf(stderr,"check mempool\n");
         if (mempool.lookup(hash, txOut))
@@ -2563,6 +2725,8 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 }
 
 bool CScriptCheck::operator()() {
+    CCInputsSnapshotScope ccscope(ccinputs);
+    CCBlockOverlayScope ccblockscope(ccblock);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     ServerTransactionSignatureChecker checker(ptxTo, nIn, amount, cacheStore, *txdata);
     if (!VerifyScript(scriptSig, scriptPubKey, nFlags, checker, consensusBranchId, &error)) {
@@ -2865,6 +3029,14 @@ namespace {
 
 } // anon namespace
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || pindex->pprev == NULL)
+        return false;
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
  * @param undo The undo object.
@@ -2906,7 +3078,7 @@ void ConnectNotarisations(const CBlock &block, int height)
     if (notarisations.size() > 0) {
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Write(block.GetHash(), notarisations);
-        WriteBackNotarisations(notarisations, batch);
+        WriteBackNotarisations(notarisations, height, batch);
         pnotarisations->WriteBatch(batch, true);
         LogPrintf("ConnectBlock: wrote %i block notarisations in block: %s\n",
                 notarisations.size(), block.GetHash().GetHex().data());
@@ -2914,14 +3086,14 @@ void ConnectNotarisations(const CBlock &block, int height)
 }
 
 
-void DisconnectNotarisations(const CBlock &block)
+void DisconnectNotarisations(const CBlock &block, int height)
 {
     // Delete from notarisations cache
     NotarisationsInBlock nibs;
     if (GetBlockNotarisations(block.GetHash(), nibs)) {
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Erase(block.GetHash());
-        EraseBackNotarisations(nibs, batch);
+        EraseBackNotarisations(nibs, height, batch);
         pnotarisations->WriteBatch(batch, true);
         LogPrintf("DisconnectTip: deleted %i block notarisations in block: %s\n",
             nibs.size(), block.GetHash().GetHex().data());
@@ -3098,6 +3270,11 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
             return AbortNode(state, "Failed to write address unspent index");
         }
+        CCaddress_cache_invalidate(addressUnspentIndex);
+
+        if (fAddressBalanceIndex && !UpdateAddressBalances(addressIndex, pindex, false)) {
+            return AbortNode(state, "Failed to write address balance index");
+        }
     }
 
     return fClean;
@@ -3225,6 +3402,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
     int32_t futureblock;
+    // CC contracts might refer to transactions in this block, from a CC spend within the same block and out of order
+    // set on this thread only, the checks created below carry it to the script check threads
+    CCBlockOverlay ccblock(block);
+    CCBlockOverlayScope ccblockscope(ASSETCHAINS_CC != 0 ? &ccblock : NULL);
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
     if (!CheckBlock(&futureblock,pindex->GetHeight(),pindex,block, state, fExpensiveChecks ? verifier : disabledVerifier, fCheckPOW, !fJustCheck) || futureblock != 0 )
     {
@@ -3289,7 +3470,33 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             sleep(1);
         }
     }
+    // declared before control, so it is only destroyed after the checks have finished
+    CCInputsSnapshot ccinputs;
     CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    if ( ASSETCHAINS_CC != 0 && fExpensiveChecks && nScriptCheckThreads )
+    {
+        // inputs created earlier in this block are not in view yet, those stay on the normal lookup
+        for (const CTransaction &tx : block.vtx)
+        {
+            if ( tx.IsCoinBase() )
+                continue;
+            for (const CTxIn &txin : tx.vin)
+            {
+                const CCoins *coins = view.AccessCoins(txin.prevout.hash);
+                if ( coins == 0 || !coins->IsAvailable(txin.prevout.n) || coins->vout[txin.prevout.n].scriptPubKey.IsPayToCryptoCondition() == 0 )
+                    continue;
+                if ( ccinputs.count(txin.prevout.hash) != 0 )
+                    continue;
+                CTransaction prevtx; uint256 hashBlock;
+                if ( myGetTransaction(txin.prevout.hash,prevtx,hashBlock) != 0 )
+                    ccinputs[txin.prevout.hash] = std::make_pair(prevtx,hashBlock);
+            }
+        }
+        if ( ccinputs.size() != 0 )
+            LogPrint("bench", "    - %u CC input transactions looked up ahead\n", ccinputs.size());
+    }
+    // the checks created below pick it up from this thread
+    CCInputsSnapshotScope ccscope(ccinputs.size() != 0 ? &ccinputs : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3583,7 +3790,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
             return AbortNode(state, "Failed to write address unspent index");
         }
+        CCaddress_cache_invalidate(addressUnspentIndex);
+
+        if (fAddressBalanceIndex && !UpdateAddressBalances(addressIndex, pindex, true)) {
+            return AbortNode(state, "Failed to write address balance index");
+        }
     }
+    // after the unspent index, so an oracle load racing it either sees this block's outputs or is discarded
+    if ( ASSETCHAINS_CC != 0 )
+        OraclesIndexUpdate(block,pindex->GetHeight(),1);
 
     if (fSpentIndex)
         if (!pblocktree->UpdateSpentIndex(spentIndex))
@@ -3626,7 +3841,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
 
     //FlushStateToDisk();
-    safecoin_connectblock(pindex,*(CBlock *)&block);
+    safecoin_connectblock(pindex,*(CBlock *)&block,&blockundo);
     return true;
 }
 
@@ -3750,6 +3965,182 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+/** SafeNode self-status, validated on the scheduler thread and consulted by UpdateTip */
+static CCriticalSection cs_safenode;
+static CScheduler *pSafeNodeScheduler = NULL;
+static bool fSafeNodeDirty = true;          // KV index or wallet balance changed since the last balance check
+static bool fSafeNodeFunded = false;        // wallet balance covered a registration at the last check
+static bool fSafeNodeScheduled = false;
+
+bool SafeNodeValidateParams(int32_t height, uint32_t timestamp, std::vector<std::string> &errors)
+{
+	bool safenode_valid = true; // presumption of innocence 
+	
+	std::string parentkey = GetArg("-parentkey", "");
+	std::string safekey = GetArg("-safekey", "");
+	std::string safeheight = GetArg("-safeheight", "");
+	
+	// checking parentkey
+	std::vector<std::string> notaries = vs_safecoin_notaries(height, timestamp);
+	if (std::find(notaries.begin(), notaries.end(), parentkey) == notaries.end())
+	{
+		errors.push_back("Invalid parentkey, should be a valid notary pubkey !");
+		safenode_valid = false;
+	}
+	
+	// checking safekey
+	if (str_safe_address(safekey) == "invalid")
+	{
+		errors.push_back("Invalid safekey, should be a valid safenode pubkey !");
+		safenode_valid = false;
+	}
+	
+	// checking safeheight
+	int32_t i_safeheight = 0; // presumption of guilt
+	try 
+	{
+		i_safeheight = std::stoi(safeheight);
+		if (i_safeheight < 750000) throw i_safeheight;
+		if (i_safeheight > height) throw i_safeheight;
+	}
+	catch (...)
+	{
+		errors.push_back("Invalid safeheight, should be a number >= 750000 and <= current height !");
+		safenode_valid = false;
+	}
+	return safenode_valid;
+}
+
+void SafeNodeStatusInvalidate()
+{
+	LOCK(cs_safenode);
+	fSafeNodeDirty = true;
+}
+
+static void SafeNodeRegistrationTask(int current_height)
+{
+	bool fRecheck;
+	{
+		LOCK(cs_safenode);
+		fSafeNodeScheduled = false;
+	}
+	
+	// validated against every tip, -safeheight and the notary season of -parentkey depend on it
+	std::vector<std::string> errors;
+	bool is_safenode_valid; // meaning parentkey, safekey and safeheight are validated
+	{
+		LOCK(cs_main);
+		CBlockIndex *pindex = chainActive.Tip();
+		is_safenode_valid = pindex != NULL && SafeNodeValidateParams(pindex->GetHeight(), pindex->GetBlockTime(), errors);
+	}
+	if (!is_safenode_valid || pwalletMain == NULL)
+		return;
+	
+	// only the wallet balance is cached, GetBalance walks the whole wallet
+	{
+		LOCK(cs_safenode);
+		fRecheck = fSafeNodeDirty;
+		fSafeNodeDirty = false;
+	}
+	if (fRecheck)
+	{
+		// check for required wallet balance, for registration expenses 
+		uint64_t wallet_balance = pwalletMain->GetBalance();
+		bool is_funded = wallet_balance >= 115000; // minimum required for registration tx
+		if (!is_funded)
+			LogPrintf("SAFENODES: Wallet balance %lu safetoshis < 115000, insufficient for safenode registration !!!\n", wallet_balance );
+		LOCK(cs_safenode);
+		fSafeNodeFunded = is_funded;
+	}
+	
+	{
+		LOCK(cs_safenode);
+		if (!fSafeNodeFunded)
+			return;
+	}
+	
+	string sk =  GetArg("-safekey", "");
+	boost::crc_16_type sk_crc;
+	sk_crc.process_bytes(sk.data(), sk.length());
+	int sk_checksum = sk_crc.checksum();
+	int id_by_checksum = sk_checksum % (REGISTRATION_TRIGGER_DAYS * 1440 / 2); // to trigger twice within REGISTRATION_TRIGGER_DAYS 
+	
+	// check for active safenode registration, if not found schedule it a.s.a.p.
+	bool no_active_registration = true;
+	int32_t saved_on_height,saved_duration; uint32_t saved_flags;
+	
+	// check whole REGISTRATION_TRIGGER_DAYS window
+	if (safecoin_safenode_lookup(sk, current_height, &saved_on_height, &saved_duration, &saved_flags) == 0 && (current_height - saved_on_height <= REGISTRATION_TRIGGER_DAYS * 1440))
+	{
+		// previous registration found within the search range
+		no_active_registration = false;
+		if (LogAcceptCategory("safenodes"))
+		{
+			LogPrint("safenodes", "SAFENODES: Active safeid registration found at block height %u: safeid %s\n", saved_on_height, sk.c_str());
+		}
+	}
+	
+	if ((id_by_checksum == current_height % (REGISTRATION_TRIGGER_DAYS * 1440 / 2)) || no_active_registration) // to trigger twice within REGISTRATION_TRIGGER_DAYS or NOW if there is no active registration
+	{
+		printf("Validate SafeNode at height %u\n", current_height);
+		std::string args;
+		std::string defaultpub = "0333b9796526ef8de88712a649d618689a1de1ed1adf9fb5ec415f31e560b1f9a3";
+		if (!GetArg("-parentkey", "").empty()) defaultpub = (GetArg("-parentkey", ""));
+		std::string safepass = GetArg("-safepass", "");
+
+		std::string padding = "0";
+		std::string safeheight =  GetArg("-safeheight", "");
+
+		uint32_t flag_from_days = (REGISTRATION_TRIGGER_DAYS - 1) << 2;
+
+		args = defaultpub + padding + safeheight + "1 " + sk + " " + std::to_string(flag_from_days) + " " + safepass;
+
+		vector<string> vArgs;
+		boost::split(vArgs, args, boost::is_any_of(" \t"));
+		// Handle empty strings the same way as CLI
+		for (auto i = 0; i < vArgs.size(); i++)
+		{
+			if (vArgs[i] == "\"\"")
+			{
+				vArgs[i] = "";
+			}
+		}
+
+		UniValue paramz(UniValue::VARR);
+		for (unsigned int idx = 0; idx < vArgs.size(); idx++)
+			paramz.push_back(vArgs[idx]);
+
+		try
+		{
+			kvupdate(paramz,false);
+		}
+		catch (const UniValue& objError)
+		{
+			LogPrintf("SAFENODES: registration failed: %s\n", find_value(objError, "message").get_str());
+		}
+		catch (const std::exception& e)
+		{
+			LogPrintf("SAFENODES: registration failed: %s\n", e.what());
+		}
+	}
+}
+
+void SafeNodeScheduleRegistration(int height)
+{
+	LOCK(cs_safenode);
+	if (pSafeNodeScheduler == NULL || fSafeNodeScheduled || (!fSafeNodeDirty && !fSafeNodeFunded))
+		return;
+	fSafeNodeScheduled = true;
+	pSafeNodeScheduler->scheduleFromNow(boost::bind(&SafeNodeRegistrationTask, height), 0);
+}
+
+void StartSafeNodeRegistration(CScheduler &scheduler)
+{
+	LOCK(cs_safenode);
+	pSafeNodeScheduler = &scheduler;
+	fSafeNodeDirty = true;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
@@ -3800,110 +4191,14 @@ void static UpdateTip(CBlockIndex *pindexNew) {
         }
     }
 
-	UniValue params;
-	params.clear();
-	UniValue nodeinfo = getnodeinfo(&params, false);
-	UniValue uv_is_valid = find_value(nodeinfo, "is_valid");
-	bool is_safenode_valid = uv_is_valid.get_bool();
-	
-	if (is_safenode_valid // meaning parentkey, safekey and safeheight are validated
-	&& safecoin_longestchain > 0 // if longestchain is up to date
-	&& chainActive.Height() >= safecoin_longestchain() // if chain is synced
+	// registration work runs on the scheduler, which checks the params against this tip and rereads the balance only when it changed
+	int32_t safenode_longestchain = safecoin_longestchain();
+	if (safenode_longestchain > 0 // if longestchain is up to date
+	&& chainActive.Height() >= safenode_longestchain // if chain is synced
 	&& chainActive.Height() % 2 == 0) // reduce frequency to 50% by attempting to register only at even block heights
-    {
-        // check for required wallet balance, for registration expenses 
-        uint64_t wallet_balance = pwalletMain->GetBalance();
-        if (wallet_balance >= 115000) // minimum required for registration tx
-        {
-			int current_height = chainActive.Height();
-			string sk =  GetArg("-safekey", "");
-			std::string safeheight =  GetArg("-safeheight", "");
-			boost::crc_16_type sk_crc;
-			sk_crc.process_bytes(sk.data(), sk.length());
-			int sk_checksum = sk_crc.checksum();
-			int id_by_checksum = sk_checksum % (REGISTRATION_TRIGGER_DAYS * 1440 / 2); // to trigger twice within REGISTRATION_TRIGGER_DAYS 
-			
-			/* old way - safeheight dependent
-			std::istringstream ss_id_by_checksum (safeheight); // once per week
-			int int_id_by_checksum;
-			ss_id_by_checksum >> int_id_by_checksum;
-			*/
-			
-			// check for active safenode registration, if not found schedule it a.s.a.p.
-			portable_mutex_lock(&SAFECOIN_KV_mutex);
-			struct safecoin_kv *s;
-			bool no_active_registration = true;
-			
-			for(s = SAFECOIN_KV; s != NULL; s = (safecoin_kv*)s->hh.next)
-			{
-				int32_t saved_on_height = s->height;
-				uint8_t *value_ptr = s->value;
-				uint16_t value_size = s->valuesize;
-				
-				// skip checking against records with invalid safeid size or height too much in the past
-				if (value_size == 66 && (current_height - saved_on_height <= REGISTRATION_TRIGGER_DAYS * 1440)) // check whole REGISTRATION_TRIGGER_DAYS window
-				{
-					std::string str_saved_safeid = std::string((char*)value_ptr, (int)value_size);
-
-					if (sk == str_saved_safeid)
-					{
-						// previous registration found within the search range
-						no_active_registration = false;
-						if (LogAcceptCategory("safenodes"))
-						{
-							LogPrint("safenodes", "SAFENODES: Active safeid registration found at block height %u: safeid %s\n", saved_on_height, sk.c_str());
-						}
-						break;
-					}
-				} 
-			}
-			
-			portable_mutex_unlock(&SAFECOIN_KV_mutex);
-			
-			if ((id_by_checksum == current_height % (REGISTRATION_TRIGGER_DAYS * 1440 / 2)) || no_active_registration) // to trigger twice within REGISTRATION_TRIGGER_DAYS or NOW if there is no active registration
-			{
-				printf("Validate SafeNode at height %u\n", current_height);
-				std::string args;
-				std::string defaultpub = "0333b9796526ef8de88712a649d618689a1de1ed1adf9fb5ec415f31e560b1f9a3";
-				if (!GetArg("-parentkey", "").empty()) defaultpub = (GetArg("-parentkey", ""));
-				std::string safepass = GetArg("-safepass", "");
-
-				std::string padding = "0";
-				std::string safeheight =  GetArg("-safeheight", "");
-				// std::to_string(current_height - (rand() % 1000));  //subtract a random amount less than 100
-
-				uint32_t flag_from_days = (REGISTRATION_TRIGGER_DAYS - 1) << 2;
-
-				args = defaultpub + padding + safeheight + "1 " + GetArg("-safekey", "") + " " + std::to_string(flag_from_days) + " " + safepass;
-
-				vector<string> vArgs;
-				boost::split(vArgs, args, boost::is_any_of(" \t"));
-				// Handle empty strings the same way as CLI
-				for (auto i = 0; i < vArgs.size(); i++)
-				{
-					if (vArgs[i] == "\"\"")
-					{
-						vArgs[i] = "";
-					}
-				}
-
-				UniValue paramz(UniValue::VARR);
-				for (unsigned int idx = 0; idx < vArgs.size(); idx++)
-				{
-					const std::string& strValz = vArgs[idx];
-					// printf("UPDATE TIP KV: param %i = %s\n", idx, strValz.c_str());
-					paramz.push_back(strValz);
-				}
-	 
-				kvupdate(paramz,false);
-			}
-			
-		}
-		else
-		{
-			LogPrintf("SAFENODES: Wallet balance %lu safetoshis < 115000, insufficient for safenode registration !!!\n", wallet_balance );
-		}
-    }    
+	{
+		SafeNodeScheduleRegistration(chainActive.Height());
+	}
 }
 
 /**
@@ -3936,7 +4231,9 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
         if (!DisconnectBlock(block, state, pindexDelete, view))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
-        DisconnectNotarisations(block);
+        DisconnectNotarisations(block, pindexDelete->GetHeight());
+        if ( ASSETCHAINS_CC != 0 )
+            OraclesIndexUpdate(block,pindexDelete->GetHeight(),0);
     }
     pindexDelete->segid = -2;
     pindexDelete->newcoins = 0;
@@ -4868,60 +5165,6 @@ bool CheckBlock(int32_t *futureblockp,int32_t height,CBlockIndex *pindex,const C
     // Check transactions
     CTransaction sTx;
     CTransaction *ptx = NULL;
-    if ( ASSETCHAINS_CC != 0 ) // CC contracts might refer to transactions in the current block, from a CC spend within the same block and out of order
-    {
-        int32_t i,j,rejects=0,lastrejects=0;
-        //fprintf(stderr,"put block's tx into mempool\n");
-        // Copy all non Z-txs in mempool to temporary mempool because there can be tx in local mempool that make the block invalid.
-        LOCK2(cs_main,mempool.cs);
-        //fprintf(stderr, "starting... mempoolsize.%ld\n",mempool.size());
-        list<CTransaction> transactionsToRemove;
-        for (const CTxMemPoolEntry& e : mempool.mapTx) {
-            const CTransaction &tx = e.GetTx();
-            const uint256 &hash = tx.GetHash();
-            if ( tx.vjoinsplit.empty() && tx.vShieldedSpend.empty()) {
-                transactionsToRemove.push_back(tx);
-                tmpmempool.addUnchecked(hash,e,true);
-            }
-        }
-        for (const CTransaction& tx : transactionsToRemove) {
-            list<CTransaction> removed;
-            mempool.remove(tx, removed, false);
-        }
-        // add all the txs in the block to the empty mempool.
-        // CC validation shouldnt (cant) depend on the state of mempool!
-        while ( 1 )
-        {
-            list<CTransaction> removed;
-            for (i=0; i<block.vtx.size(); i++)
-            {
-                CValidationState state;
-                CTransaction Tx;
-                const CTransaction &tx = (CTransaction)block.vtx[i];
-                if (tx.IsCoinBase() || (!tx.vjoinsplit.empty() && !tx.vShieldedSpend.empty()) || ((i == (block.vtx.size() - 1)) && (ASSETCHAINS_STAKED && safecoin_isPoS((CBlock *)&block) != 0)))
-                    continue;
-                Tx = tx;
-                if ( myAddtomempool(Tx, &state, true) == false ) // happens with out of order tx in block on resync
-                {
-                rejects++;
-                }
-                // here we remove any txs in the temp mempool that were included in the block.
-                tmpmempool.remove(tx, removed, false);
-            }
-            //fprintf(stderr, "removed.%ld\n",removed.size());
-            if ( rejects == 0 || rejects == lastrejects )
-            {
-                if ( 0 && lastrejects != 0 )
-                    fprintf(stderr,"lastrejects.%d -> all tx in mempool\n",lastrejects);
-                break;
-            }
-            //fprintf(stderr,"addtomempool ht.%d for CC checking: n.%d rejects.%d last.%d\n",height,(int32_t)block.vtx.size(),rejects,lastrejects);
-            lastrejects = rejects;
-            rejects = 0;
-        }
-        //fprintf(stderr,"done putting block's tx into mempool\n");
-    }
-
     for (uint32_t i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction& tx = block.vtx[i];
@@ -4952,20 +5195,6 @@ bool CheckBlock(int32_t *futureblockp,int32_t height,CBlockIndex *pindex,const C
         SyncWithWallets(*ptx, &block);
     }
 
-    if ( ASSETCHAINS_CC != 0 )
-    {
-        // here we add back all txs from the temp mempool to the main mempool.
-        for (const CTxMemPoolEntry& e : tmpmempool.mapTx)
-        {
-            const CTransaction &tx = e.GetTx();
-            const uint256 &hash = tx.GetHash();
-            mempool.addUnchecked(hash,e,true);
-        }
-        //fprintf(stderr, "finished adding back. mempoolsize.%ld\n",mempool.size());
-        // empty the temp mempool for next time.
-        tmpmempool.clear();
-    }
-    
     return true;
 }
 
@@ -5820,6 +6049,11 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    // Check whether we have an address balance index
+    pblocktree->ReadFlag("addressbalanceindex", fAddressBalanceIndex);
+    fAddressBalanceIndex = fAddressBalanceIndex && fAddressIndex;
+    LogPrintf("%s: address balance index %s\n", __func__, fAddressBalanceIndex ? "enabled" : "disabled");
+
     // Fill in-memory data
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
     {
@@ -6181,6 +6415,10 @@ bool InitBlockIndex() {
 
     fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
     pblocktree->WriteFlag("spentindex", fSpentIndex);
+
+    // The address balance index is built from the address index entries
+    fAddressBalanceIndex = fAddressIndex && GetBoolArg("-addressbalanceindex", DEFAULT_ADDRESSBALANCEINDEX);
+    pblocktree->WriteFlag("addressbalanceindex", fAddressBalanceIndex);
     fprintf(stderr,"fAddressIndex.%d/%d fSpentIndex.%d/%d\n",fAddressIndex,DEFAULT_ADDRESSINDEX,fSpentIndex,DEFAULT_SPENTINDEX);
     LogPrintf("Initializing databases...\n");
 
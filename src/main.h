@@ -42,8 +42,10 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CInv;
+class CScheduler;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -109,6 +111,7 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 #define DEFAULT_ADDRESSINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 #define DEFAULT_SPENTINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 static const bool DEFAULT_TIMESTAMPINDEX = false;
+static const bool DEFAULT_ADDRESSBALANCEINDEX = false;
 static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 1000;
 static const bool DEFAULT_DB_COMPRESSION = true;
 
@@ -267,6 +270,14 @@ CBlockIndex * InsertBlockIndex(uint256 hash);
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
+/** Check -parentkey, -safekey and -safeheight against the chain at the given height */
+bool SafeNodeValidateParams(int32_t height, uint32_t timestamp, std::vector<std::string> &errors);
+/** Force the cached SafeNode status to be rechecked (KV index or wallet balance changed) */
+void SafeNodeStatusInvalidate();
+/** Queue a SafeNode registration check for the given tip height on the scheduler */
+void SafeNodeScheduleRegistration(int height);
+/** Start servicing SafeNode registrations on the given scheduler */
+void StartSafeNodeRegistration(CScheduler &scheduler);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
@@ -616,6 +627,35 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    int64_t txcount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txcount);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txcount = 0;
+    }
+
+    bool IsNull() const {
+        return (txcount == 0);
+    }
+};
+
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
@@ -743,6 +783,29 @@ bool CheckFinalTx(const CTransaction &tx, int flags = -1);
  * Closure representing one script verification
  * Note that this stores references to the spending transaction
  */
+/**
+ * The transactions spent by the CC inputs of the block ConnectBlock is checking, with their
+ * myGetTransaction result. Only visible to the thread connecting the block and, while they run
+ * its checks, to the script check threads.
+ */
+typedef std::map<uint256, std::pair<CTransaction, uint256> > CCInputsSnapshot;
+const CCInputsSnapshot *CCInputsSnapshotCurrent();
+
+/**
+ * The transactions of the block ConnectBlock is connecting, for CC validators that refer to
+ * another transaction of the same block, in either order. While it is set, the CC lookups take
+ * these in place of the mempool, which they never consult, so a block is valid or not the same
+ * way on every node. Visible to the same threads as the CCInputsSnapshot.
+ */
+class CCBlockOverlay
+{
+public:
+    std::map<uint256, const CTransaction*> mapTx;
+    std::map<COutPoint, uint256> mapSpent;
+    CCBlockOverlay(const CBlock &block);
+};
+const CCBlockOverlay *CCBlockOverlayCurrent();
+
 class CScriptCheck
 {
 private:
@@ -755,12 +818,15 @@ private:
     uint32_t consensusBranchId;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    const CCInputsSnapshot *ccinputs;
+    const CCBlockOverlay *ccblock;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR), ccinputs(NULL), ccblock(NULL) {}
     CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(CCoinsViewCache::GetSpendFor(&txFromIn, txToIn.vin[nInIn])), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn),
+        ccinputs(CCInputsSnapshotCurrent()), ccblock(CCBlockOverlayCurrent()) { }
 
     bool operator()();
 
@@ -774,6 +840,8 @@ public:
         std::swap(consensusBranchId, check.consensusBranchId);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(ccinputs, check.ccinputs);
+        std::swap(ccblock, check.ccblock);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -786,11 +854,20 @@ bool GetAddressIndex(uint160 addressHash, int type,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+/** Paged reads: at most limit entries (0 for all), resuming after pafter when it is set */
+bool GetAddressIndex(uint160 addressHash, int type,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                     int start, int end, const CAddressIndexKey *pafter, size_t limit);
+bool GetAddressUnspent(uint160 addressHash, int type,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       const CAddressUnspentKey *pafter, size_t limit);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos,bool checkPOW);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -102,6 +102,159 @@ public:
     }
 };
 
+//
+// The per transaction work of CreateNewBlock (serialized size, sigops, input values and ages,
+// parents still in the mempool) is kept in a candidate set that follows the mempool's change
+// journal, so a new template only revisits transactions added or removed since the last one.
+// Priority is kept as sums over the confirmed inputs so it can be evaluated at any height.
+// Guarded by mempool.cs.
+//
+class CTemplateCandidate
+{
+public:
+    const CTransaction* ptx;
+    unsigned int nTxSize;
+    unsigned int nLegacySigOps;
+    unsigned int nVout; // kept so the spenders can be found after ptx left the mempool
+    CAmount nTotalIn;
+    double dPriorityFlat; // coin imports
+    double dValueConfirmed; // sum of confirmed input values
+    double dValueHeight; // sum of confirmed input value * coins height
+    std::vector<uint256> vParents; // inputs spending transactions still in the mempool
+    bool fMissingInputs;
+    uint32_t nScriptsBranchId; // scripts already verified against these inputs for this branch, 0 if not
+    bool fCC; // CC vins or vouts, or a coin import: their validity depends on the chain state, so never cached
+
+    CTemplateCandidate() : ptx(NULL), nTxSize(0), nLegacySigOps(0), nVout(0), nTotalIn(0), dPriorityFlat(0),
+        dValueConfirmed(0), dValueHeight(0), fMissingInputs(false), nScriptsBranchId(0), fCC(false) {}
+
+    double GetPriority(int nHeight) const
+    {
+        return ptx->ComputePriority(dPriorityFlat + dValueConfirmed * nHeight - dValueHeight, nTxSize);
+    }
+};
+
+static std::map<uint256, CTemplateCandidate> mapTemplateCandidates;
+static const CBlockIndex* pindexTemplateTip = NULL;
+
+static void ComputeTemplateCandidate(CTemplateCandidate& candidate, const CTransaction& tx, const CCoinsViewCache& view)
+{
+    candidate = CTemplateCandidate();
+    candidate.ptx = &tx;
+    candidate.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    candidate.nLegacySigOps = GetLegacySigOpCount(tx);
+    candidate.nVout = tx.vout.size();
+    for (const CTxOut& txout : tx.vout)
+        if (txout.scriptPubKey.IsPayToCryptoCondition())
+            candidate.fCC = true;
+
+    if (tx.IsCoinImport())
+    {
+        candidate.fCC = true;
+        CAmount nValueIn = GetCoinImportValue(tx);
+        candidate.nTotalIn += nValueIn;
+        candidate.dPriorityFlat += (double)nValueIn * 1000;  // flat multiplier
+        return;
+    }
+    for (const CTxIn& txin : tx.vin)
+    {
+        // Read prev transaction
+        if (!view.HaveCoins(txin.prevout.hash))
+        {
+            // This should never happen; all transactions in the memory
+            // pool should connect to either transactions in the chain
+            // or other transactions in the memory pool.
+            CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.find(txin.prevout.hash);
+            if (mi == mempool.mapTx.end())
+            {
+                LogPrintf("ERROR: mempool transaction missing input\n");
+                if (fDebug) assert("mempool transaction missing input" == 0);
+                candidate.fMissingInputs = true;
+                return;
+            }
+
+            // Has to wait for dependencies
+            if (std::find(candidate.vParents.begin(), candidate.vParents.end(), txin.prevout.hash) == candidate.vParents.end())
+                candidate.vParents.push_back(txin.prevout.hash);
+            candidate.nTotalIn += mi->GetTx().vout[txin.prevout.n].nValue;
+            if (mi->GetTx().vout[txin.prevout.n].scriptPubKey.IsPayToCryptoCondition())
+                candidate.fCC = true;
+            continue;
+        }
+        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+        assert(coins);
+
+        CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+        if (coins->vout[txin.prevout.n].scriptPubKey.IsPayToCryptoCondition())
+            candidate.fCC = true;
+        candidate.nTotalIn += nValueIn;
+        candidate.dValueConfirmed += (double)nValueIn;
+        candidate.dValueHeight += (double)nValueIn * coins->nHeight;
+    }
+    candidate.nTotalIn += tx.GetShieldedValueIn();
+}
+
+/** Bring mapTemplateCandidates in line with the mempool, from scratch when the journal cannot be trusted. */
+static void SyncTemplateCandidates(const CCoinsViewCache& view, const CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(mempool.cs);
+
+    // a disconnected block can change the coins of candidates that did not leave the mempool
+    bool fRebuild = !mempool.fTrackTemplateChanges || mempool.fTemplateChangesOverflow || pindexTemplateTip == NULL ||
+                    pindexPrev->GetAncestor(pindexTemplateTip->GetHeight()) != pindexTemplateTip;
+
+    std::set<uint256> setDirty;
+    if (fRebuild)
+    {
+        mapTemplateCandidates.clear();
+        for (CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+            setDirty.insert(mi->GetTx().GetHash());
+    }
+    else
+    {
+        // the changed transactions and whatever spends them in the mempool, their inputs moved
+        for (const uint256& hash : mempool.vTemplateChanges)
+        {
+            if (!setDirty.insert(hash).second)
+                continue;
+            unsigned int nVout = 0;
+            CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.find(hash);
+            std::map<uint256, CTemplateCandidate>::const_iterator ci = mapTemplateCandidates.find(hash);
+            if (mi != mempool.mapTx.end())
+                nVout = mi->GetTx().vout.size();
+            else if (ci != mapTemplateCandidates.end())
+                nVout = ci->second.nVout;
+            for (unsigned int i = 0; i < nVout; i++)
+            {
+                std::map<COutPoint, CInPoint>::const_iterator it = mempool.mapNextTx.find(COutPoint(hash, i));
+                if (it != mempool.mapNextTx.end())
+                    setDirty.insert(it->second.ptx->GetHash());
+            }
+        }
+    }
+
+    for (const uint256& hash : setDirty)
+    {
+        CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.find(hash);
+        if (mi == mempool.mapTx.end())
+            mapTemplateCandidates.erase(hash);
+        else
+            ComputeTemplateCandidate(mapTemplateCandidates[hash], mi->GetTx(), view);
+    }
+
+    mempool.vTemplateChanges.clear();
+    mempool.fTemplateChangesOverflow = false;
+    mempool.fTrackTemplateChanges = true;
+    pindexTemplateTip = pindexPrev;
+}
+
+void ResetBlockTemplateCandidates()
+{
+    LOCK(mempool.cs);
+    mapTemplateCandidates.clear();
+    pindexTemplateTip = NULL;
+}
+
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
@@ -237,11 +390,13 @@ CBlockTemplate* CreateNewBlock(const CScript& _scriptPubKeyIn, int32_t gpucount,
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size() + 1);
 
-        // now add transactions from the mem pool
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
+        // now add transactions from the mem pool, by way of the incrementally maintained candidates
+        SyncTemplateCandidates(view, pindexPrev);
+        for (std::map<uint256, CTemplateCandidate>::iterator ci = mapTemplateCandidates.begin();
+             ci != mapTemplateCandidates.end(); ++ci)
         {
-            const CTransaction& tx = mi->GetTx();
+            const CTemplateCandidate& candidate = ci->second;
+            const CTransaction& tx = *candidate.ptx;
 
             int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
             ? nMedianTimePast
@@ -259,77 +414,32 @@ CBlockTemplate* CreateNewBlock(const CScript& _scriptPubKeyIn, int32_t gpucount,
                 continue;
             }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            if (tx.IsCoinImport())
-            {
-                CAmount nValueIn = GetCoinImportValue(tx);
-                nTotalIn += nValueIn;
-                dPriority += (double)nValueIn * 1000;  // flat multiplier
-            } else {
-                for (const CTxIn& txin : tx.vin)
-                {
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
-                    {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
-                        {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
-
-                        // Has to wait for dependencies
-                        if (!porphan)
-                        {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
-
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = nHeight - coins->nHeight;
-
-                    dPriority += (double)nValueIn * nConf;
-                }
-                nTotalIn += tx.GetShieldedValueIn();
-            }
-
-            if (fMissingInputs) continue;
+            if (candidate.fMissingInputs) continue;
 
             // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+            double dPriority = candidate.GetPriority(nHeight);
+            CAmount nTotalIn = candidate.nTotalIn;
 
-            uint256 hash = tx.GetHash();
+            const uint256& hash = ci->first;
             mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), candidate.nTxSize);
 
-            if (porphan)
+            if (!candidate.vParents.empty())
             {
+                // Use list for automatic deletion
+                vOrphan.push_back(COrphan(&tx));
+                COrphan* porphan = &vOrphan.back();
+                for (const uint256& parent : candidate.vParents)
+                {
+                    mapDependers[parent].push_back(porphan);
+                    porphan->setDependsOn.insert(parent);
+                }
                 porphan->dPriority = dPriority;
                 porphan->feeRate = feeRate;
             }
             else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
+                vecPriority.push_back(TxPriority(dPriority, feeRate, &tx));
         }
 
         // Collect transactions into block
@@ -352,8 +462,10 @@ CBlockTemplate* CreateNewBlock(const CScript& _scriptPubKeyIn, int32_t gpucount,
             std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
             vecPriority.pop_back();
 
+            CTemplateCandidate& candidate = mapTemplateCandidates[tx.GetHash()];
+
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            unsigned int nTxSize = candidate.nTxSize;
             if (nBlockSize + nTxSize >= nBlockMaxSize-512) // room for extra autotx
             {
                 //fprintf(stderr,"nBlockSize %d + %d nTxSize >= %d nBlockMaxSize\n",(int32_t)nBlockSize,(int32_t)nTxSize,(int32_t)nBlockMaxSize);
@@ -361,7 +473,7 @@ CBlockTemplate* CreateNewBlock(const CScript& _scriptPubKeyIn, int32_t gpucount,
             }
 
             // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+            unsigned int nTxSigOps = candidate.nLegacySigOps;
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS-1)
             {
                 //fprintf(stderr,"A nBlockSigOps %d + %d nTxSigOps >= %d MAX_BLOCK_SIGOPS-1\n",(int32_t)nBlockSigOps,(int32_t)nTxSigOps,(int32_t)MAX_BLOCK_SIGOPS);
@@ -403,13 +515,17 @@ CBlockTemplate* CreateNewBlock(const CScript& _scriptPubKeyIn, int32_t gpucount,
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
+            // Scripts only need to be run again when the candidate's inputs or the branch changed,
+            // CC evals also depend on the chain height and state so those always run.
             CValidationState state;
             PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+            bool fScriptChecks = candidate.fCC || (candidate.nScriptsBranchId != consensusBranchId);
+            if (!ContextualCheckInputs(tx, state, view, fScriptChecks, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
             {
                 //fprintf(stderr,"context failure\n");
                 continue;
             }
+            candidate.nScriptsBranchId = consensusBranchId;
             UpdateCoins(tx, view, nHeight);
 
             for (const OutputDescription &outDescription : tx.vShieldedOutput) {
@@ -29,6 +29,8 @@ struct CBlockTemplate
 
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, int32_t gpucount, bool isStake = false);
+/** Drop the cached template candidates so the next CreateNewBlock rebuilds them from the whole mempool */
+void ResetBlockTemplateCandidates();
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, int32_t nHeight, int32_t gpucount, bool isStake = false);
@@ -25,6 +25,12 @@
 #include <fcntl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <unordered_map>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -58,6 +64,10 @@ using namespace safe;
 #define USE_TLS
 #define COMPAT_NON_TLS // enables compatibility with nodes, that still doesn't support TLS connections
 
+#ifdef __linux__
+#define USE_EPOLL // edge triggered epoll backend for ThreadSocketHandler, select() is kept as the fallback
+#endif
+
 using namespace std;
 
 namespace {
@@ -120,13 +130,9 @@ CNodeSignals& GetNodeSignals() { return g_signals; }
 // OpenSSL server and client contexts
 SSL_CTX *tls_ctx_server, *tls_ctx_client;
 
-static bool operator==(_NODE_ADDR a, _NODE_ADDR b)
-{
-    return (a.ipAddr == b.ipAddr);
-}
-static std::vector<NODE_ADDR> vNonTLSNodesInbound;
+static NonTLSPool vNonTLSNodesInbound;
 static CCriticalSection cs_vNonTLSNodesInbound;
-static std::vector<NODE_ADDR> vNonTLSNodesOutbound;
+static NonTLSPool vNonTLSNodesOutbound;
 static CCriticalSection cs_vNonTLSNodesOutbound;
 
 void AddOneShot(const std::string& strDest)
@@ -423,20 +429,28 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         /* TCP connection is ready. Do client side SSL. */
 #ifdef COMPAT_NON_TLS
         {
-            LOCK(cs_vNonTLSNodesOutbound);
+            string strAddr = addrConnect.ToStringIP();
+            bool bUseTLS;
 
-            NODE_ADDR nodeAddr(addrConnect.ToStringIP());
+            {
+                LOCK(cs_vNonTLSNodesOutbound);
 
-            bool bUseTLS = (find(vNonTLSNodesOutbound.begin(),
-                                 vNonTLSNodesOutbound.end(),
-                                 nodeAddr) == vNonTLSNodesOutbound.end());
+                bUseTLS = !vNonTLSNodesOutbound.contains(strAddr);
+                if (!bUseTLS)
+                    vNonTLSNodesOutbound.erase(strAddr);
+            }
+
+            // the pool lock is not held across the handshake
             if (bUseTLS)
             {
                 ssl = tlsmanager.connect(hSocket, addrConnect);
                 if (!ssl)
                 {
                     // Further reconnection will be made in non-TLS (unencrypted) mode
-                    vNonTLSNodesOutbound.push_back(NODE_ADDR(addrConnect.ToStringIP(), GetTimeMillis()));
+                    {
+                        LOCK(cs_vNonTLSNodesOutbound);
+                        vNonTLSNodesOutbound.insert(strAddr, GetTimeMillis());
+                    }
                     CloseSocket(hSocket);
                     return NULL;
                 }
@@ -444,13 +458,6 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
             else
             {
                 LogPrintf ("Connection to %s will be unencrypted\n", addrConnect.ToString());
-
-                vNonTLSNodesOutbound.erase(
-                        remove(
-                                vNonTLSNodesOutbound.begin(),
-                                vNonTLSNodesOutbound.end(),
-                                nodeAddr),
-                        vNonTLSNodesOutbound.end());
             }
         }
 #else
@@ -1062,6 +1069,220 @@ static bool AttemptToEvictConnection(bool fPreferNewConnection) {
     return true;
 }
 
+#ifdef USE_EPOLL
+
+/**
+ * epoll backend for ThreadSocketHandler. Peers are registered edge triggered and their readiness is
+ * remembered in CNode::fRecvReady until a read would block, listening sockets and TLS handshakes are
+ * level triggered. The kind of source and its socket are packed into epoll_event.data.u64.
+ */
+static int hEpollSocketHandler = -1;
+
+enum EpollSource
+{
+    EPOLL_SOURCE_NODE = 0,
+    EPOLL_SOURCE_LISTEN = 1,
+    EPOLL_SOURCE_HANDSHAKE = 2,
+};
+
+static const int EPOLL_MAX_EVENTS = 256;
+
+static bool EpollCtl(int nOp, SOCKET hSocket, EpollSource source, uint32_t nEvents)
+{
+    if (hEpollSocketHandler == -1)
+        return false;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = nEvents;
+    event.data.u64 = ((uint64_t)source << 32) | (uint32_t)hSocket;
+    if (epoll_ctl(hEpollSocketHandler, nOp, hSocket, &event) != 0)
+    {
+        LogPrint("net", "socket epoll_ctl(%d) failed for %d: %s\n", nOp, hSocket, NetworkErrorString(errno));
+        return false;
+    }
+    return true;
+}
+
+#endif // USE_EPOLL
+
+static void AddInboundNode(SOCKET hSocket, const CAddress& addr, bool whitelisted, SSL *ssl)
+{
+#ifdef USE_TLS
+    if (GetBoolArg("-tlsvalidate", false))
+    {
+        if (ssl && !ValidatePeerCertificate(ssl))
+        {
+            LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", addr.ToString());
+
+            SSL_shutdown(ssl);
+            CloseSocket(hSocket);
+            SSL_free(ssl);
+            return;
+        }
+    }
+#endif // USE_TLS
+
+    if ((GetBoolArg("-tlsforce", false) && ssl) || !(GetBoolArg("-tlsforce", false)))
+    {
+        CNode* pnode = new CNode(hSocket, addr, "", true, ssl);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+    else
+        CloseSocket(hSocket);
+}
+
+#ifdef USE_TLS
+
+/**
+ * Inbound TLS handshakes are driven from ThreadSocketHandler's select() loop instead of
+ * blocking it for up to DEFAULT_CONNECT_TIMEOUT per peer; only that thread touches the list.
+ */
+struct PendingTLSHandshake
+{
+    SOCKET hSocket;
+    SSL *ssl;
+    CAddress addr;
+    bool whitelisted;
+    int64_t nTimeStart;
+    int nWant;
+};
+
+static std::list<PendingTLSHandshake> lPendingTLSHandshakes;
+
+#ifdef USE_EPOLL
+static void EpollWatchHandshake(const PendingTLSHandshake& handshake, int nOp);
+#endif
+
+static void StartTLSHandshake(SOCKET hSocket, const CAddress& addr, bool whitelisted)
+{
+    if (lPendingTLSHandshakes.size() >= MAX_PENDING_TLS_HANDSHAKES)
+    {
+        LogPrint("net", "TLS: too many pending handshakes - connection from %s dropped\n", addr.ToString());
+        CloseSocket(hSocket);
+        return;
+    }
+
+    SSL *ssl = tlsmanager.startAccept(hSocket, addr);
+    if (!ssl)
+    {
+        CloseSocket(hSocket);
+        return;
+    }
+
+    PendingTLSHandshake handshake = {hSocket, ssl, addr, whitelisted, GetTimeMillis(), SSL_ERROR_WANT_READ};
+    lPendingTLSHandshakes.push_back(handshake);
+#ifdef USE_EPOLL
+    EpollWatchHandshake(handshake, EPOLL_CTL_ADD);
+#endif
+}
+
+/** Advance one pending handshake, returns true once it is finished either way and should be dropped. */
+static bool StepTLSHandshake(PendingTLSHandshake& handshake, bool fReady, int64_t nNow)
+{
+    int nRet = 0, nWant = handshake.nWant;
+
+    if (fReady)
+        nRet = tlsmanager.handshakeStep(SSL_ACCEPT, handshake.ssl, handshake.nWant);
+
+    if (nRet == 0 && nNow - handshake.nTimeStart >= DEFAULT_CONNECT_TIMEOUT)
+    {
+        LogPrint("net", "TLS: ERROR: %s: %s: handshake with %s timed out\n", __FILE__, __func__, handshake.addr.ToString());
+        nRet = -1;
+    }
+
+    if (nRet == 0)
+    {
+#ifdef USE_EPOLL
+        if (handshake.nWant != nWant)
+            EpollWatchHandshake(handshake, EPOLL_CTL_MOD);
+#endif
+        return false;
+    }
+
+    if (nRet == 1)
+    {
+        LogPrintf("TLS: connection from %s has been accepted. Using cipher: %s\n", handshake.addr.ToString(), SSL_get_cipher(handshake.ssl));
+#ifdef USE_EPOLL
+        // the node is registered again, edge triggered, by the socket handler
+        if (hEpollSocketHandler != -1)
+            epoll_ctl(hEpollSocketHandler, EPOLL_CTL_DEL, handshake.hSocket, NULL);
+#endif
+        AddInboundNode(handshake.hSocket, handshake.addr, handshake.whitelisted, handshake.ssl);
+    }
+    else
+    {
+        LogPrintf("TLS: ERROR: %s: %s: TLS connection from %s failed\n", __FILE__, __func__, handshake.addr.ToString());
+        SSL_free(handshake.ssl);
+        CloseSocket(handshake.hSocket);
+#ifdef COMPAT_NON_TLS
+        // Further reconnection will be made in non-TLS (unencrypted) mode
+        LOCK(cs_vNonTLSNodesInbound);
+        vNonTLSNodesInbound.insert(handshake.addr.ToStringIP(), GetTimeMillis());
+#endif // COMPAT_NON_TLS
+    }
+    return true;
+}
+
+static void ProcessPendingTLSHandshakes(fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
+{
+    int64_t nNow = GetTimeMillis();
+
+    for (std::list<PendingTLSHandshake>::iterator it = lPendingTLSHandshakes.begin(); it != lPendingTLSHandshakes.end(); )
+    {
+        bool fReady = FD_ISSET(it->hSocket, &fdsetError) ||
+                      FD_ISSET(it->hSocket, it->nWant == SSL_ERROR_WANT_WRITE ? &fdsetSend : &fdsetRecv);
+
+        if (StepTLSHandshake(*it, fReady, nNow))
+            it = lPendingTLSHandshakes.erase(it);
+        else
+            ++it;
+    }
+}
+
+#ifdef USE_EPOLL
+static void ProcessPendingTLSHandshakes(const std::set<SOCKET>& setReady)
+{
+    int64_t nNow = GetTimeMillis();
+
+    for (std::list<PendingTLSHandshake>::iterator it = lPendingTLSHandshakes.begin(); it != lPendingTLSHandshakes.end(); )
+    {
+        if (StepTLSHandshake(*it, setReady.count(it->hSocket) != 0, nNow))
+            it = lPendingTLSHandshakes.erase(it);
+        else
+            ++it;
+    }
+}
+
+static void EpollWatchHandshake(const PendingTLSHandshake& handshake, int nOp)
+{
+    EpollCtl(nOp, handshake.hSocket, EPOLL_SOURCE_HANDSHAKE, handshake.nWant == SSL_ERROR_WANT_WRITE ? EPOLLOUT : EPOLLIN);
+}
+#endif // USE_EPOLL
+
+/** Frees the handshakes still pending when ThreadSocketHandler exits, it is interrupted mid loop so this runs from a destructor. */
+class CPendingTLSHandshakesCleanup
+{
+public:
+    ~CPendingTLSHandshakesCleanup()
+    {
+        for (PendingTLSHandshake& handshake : lPendingTLSHandshakes)
+        {
+            SSL_free(handshake.ssl);
+            CloseSocket(handshake.hSocket);
+        }
+        lPendingTLSHandshakes.clear();
+    }
+};
+
+#endif // USE_TLS
+
 static void AcceptConnection(const ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
@@ -1081,6 +1302,9 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
             if (pnode->fInbound)
                 nInbound++;
     }
+#ifdef USE_TLS
+    nInbound += lPendingTLSHandshakes.size();
+#endif
 
     if (hSocket == INVALID_SOCKET)
     {
@@ -1133,88 +1357,165 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNonTLSNodesInbound);
 
-        NODE_ADDR nodeAddr(addr.ToStringIP());
+        string strAddr = addr.ToStringIP();
 
-        bool bUseTLS = (find(vNonTLSNodesInbound.begin(),
-                             vNonTLSNodesInbound.end(),
-                             nodeAddr) == vNonTLSNodesInbound.end());
+        bool bUseTLS = !vNonTLSNodesInbound.contains(strAddr);
         if (bUseTLS)
         {
-            ssl = tlsmanager.accept( hSocket, addr);
-            if(!ssl)
-            {
-                // Further reconnection will be made in non-TLS (unencrypted) mode
-                vNonTLSNodesInbound.push_back(NODE_ADDR(addr.ToStringIP(), GetTimeMillis()));
-                CloseSocket(hSocket);
-                return;
-            }
+            StartTLSHandshake(hSocket, addr, whitelisted);
+            return;
         }
         else
         {
             LogPrintf ("TLS: Connection from %s will be unencrypted\n", addr.ToString());
 
-            vNonTLSNodesInbound.erase(
-                    remove(
-                            vNonTLSNodesInbound.begin(),
-                            vNonTLSNodesInbound.end(),
-                            nodeAddr
-                    ),
-                    vNonTLSNodesInbound.end());
+            vNonTLSNodesInbound.erase(strAddr);
         }
     }
 #else
-    ssl = TLSManager::accept( hSocket, addr);
-    if(!ssl)
+    StartTLSHandshake(hSocket, addr, whitelisted);
+    return;
+#endif // COMPAT_NON_TLS
+#endif // USE_TLS
+
+    AddInboundNode(hSocket, addr, whitelisted, ssl);
+}
+
+#if defined(USE_TLS) && defined(COMPAT_NON_TLS)
+
+void ThreadNonTLSPoolsCleaner()
+{
+    while (true)
     {
-        CloseSocket(hSocket);
-        return;
+        tlsmanager.cleanNonTLSPool(vNonTLSNodesInbound,  cs_vNonTLSNodesInbound);
+        tlsmanager.cleanNonTLSPool(vNonTLSNodesOutbound, cs_vNonTLSNodesOutbound);
+        MilliSleep(DEFAULT_CONNECT_TIMEOUT);  // sleep and sleep_for are interruption points, which will throw boost::thread_interrupted
     }
-#endif // COMPAT_NON_TLS
+}
 
-    if (GetBoolArg("-tlsvalidate", false))
+#endif // USE_TLS && COMPAT_NON_TLS
+
+#ifdef USE_EPOLL
+
+/** Wait for socket events and dispatch them: accept, advance TLS handshakes, mark peers readable. */
+static void EpollWaitSocketEvents(std::unordered_map<SOCKET, CNode*>& mapEpollNodes, bool fMoreWork)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    std::set<SOCKET> setHandshakesReady;
+
+    // a peer that still has unread data is serviced again right away, otherwise poll pnode->vSend every 50ms
+    int nEvents = epoll_wait(hEpollSocketHandler, events, EPOLL_MAX_EVENTS, fMoreWork ? 0 : 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0)
     {
-        if (ssl && !ValidatePeerCertificate(ssl))
+        if (errno != EINTR)
         {
-            LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", addr.ToString());
-
-            SSL_shutdown(ssl);
-            CloseSocket(hSocket);
-            SSL_free(ssl);
-            return;
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
         }
+        nEvents = 0;
     }
-#endif // USE_TLS
 
-    if ((GetBoolArg("-tlsforce", false) && ssl) || !(GetBoolArg("-tlsforce", false)))
+    for (int i = 0; i < nEvents; i++)
     {
-        CNode* pnode = new CNode(hSocket, addr, "", true, ssl);
-        pnode->AddRef();
-        pnode->fWhitelisted = whitelisted;
+        SOCKET hSocket = (SOCKET)(uint32_t)events[i].data.u64;
 
+        switch (events[i].data.u64 >> 32)
         {
-            LOCK(cs_vNodes);
-            vNodes.push_back(pnode);
+        case EPOLL_SOURCE_LISTEN:
+            for (const ListenSocket& hListenSocket : vhListenSocket)
+                if (hListenSocket.socket == hSocket)
+                    AcceptConnection(hListenSocket);
+            break;
+
+        case EPOLL_SOURCE_HANDSHAKE:
+            setHandshakesReady.insert(hSocket);
+            break;
+
+        default:
+            // EPOLLOUT alone only wakes the loop, queued sends are retried while vSendMsg is not empty
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            {
+                std::unordered_map<SOCKET, CNode*>::iterator mi = mapEpollNodes.find(hSocket);
+                if (mi != mapEpollNodes.end())
+                    mi->second->fRecvReady = true;
+            }
+            break;
         }
     }
-}
 
-#if defined(USE_TLS) && defined(COMPAT_NON_TLS)
+#ifdef USE_TLS
+    ProcessPendingTLSHandshakes(setHandshakesReady);
+#endif
+}
 
-void ThreadNonTLSPoolsCleaner()
+/** epoll counterpart of the fd_set bookkeeping in ThreadSocketHandler for a single peer. */
+static int EpollServiceNode(CNode* pnode, std::unordered_map<SOCKET, CNode*>& mapEpollNodes, bool& fMoreWork)
 {
-    while (true)
+    bool recvSet = false, sendSet = false;
+
     {
-        tlsmanager.cleanNonTLSPool(vNonTLSNodesInbound,  cs_vNonTLSNodesInbound);
-        tlsmanager.cleanNonTLSPool(vNonTLSNodesOutbound, cs_vNonTLSNodesOutbound);
-        MilliSleep(DEFAULT_CONNECT_TIMEOUT);  // sleep and sleep_for are interruption points, which will throw boost::thread_interrupted
+        LOCK(pnode->cs_hSocket);
+
+        if (pnode->hSocket == INVALID_SOCKET)
+            return -1;
+
+        if (pnode->hSocketEpoll != pnode->hSocket)
+        {
+            // new peer: whatever arrived before registration has not produced an edge, so read optimistically
+            pnode->hSocketEpoll = pnode->hSocket;
+            pnode->fRecvReady = true;
+            mapEpollNodes[pnode->hSocket] = pnode;
+            EpollCtl(EPOLL_CTL_ADD, pnode->hSocket, EPOLL_SOURCE_NODE, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
     }
+
+    // Same policy as the select() backend: drain the send queue first, and only
+    // receive while there is no complete message or the receive buffer has room.
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        sendSet = lockSend && !pnode->vSendMsg.empty();
+    }
+    if (!sendSet && pnode->fRecvReady)
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        recvSet = lockRecv && (
+            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+            pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+    }
+
+    int nRet = tlsmanager.threadSocketHandler(pnode, recvSet, sendSet, false);
+    if (recvSet && pnode->fRecvReady)
+        fMoreWork = true;
+    return nRet;
 }
 
-#endif // USE_TLS && COMPAT_NON_TLS
+#endif // USE_EPOLL
 
 void ThreadSocketHandler()
 {
+#ifdef USE_TLS
+    CPendingTLSHandshakesCleanup pendingTLSHandshakesCleanup;
+#endif
     unsigned int nPrevNodeCount = 0;
+    bool fEpoll = false, fMoreWork = false;
+#ifdef USE_EPOLL
+    std::unordered_map<SOCKET, CNode*> mapEpollNodes;
+    if (hEpollSocketHandler == -1)
+    {
+        hEpollSocketHandler = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpollSocketHandler == -1)
+            LogPrintf("socket epoll_create1 failed: %s, falling back to select()\n", NetworkErrorString(errno));
+        else
+        {
+            for (const ListenSocket& hListenSocket : vhListenSocket)
+                if (hListenSocket.socket != INVALID_SOCKET)
+                    EpollCtl(EPOLL_CTL_ADD, hListenSocket.socket, EPOLL_SOURCE_LISTEN, EPOLLIN);
+        }
+    }
+    fEpoll = (hEpollSocketHandler != -1);
+#endif
     while (true)
     {
         //
@@ -1232,6 +1533,12 @@ void ThreadSocketHandler()
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
+#ifdef USE_EPOLL
+                    std::unordered_map<SOCKET, CNode*>::iterator mi = mapEpollNodes.find(pnode->hSocketEpoll);
+                    if (mi != mapEpollNodes.end() && mi->second == pnode)
+                        mapEpollNodes.erase(mi);
+#endif
+
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
 
@@ -1280,100 +1587,127 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
         fd_set fdsetRecv;
         fd_set fdsetSend;
         fd_set fdsetError;
         FD_ZERO(&fdsetRecv);
         FD_ZERO(&fdsetSend);
         FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
 
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+#ifdef USE_EPOLL
+        if (fEpoll)
+        {
+            EpollWaitSocketEvents(mapEpollNodes, fMoreWork);
+            fMoreWork = false;
         }
-
+#endif
+        if (!fEpoll)
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                LOCK(pnode->cs_hSocket);
+            //
+            // Find which sockets have data to receive
+            //
+            struct timeval timeout;
+            timeout.tv_sec  = 0;
+            timeout.tv_usec = 50000; // frequency to poll pnode->vSend
 
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+            SOCKET hSocketMax = 0;
+            bool have_fds = false;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
+            for (const ListenSocket& hListenSocket : vhListenSocket) {
+                FD_SET(hListenSocket.socket, &fdsetRecv);
+                hSocketMax = max(hSocketMax, hListenSocket.socket);
                 have_fds = true;
+            }
 
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
+#ifdef USE_TLS
+            for (const PendingTLSHandshake& handshake : lPendingTLSHandshakes) {
+                FD_SET(handshake.hSocket, handshake.nWant == SSL_ERROR_WANT_WRITE ? &fdsetSend : &fdsetRecv);
+                FD_SET(handshake.hSocket, &fdsetError);
+                hSocketMax = max(hSocketMax, handshake.hSocket);
+                have_fds = true;
+            }
+#endif
+
+            {
+                LOCK(cs_vNodes);
+                for (CNode* pnode : vNodes)
                 {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                    LOCK(pnode->cs_hSocket);
+
+                    if (pnode->hSocket == INVALID_SOCKET)
                         continue;
+
+                    FD_SET(pnode->hSocket, &fdsetError);
+                    hSocketMax = max(hSocketMax, pnode->hSocket);
+                    have_fds = true;
+
+                    // Implement the following logic:
+                    // * If there is data to send, select() for sending data. As this only
+                    //   happens when optimistic write failed, we choose to first drain the
+                    //   write buffer in this case before receiving more. This avoids
+                    //   needlessly queueing received data, if the remote peer is not themselves
+                    //   receiving data. This means properly utilizing TCP flow control signalling.
+                    // * Otherwise, if there is no (complete) message in the receive buffer,
+                    //   or there is space left in the buffer, select() for receiving data.
+                    // * (if neither of the above applies, there is certainly one message
+                    //   in the receiver buffer ready to be processed).
+                    // Together, that means that at least one of the following is always possible,
+                    // so we don't deadlock:
+                    // * We send some data.
+                    // * We wait for data to be received (and disconnect after timeout).
+                    // * We process a message in the buffer (message handler thread).
+                    {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend && !pnode->vSendMsg.empty()) {
+                            FD_SET(pnode->hSocket, &fdsetSend);
+                            continue;
+                        }
+                    }
+                    {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv && (
+                            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                            FD_SET(pnode->hSocket, &fdsetRecv);
                     }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
-        }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+            int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                                 &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+            boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
+            if (nSelect == SOCKET_ERROR)
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                if (have_fds)
+                {
+                    int nErr = WSAGetLastError();
+                    LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+                    for (unsigned int i = 0; i <= hSocketMax; i++)
+                        FD_SET(i, &fdsetRecv);
+                }
+                FD_ZERO(&fdsetSend);
+                FD_ZERO(&fdsetError);
+                MilliSleep(timeout.tv_usec/1000);
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
 
-        //
-        // Accept new connections
-        //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
-        {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            //
+            // Accept new connections
+            //
+            for (const ListenSocket& hListenSocket : vhListenSocket)
             {
-                AcceptConnection(hListenSocket);
+                if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                {
+                    AcceptConnection(hListenSocket);
+                }
             }
+
+#ifdef USE_TLS
+            //
+            // Advance pending TLS handshakes
+            //
+            ProcessPendingTLSHandshakes(fdsetRecv, fdsetSend, fdsetError);
+#endif
         }
 
         //
@@ -1390,7 +1724,14 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 			
-            if (tlsmanager.threadSocketHandler(pnode,fdsetRecv,fdsetSend,fdsetError)==-1){
+            int nRet;
+#ifdef USE_EPOLL
+            if (fEpoll)
+                nRet = EpollServiceNode(pnode, mapEpollNodes, fMoreWork);
+            else
+#endif
+                nRet = tlsmanager.threadSocketHandler(pnode,fdsetRecv,fdsetSend,fdsetError);
+            if (nRet == -1){
                 continue;
             }
 
@@ -2291,6 +2632,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     ssl = sslIn;
     nServices = 0;
     hSocket = hSocketIn;
+    hSocketEpoll = INVALID_SOCKET;
+    fRecvReady = true;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
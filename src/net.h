@@ -60,6 +60,8 @@ static const bool DEFAULT_LISTEN = true;
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency)*/
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
+/** The maximum number of inbound TLS handshakes driven by the socket handler at once. */
+static const size_t MAX_PENDING_TLS_HANDSHAKES = 128;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 384;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
@@ -268,6 +270,8 @@ public:
     uint64_t nServices;
     SOCKET hSocket;
     CCriticalSection cs_hSocket;
+    SOCKET hSocketEpoll; // socket registered with the epoll backend, only used by ThreadSocketHandler
+    bool fRecvReady; // edge triggered readability, cleared once a read would block
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
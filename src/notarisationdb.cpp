@@ -4,11 +4,49 @@
 #include "cc/eval.h"
 #include "main.h"
 
+#include <boost/scoped_ptr.hpp>
+
 
 NotarisationDB *pnotarisations;
 
+static const char DB_SYMBOLINDEX = 's';
+static const char DB_SYMBOLINDEX_START = 'S';
+
+
+/*
+ * Key of the (symbol, height) -> notarisation index. Heights are stored
+ * inverted and big-endian so that a seek lands on the latest notarisation
+ * at or below the requested height.
+ */
+struct CNotarisationSymbolKey {
+    std::string symbol;
+    int blockHeight;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(symbol, nType, nVersion) + 4;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, symbol);
+        ser_writedata32be(s, ~(uint32_t)blockHeight);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        ::Unserialize(s, symbol);
+        blockHeight = ~ser_readdata32be(s);
+    }
+
+    CNotarisationSymbolKey() : blockHeight(0) { }
+    CNotarisationSymbolKey(std::string symbolIn, int height) : symbol(symbolIn), blockHeight(height) { }
+};
 
-NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64) { }
+
+NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64)
+{
+    // A fresh database gets the symbol index from the first block, older ones from the next notarisation written
+    if (IsEmpty())
+        Write(DB_SYMBOLINDEX_START, 0);
+}
 
 
 NotarisationsInBlock ScanBlockNotarisations(const CBlock &block, int nHeight)
@@ -63,30 +101,60 @@ bool GetBackNotarisation(uint256 notarisationHash, Notarisation &n)
 
 
 /*
- * Write an index of SAFE notarisation id -> backnotarisation
+ * Write an index of SAFE notarisation id -> backnotarisation,
+ * and of (symbol, height) -> first notarisation for symbol in the block
  */
-void WriteBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch)
+void WriteBackNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch)
 {
     int wrote = 0;
+    std::set<std::string> symbols;
     for (const Notarisation &n : notarisations)
     {
         if (!n.second.txHash.IsNull()) {
             batch.Write(n.second.txHash, n);
             wrote++;
         }
+        if (symbols.insert(n.second.symbol).second)
+            batch.Write(std::make_pair(DB_SYMBOLINDEX, CNotarisationSymbolKey(n.second.symbol, height)), n);
     }
+    int start;
+    if (!pnotarisations->Read(DB_SYMBOLINDEX_START, start))
+        batch.Write(DB_SYMBOLINDEX_START, height);
 }
 
 
-void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch)
+void EraseBackNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch)
 {
     for (const Notarisation &n : notarisations)
     {
         if (!n.second.txHash.IsNull())
             batch.Erase(n.second.txHash);
+        batch.Erase(std::make_pair(DB_SYMBOLINDEX, CNotarisationSymbolKey(n.second.symbol, height)));
     }
 }
 
+/*
+ * Seek the (symbol, height) index for the latest notarisation for symbol
+ * at or below height. Return its height, or 0 if there is none down to
+ * lowest. Heights below the start of the index are not searched.
+ */
+static int SeekNotarisationsDB(int height, std::string symbol, int lowest, Notarisation& out)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->NewIterator());
+    pcursor->Seek(std::make_pair(DB_SYMBOLINDEX, CNotarisationSymbolKey(symbol, height)));
+    if (!pcursor->Valid())
+        return 0;
+
+    std::pair<char, CNotarisationSymbolKey> keyObj;
+    if (!pcursor->GetKey(keyObj) || keyObj.first != DB_SYMBOLINDEX || keyObj.second.symbol != symbol)
+        return 0;
+    if (keyObj.second.blockHeight < lowest || keyObj.second.blockHeight > height)
+        return 0;
+    if (!pcursor->GetValue(out))
+        return 0;
+    return keyObj.second.blockHeight;
+}
+
 /*
  * Scan notarisationsdb backwards for blocks containing a notarisation
  * for given symbol. Return height of matched notarisation or 0.
@@ -96,6 +164,19 @@ int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Not
     if (height < 0 || height > chainActive.Height())
         return false;
 
+    int lowest = std::max(height - scanLimitBlocks + 1, 0);
+    int start;
+    if (!pnotarisations->Read(DB_SYMBOLINDEX_START, start))
+        start = height + 1;
+    if (start <= height) {
+        int matched = SeekNotarisationsDB(height, symbol, std::max(lowest, start), out);
+        if (matched > 0 || lowest >= start)
+            return matched;
+        // Fall back to scanning the blocks connected before the index existed
+        scanLimitBlocks -= height - start + 1;
+        height = start - 1;
+    }
+
     for (int i=0; i<scanLimitBlocks; i++) {
         if (i > height) break;
         NotarisationsInBlock notarisations;
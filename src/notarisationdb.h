@@ -21,8 +21,8 @@ typedef std::vector<Notarisation> NotarisationsInBlock;
 NotarisationsInBlock ScanBlockNotarisations(const CBlock &block, int nHeight);
 bool GetBlockNotarisations(uint256 blockHash, NotarisationsInBlock &nibs);
 bool GetBackNotarisation(uint256 notarisationHash, Notarisation &n);
-void WriteBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
-void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
+void WriteBackNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch);
+void EraseBackNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch);
 int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Notarisation& out);
 bool IsTXSCL(const char* symbol);
 
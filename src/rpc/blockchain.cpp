@@ -371,31 +371,19 @@ bool myIsutxo_spentinmempool(uint256 txid,int32_t vout)
 {
     //char *uint256_str(char *str,uint256); char str[65];
     //LOCK(mempool.cs);
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
-    {
-        const CTransaction &tx = e.GetTx();
-        const uint256 &hash = tx.GetHash();
-        for (const CTxIn &txin : tx.vin)
-        {
-            //fprintf(stderr,"%s/v%d ",uint256_str(str,txin.prevout.hash),txin.prevout.n);
-            if ( txin.prevout.n == vout && txin.prevout.hash == txid )
-                return(true);
-        }
-        //fprintf(stderr,"are vins for %s\n",uint256_str(str,hash));
-    }
-    return(false);
+    uint256 spender; uint32_t nIn; const CCBlockOverlay *overlay;
+    // while a block is connected its own transactions take the place of the mempool
+    if ( (overlay= CCBlockOverlayCurrent()) != 0 )
+        return(overlay->mapSpent.count(COutPoint(txid,vout)) != 0);
+    return(mempool.getSpender(COutPoint(txid,vout),spender,nIn));
 }
 
 bool mytxid_inmempool(uint256 txid)
 {
-    for (const CTxMemPoolEntry &e : mempool.mapTx)
-    {
-        const CTransaction &tx = e.GetTx();
-        const uint256 &hash = tx.GetHash();
-        if ( txid == hash )
-            return(true);
-    }
-    return(false);
+    const CCBlockOverlay *overlay;
+    if ( (overlay= CCBlockOverlayCurrent()) != 0 )
+        return(overlay->mapTx.count(txid) != 0);
+    return(mempool.exists(txid));
 }
 
 UniValue mempoolToJSON(bool fVerbose = false)
@@ -68,6 +68,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "createmultisig", 0 },
     { "createmultisig", 1 },
     { "listfromto", 2 },
+    { "listfromto", 3 },
     { "listunspent", 0 },
     { "listunspent", 1 },
     { "listunspent", 2 },
@@ -117,6 +118,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
+    { "zcbenchmark", 4 },
     { "getblocksubsidy", 0},
     { "z_listaddresses", 0},
     { "z_listreceivedbyaddress", 1},
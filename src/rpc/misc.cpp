@@ -71,6 +71,8 @@ extern std::vector<std::string> vs_safecoin_notaries(int32_t height, uint32_t ti
 extern std::string str_safe_address(std::string pubkey);
 extern bool getAddressFromIndex(const int &type, const uint160 &hash, std::string &address);
 extern bool heightSort(std::pair<CAddressUnspentKey, CAddressUnspentValue> a, std::pair<CAddressUnspentKey, CAddressUnspentValue> b);
+int32_t safecoin_safenode_lookup(const std::string &safekey,int32_t current_height,int32_t *heightp,int32_t *durationp,uint32_t *flagsp);
+int32_t safecoin_safenodes_active(std::vector<std::pair<std::string,int32_t> > &safenodes,int32_t current_height);
 
 
 UniValue getinfo(const UniValue& params, bool fHelp)
@@ -784,6 +786,77 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+/** A continuation token is the hex of the last index key returned, the next page seeks past it */
+template<typename Key>
+static std::string encodeAddressIndexCursor(const Key &key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template<typename Key>
+static bool decodeAddressIndexCursor(const UniValue &value, Key &key)
+{
+    if (!value.isStr() || !IsHex(value.get_str())) {
+        return false;
+    }
+    std::vector<unsigned char> data(ParseHex(value.get_str()));
+    CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return ss.empty();
+}
+
+/** Reads the optional "limit" and "after" paging fields, returns true when a page was asked for */
+template<typename Key>
+static bool getAddressIndexPaging(const UniValue& params, size_t &limit, Key &after, bool &fAfter)
+{
+    limit = 0;
+    fAfter = false;
+    if (!params[0].isObject()) {
+        return false;
+    }
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue afterValue = find_value(params[0].get_obj(), "after");
+    if (limitValue.isNull()) {
+        if (!afterValue.isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "After requires a limit");
+        }
+        return false;
+    }
+    if (!limitValue.isNum() || limitValue.get_int() <= 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+    }
+    limit = limitValue.get_int();
+
+    if (!afterValue.isNull()) {
+        if (!decodeAddressIndexCursor(afterValue, after)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid after token");
+        }
+        fAfter = true;
+    }
+    return true;
+}
+
+/** Position of the address a continuation token belongs to, the addresses before it are done */
+static size_t getAddressIndexResume(const std::vector<std::pair<uint160, int> > &addresses, bool fAfter, int type, const uint160 &hashBytes)
+{
+    if (!fAfter) {
+        return 0;
+    }
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i].first == hashBytes && addresses[i].second == type) {
+            return i;
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "After token does not belong to the addresses");
+}
+
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -869,6 +942,8 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      ,...\n"
             "    ],\n"
             "  \"chainInfo\"  (boolean) Include chain info with results\n"
+            "  \"limit\"  (number) Return at most this many outputs, the result becomes {\"utxos\": [...], \"next\": token}\n"
+            "  \"after\"  (string) The \"next\" token of the previous page\n"
             "}\n"
             "\nResult\n"
             "[\n"
@@ -900,11 +975,29 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t limit;
+    bool fAfter;
+    CAddressUnspentKey after;
+    bool fPaged = getAddressIndexPaging(params, limit, after, fAfter);
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    std::string next;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    if (fPaged) {
+        for (size_t i = getAddressIndexResume(addresses, fAfter, after.type, after.hashBytes); i < addresses.size() && unspentOutputs.size() < limit; i++) {
+            bool fResume = fAfter && addresses[i].first == after.hashBytes && addresses[i].second == (int)after.type;
+            if (!GetAddressUnspent(addresses[i].first, addresses[i].second, unspentOutputs, fResume ? &after : NULL, limit - unspentOutputs.size())) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+        }
+        if (unspentOutputs.size() >= limit) {
+            next = encodeAddressIndexCursor(unspentOutputs.back().first);
+        }
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
         }
     }
 
@@ -928,13 +1021,18 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         utxos.push_back(output);
     }
 
-    if (includeChainInfo) {
+    if (includeChainInfo || fPaged) {
         UniValue result(UniValue::VOBJ);
         result.push_back(Pair("utxos", utxos));
+        if (!next.empty()) {
+            result.push_back(Pair("next", next));
+        }
 
-        LOCK(cs_main);
-        result.push_back(Pair("hash", chainActive.LastTip()->GetBlockHash().GetHex()));
-        result.push_back(Pair("height", (int)chainActive.Height()));
+        if (includeChainInfo) {
+            LOCK(cs_main);
+            result.push_back(Pair("hash", chainActive.LastTip()->GetBlockHash().GetHex()));
+            result.push_back(Pair("height", (int)chainActive.Height()));
+        }
         return result;
     } else {
         return utxos;
@@ -1042,6 +1140,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
             "  \"chainInfo\" (boolean) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\" (number) Return at most this many deltas, the result becomes {\"deltas\": [...], \"next\": token}\n"
+            "  \"after\" (string) The \"next\" token of the previous page\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -1088,16 +1188,34 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t limit;
+    bool fAfter;
+    CAddressIndexKey after;
+    bool fPaged = getAddressIndexPaging(params, limit, after, fAfter);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::string next;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+    if (fPaged) {
+        for (size_t i = getAddressIndexResume(addresses, fAfter, after.type, after.hashBytes); i < addresses.size() && addressIndex.size() < limit; i++) {
+            bool fResume = fAfter && addresses[i].first == after.hashBytes && addresses[i].second == (int)after.type;
+            if (!GetAddressIndex(addresses[i].first, addresses[i].second, addressIndex, start, end, fResume ? &after : NULL, limit - addressIndex.size())) {
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
             }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (addressIndex.size() >= limit) {
+            next = encodeAddressIndexCursor(addressIndex.back().first);
+        }
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (start > 0 && end > 0) {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
+            } else {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
             }
         }
     }
@@ -1142,9 +1260,18 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         endInfo.push_back(Pair("height", end));
 
         result.push_back(Pair("deltas", deltas));
+        if (!next.empty()) {
+            result.push_back(Pair("next", next));
+        }
         result.push_back(Pair("start", startInfo));
         result.push_back(Pair("end", endInfo));
 
+        return result;
+    } else if (fPaged) {
+        result.push_back(Pair("deltas", deltas));
+        if (!next.empty()) {
+            result.push_back(Pair("next", next));
+        }
         return result;
     } else {
         return deltas;
@@ -1169,6 +1296,7 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "{\n"
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
+            "  \"txcount\"  (numeric) The number of transactions involving each address, summed (with -addressbalanceindex only)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"RY5LccmGiX9bUHYGtSWQouNy1yFhc5rM87\"]}'")
@@ -1181,6 +1309,30 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    extern bool fAddressBalanceIndex;
+    if (fAddressBalanceIndex) {
+        CAmount balance = 0;
+        CAmount received = 0;
+        int64_t txcount = 0;
+
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            CAddressBalanceValue value;
+            if (!GetAddressBalance((*it).first, (*it).second, value)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            balance += value.balance;
+            received += value.received;
+            txcount += value.txcount;
+        }
+
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("balance", balance));
+        result.push_back(Pair("received", received));
+        result.push_back(Pair("txcount", txcount));
+
+        return result;
+    }
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -1207,25 +1359,20 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
 
 }
 
-UniValue safecoin_snapshot(int top);
+UniValue safecoin_snapshot(int top,const std::string &exportfile);
 
 UniValue getsnapshot(const UniValue& params, bool fHelp)
 {
-    UniValue result(UniValue::VOBJ); int64_t total; int32_t top = 0;
-
-    if (params.size() > 0 && !params[0].isNull()) {
-        top = atoi(params[0].get_str().c_str());
-    if (top <= 0)
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, top must be a positive integer");
-    }
+    UniValue result(UniValue::VOBJ); int64_t total; int32_t top = 0; std::string exportfile;
 
-    if ( fHelp || params.size() > 1)
+    if ( fHelp || params.size() > 2)
     {
         throw runtime_error(
                             "getsnapshot\n"
 			    "\nReturns a snapshot of (address,amount) pairs at current height (requires addressindex to be enabled).\n"
 			    "\nArguments:\n"
 			    "  \"top\" (number, optional) Only return this many addresses, i.e. top N richlist\n"
+			    "  \"filename\" (string, optional) Write \"addr amount\" lines to this file in -exportdir instead of returning the addresses array\n"
 			    "\nResult:\n"
 			    "{\n"
 			    "   \"addresses\": [\n"
@@ -1252,7 +1399,37 @@ UniValue getsnapshot(const UniValue& params, bool fHelp)
 			    + HelpExampleRpc("getsnapshot", "1000")
                             );
     }
-    result = safecoin_snapshot(top);
+
+    if (params.size() > 0 && !params[0].isNull()) {
+        top = atoi(params[0].get_str().c_str());
+    if (top <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, top must be a positive integer");
+    }
+
+    if (params.size() > 1 && !params[1].isNull()) {
+        boost::filesystem::path exportdir;
+        try {
+            exportdir = GetExportDir();
+        } catch (const std::runtime_error& e) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, e.what());
+        }
+        if (exportdir.empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot export snapshot until the safecoind -exportdir option has been set");
+        std::string unclean = params[1].get_str();
+        std::string clean = SanitizeFilename(unclean);
+        if (clean.compare(unclean) != 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Filename is invalid as only alphanumeric characters are allowed.  Try '%s' instead.", clean));
+        boost::filesystem::path exportfilepath = exportdir / clean;
+        if (boost::filesystem::exists(exportfilepath))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot overwrite existing file " + exportfilepath.string());
+        exportfile = exportfilepath.string();
+    }
+
+    try {
+        result = safecoin_snapshot(top,exportfile);
+    } catch (const std::runtime_error& e) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, e.what());
+    }
     if ( result.size() > 0 ) {
         result.push_back(Pair("end_time", (int) time(NULL)));
     } else {
@@ -1276,6 +1453,8 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number) Read at most this many index entries, the result becomes {\"txids\": [...], \"next\": token}\n"
+            "  \"after\" (string) The \"next\" token of the previous page\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -1304,16 +1483,34 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
+    size_t limit;
+    bool fAfter;
+    CAddressIndexKey after;
+    bool fPaged = getAddressIndexPaging(params, limit, after, fAfter);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::string next;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+    if (fPaged) {
+        for (size_t i = getAddressIndexResume(addresses, fAfter, after.type, after.hashBytes); i < addresses.size() && addressIndex.size() < limit; i++) {
+            bool fResume = fAfter && addresses[i].first == after.hashBytes && addresses[i].second == (int)after.type;
+            if (!GetAddressIndex(addresses[i].first, addresses[i].second, addressIndex, start, end, fResume ? &after : NULL, limit - addressIndex.size())) {
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
             }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (addressIndex.size() >= limit) {
+            next = encodeAddressIndexCursor(addressIndex.back().first);
+        }
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (start > 0 && end > 0) {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
+            } else {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
             }
         }
     }
@@ -1340,6 +1537,15 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("txids", result));
+        if (!next.empty()) {
+            page.push_back(Pair("next", next));
+        }
+        return page;
+    }
+
     return result;
 
 }
@@ -1348,8 +1554,10 @@ UniValue listfromto(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2)
         throw runtime_error(
-            "\nlistfromto \"src-address\" \"dst-address\" ( start-height )\n"
+            "\nlistfromto \"src-address\" \"dst-address\" ( start-height limit )\n"
             "\nReturns payments txids from src-address to dst-address (requires addressindex to be enabled).\n"
+            "With a limit the list stops after the block in which it was reached and the result becomes\n"
+            "{\"payments\": [...], \"next_height\": n}, call again with start-height n. No next_height means it is complete.\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1368,10 +1576,21 @@ UniValue listfromto(const UniValue& params, bool fHelp)
     std::string str_src_address = params[0].get_str();
     std::string str_dst_address = params[1].get_str();
 	
-	uint32_t start_height = (params.size() == 3) ? params[2].get_int() : 1;
-	uint32_t end_height = chainActive.LastTip()->GetHeight();
-	
-	LOCK(cs_main);
+	uint32_t start_height = (params.size() >= 3) ? std::max(1, params[2].get_int()) : 1;
+	size_t limit = 0;
+	if (params.size() >= 4)
+	{
+		if (params[3].get_int() <= 0)
+			throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+		limit = params[3].get_int();
+	}
+
+	// the index reads and GetTransaction below lock on their own, cs_main is only held for the chain lookups
+	uint32_t end_height;
+	{
+		LOCK(cs_main);
+		end_height = chainActive.LastTip()->GetHeight();
+	}
 	
 	CBitcoinAddress src_address(str_src_address);
 	CBitcoinAddress dst_address(str_dst_address);
@@ -1394,115 +1613,145 @@ UniValue listfromto(const UniValue& params, bool fHelp)
 	}
 
  
-	std::vector<std::pair<CAddressIndexKey, CAmount> > src_address_index;
-	std::vector<std::pair<CAddressIndexKey, CAmount> > dst_address_index;
-
-	if (!GetAddressIndex(src_hash_bytes, src_type, src_address_index, start_height, end_height))
-	{
-		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for source address");
-	}
-	
-	if (!GetAddressIndex(dst_hash_bytes, dst_type, dst_address_index, start_height, end_height))
-	{
-		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for destination address");
-	}
- 
-    std::set<std::pair<int, std::string> > src_txids, dst_txids, intersect_txids;
-    
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=src_address_index.begin(); it!=src_address_index.end(); it++)
-	{
-        int height = it->first.blockHeight;
-        std::string txid = it->first.txhash.GetHex();
-		src_txids.insert(std::make_pair(height, txid));
-    }
-    
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=dst_address_index.begin(); it!=dst_address_index.end(); it++)
-	{
-        int height = it->first.blockHeight;
-        std::string txid = it->first.txhash.GetHex();
-		dst_txids.insert(std::make_pair(height, txid));
-    }
-    
-    std::set_intersection(src_txids.begin(), src_txids.end(),
-                          dst_txids.begin(), dst_txids.end(),
-                          std::inserter(intersect_txids, intersect_txids.end()));
-
+	// the two indexes are read a window of blocks at a time, so a long history is never held in memory at once
+	static const uint32_t LISTFROMTO_WINDOW = 1000;
 	UniValue result(UniValue::VARR);
-	for (auto const &p: intersect_txids)
+	uint32_t last_height = 0, next_height = 0;
+
+	for (uint32_t window_start = start_height; window_start <= end_height && next_height == 0; window_start += LISTFROMTO_WINDOW)
 	{
-	    uint32_t height = p.first;
-	    std::string str_txid = p.second;
-	    uint256 hash = ParseHashV(str_txid, "txid");
+		uint32_t window_end = std::min(end_height, window_start + LISTFROMTO_WINDOW - 1);
+		std::vector<std::pair<CAddressIndexKey, CAmount> > src_address_index;
+		std::vector<std::pair<CAddressIndexKey, CAmount> > dst_address_index;
 
-		CTransaction tx;
-		uint256 hashBlock;
-		int nBlockTime = 0;
+		if (!GetAddressIndex(src_hash_bytes, src_type, src_address_index, window_start, window_end))
+		{
+			throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for source address");
+		}
+		
+		if (!GetAddressIndex(dst_hash_bytes, dst_type, dst_address_index, window_start, window_end))
+		{
+			throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for destination address");
+		}
+	 
+		std::set<std::pair<int, std::string> > src_txids, dst_txids, intersect_txids;
+		
+		for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=src_address_index.begin(); it!=src_address_index.end(); it++)
+		{
+			int height = it->first.blockHeight;
+			std::string txid = it->first.txhash.GetHex();
+			src_txids.insert(std::make_pair(height, txid));
+		}
+		
+		for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=dst_address_index.begin(); it!=dst_address_index.end(); it++)
+		{
+			int height = it->first.blockHeight;
+			std::string txid = it->first.txhash.GetHex();
+			dst_txids.insert(std::make_pair(height, txid));
+		}
+		
+		std::set_intersection(src_txids.begin(), src_txids.end(),
+							  dst_txids.begin(), dst_txids.end(),
+							  std::inserter(intersect_txids, intersect_txids.end()));
 
-		if (GetTransaction(hash, tx, hashBlock, true))
+		for (auto const &p: intersect_txids)
 		{
-			if (!tx.IsCoinBase()) // skip coinbase transactions
+			uint32_t height = p.first;
+			std::string str_txid = p.second;
+
+			// a page always ends with a whole block
+			if (limit != 0 && result.size() >= limit && height != last_height)
 			{
-							
-				BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-				if (mi != mapBlockIndex.end() && (*mi).second)
-				{
-					CBlockIndex* pindex = (*mi).second;
-					nBlockTime = pindex->GetBlockTime();
-				}
+				next_height = height;
+				break;
+			}
+			uint256 hash = ParseHashV(str_txid, "txid");
+
+			CTransaction tx;
+			uint256 hashBlock;
+			int nBlockTime = 0;
 
-				// we want all inputs to be from src address
-				bool flag_good_src = true;
-				for (const CTxIn& txin : tx.vin)
+			if (GetTransaction(hash, tx, hashBlock, true))
+			{
+				if (!tx.IsCoinBase()) // skip coinbase transactions
 				{
-					uint256 prevout_hash;
-					CTransaction prevout_tx;
-					CTxDestination prevout_address;
-					
-					if (GetTransaction(txin.prevout.hash, prevout_tx, prevout_hash, false))
 					{
-						if (ExtractDestination(prevout_tx.vout[txin.prevout.n].scriptPubKey, prevout_address))
+						LOCK(cs_main);
+						BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+						if (mi != mapBlockIndex.end() && (*mi).second)
 						{
-							flag_good_src = flag_good_src && (CBitcoinAddress(prevout_address) == src_address);
+							CBlockIndex* pindex = (*mi).second;
+							nBlockTime = pindex->GetBlockTime();
 						}
-						else flag_good_src = false;
 					}
-					else flag_good_src = false;
-					
-					// no need to wait end of the loop if we already know the result
-					if (!flag_good_src) break;	
-				
-				}
-				
-				if (flag_good_src)
-				{
-					// we want at least one output to be dst address
-					int good_vout_count = 0;
-					CAmount received_satoshis = 0;
-					for (const CTxOut& txout : tx.vout)
+
+					// we want all inputs to be from src address
+					bool flag_good_src = true;
+					for (const CTxIn& txin : tx.vin)
 					{
-						CTxDestination out_address;
-						if (ExtractDestination(txout.scriptPubKey, out_address))
+						uint256 prevout_hash;
+						CTransaction prevout_tx;
+						CTxDestination prevout_address;
+						
+						if (GetTransaction(txin.prevout.hash, prevout_tx, prevout_hash, false))
 						{
-							if (CBitcoinAddress(out_address) == dst_address)
+							if (ExtractDestination(prevout_tx.vout[txin.prevout.n].scriptPubKey, prevout_address))
 							{
-								good_vout_count++;
-								received_satoshis += txout.nValue; // only dst address received amount matters
+								flag_good_src = flag_good_src && (CBitcoinAddress(prevout_address) == src_address);
 							}
+							else flag_good_src = false;
 						}
+						else flag_good_src = false;
+						
+						// no need to wait end of the loop if we already know the result
+						if (!flag_good_src) break;	
+					
 					}
 					
-					if (good_vout_count > 0)
+					if (flag_good_src)
 					{
-						UniValue item(UniValue::VOBJ);
-						item.push_back(Pair("height", (int64_t)height));
-						item.push_back(Pair("timestamp", nBlockTime));
-						item.push_back(Pair("txid", str_txid));
-						item.push_back(Pair("received_SAFE", ValueFromAmount(received_satoshis)));
-						result.push_back(item);
+						// we want at least one output to be dst address
+						int good_vout_count = 0;
+						CAmount received_satoshis = 0;
+						for (const CTxOut& txout : tx.vout)
+						{
+							CTxDestination out_address;
+							if (ExtractDestination(txout.scriptPubKey, out_address))
+							{
+								if (CBitcoinAddress(out_address) == dst_address)
+								{
+									good_vout_count++;
+									received_satoshis += txout.nValue; // only dst address received amount matters
+								}
+							}
+						}
+						
+						if (good_vout_count > 0)
+						{
+							UniValue item(UniValue::VOBJ);
+							item.push_back(Pair("height", (int64_t)height));
+							item.push_back(Pair("timestamp", nBlockTime));
+							item.push_back(Pair("txid", str_txid));
+							item.push_back(Pair("received_SAFE", ValueFromAmount(received_satoshis)));
+							result.push_back(item);
+							last_height = height;
+						}
 					}
 				}
 			}
 		}
+
+		if (limit != 0 && result.size() >= limit && next_height == 0 && window_end < end_height)
+			next_height = window_end + 1;
+	}
+
+	if (limit != 0)
+	{
+		UniValue page(UniValue::VOBJ);
+		page.push_back(Pair("payments", result));
+		if (next_height != 0)
+			page.push_back(Pair("next_height", (int64_t)next_height));
+		return page;
 	}
 	
     return result;
@@ -1611,8 +1860,6 @@ UniValue getnodeinfo(const UniValue& params, bool fHelp)
 	UniValue obj(UniValue::VOBJ);
     UniValue errors(UniValue::VARR);
 	
-	bool safenode_valid = true; // presumption of innocence 
-	
 	std::string parentkey = GetArg("-parentkey", "");
 	std::string safekey = GetArg("-safekey", "");
 	std::string safeheight = GetArg("-safeheight", "");
@@ -1622,39 +1869,10 @@ UniValue getnodeinfo(const UniValue& params, bool fHelp)
 	CBlockIndex *pblockindex = chainActive[height];
     if ( pblockindex != 0 ) timestamp = pblockindex->GetBlockTime();
 	
-    // checking parentkey
-    std::vector<std::string> notaries = vs_safecoin_notaries(height, timestamp);
-    std::vector<std::string>::iterator it = std::find(notaries.begin(), notaries.end(), parentkey);
-    if (it == notaries.end())
-    {
-		errors.push_back("Invalid parentkey, should be a valid notary pubkey !");
-		safenode_valid = false;
-	}
-	
-	// checking safekey
+	std::vector<std::string> vs_errors;
+	bool safenode_valid = SafeNodeValidateParams(height, timestamp, vs_errors);
+	for (int i = 0; i < vs_errors.size(); i++) errors.push_back(vs_errors[i]);
 	std::string safe_address = str_safe_address(safekey);
-    if (safe_address == "invalid")
-    {
-		errors.push_back("Invalid safekey, should be a valid safenode pubkey !");
-		safenode_valid = false;
-	}
-	
-	// checking safeheight
-	int32_t i_safeheight = 0; // presumption of guilt
-	try 
-	{
-		i_safeheight = std::stoi(safeheight);
-		if (i_safeheight < 750000) throw i_safeheight;
-		if (i_safeheight > height) throw i_safeheight;
-	}
-	catch (...)
-	{
-		errors.push_back("Invalid safeheight, should be a number >= 750000 and <= current height !");
-		safenode_valid = false;
-	}
-	
-	
-	
 	
     obj.push_back(Pair("executable_version", FormatFullVersion()));
     obj.push_back(Pair("protocolversion", PROTOCOL_VERSION));
@@ -1895,30 +2113,10 @@ UniValue getregistrationinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("safekey", safe_key));
 		obj.push_back(Pair("SAFE_address", safe_address));
         
-		struct safecoin_kv *s;
-		extern struct safecoin_kv *SAFECOIN_KV;
-		extern pthread_mutex_t SAFECOIN_KV_mutex;
-		
-		pthread_mutex_lock(&SAFECOIN_KV_mutex);
-		
-		for(s = SAFECOIN_KV; s != NULL; s = (safecoin_kv*)s->hh.next)
-		{
-			uint8_t *value_ptr = s->value;
-			uint16_t value_size = s->valuesize;
-			
-			// skip checking against records with invalid safeid size
-			if (value_size == 66)
-			{
-				std::string str_saved_safeid = std::string((char*)value_ptr, (int)value_size);
-				if (s->height > last_reg_height && str_saved_safeid == safe_key)
-				{
-					last_reg_height = s->height;
-					last_reg_duration = ((s->flags >> 2) + 1) * SAFECOIN_KVDURATION;
-				}
-			} 
-		}
-		
-		pthread_mutex_unlock(&SAFECOIN_KV_mutex);
+		// the latest registration is reported even once expired, valid_thru_height tells the caller
+		uint32_t last_reg_flags;
+		if (safecoin_safenode_lookup(safe_key, 0, &last_reg_height, &last_reg_duration, &last_reg_flags) < 0)
+			last_reg_height = 0;
 
 		if (last_reg_height > 0)
 		{
@@ -1957,33 +2155,9 @@ UniValue getactivenodes(const UniValue& params, bool fHelp)
 
 	int32_t current_height = chainActive.LastTip()->GetHeight(); 
 
-	std::vector<std::string> vs_safekeys;
-	std::vector<std::string>::iterator it;
-	
-	struct safecoin_kv *s;
-	extern struct safecoin_kv *SAFECOIN_KV;
-	extern pthread_mutex_t SAFECOIN_KV_mutex;
-	
-	pthread_mutex_lock(&SAFECOIN_KV_mutex);
-	
-	for(s = SAFECOIN_KV; s != NULL; s = (safecoin_kv*)s->hh.next)
-	{
-		uint8_t *value_ptr = s->value;
-		uint16_t value_size = s->valuesize;
-		
-		// skip checking against records with invalid safeid size
-		if (value_size == 66)
-		{
-			std::string str_saved_safeid = std::string((char*)value_ptr, 66);
-			it = std::find(vs_safekeys.begin(), vs_safekeys.end(), str_saved_safeid);
-			if (it == vs_safekeys.end())
-			{
-				vs_safekeys.push_back(str_saved_safeid);
-			}
-		} 
-	}
-	
-	pthread_mutex_unlock(&SAFECOIN_KV_mutex);
+	// (safekey, valid thru height) for every unexpired registration, copied out of the safenode index
+	std::vector<std::pair<std::string,int32_t> > vp_safenodes;
+	safecoin_safenodes_active(vp_safenodes, current_height);
 	
 	int node_count = 0;
 	int tier_0_count = 0;
@@ -1993,23 +2167,21 @@ UniValue getactivenodes(const UniValue& params, bool fHelp)
 	double collateral_total = 0;
 	extern bool fAddressIndex;
 	
-	for (int i = 0; i < vs_safekeys.size(); i++)
+	for (int i = 0; i < vp_safenodes.size(); i++)
 	{
-		UniValue uv_one_node(UniValue::VOBJ), params(UniValue::VARR);
-		params.push_back(vs_safekeys.at(i));
-		UniValue uv_registration_info = getregistrationinfo(params, false);
-		UniValue uv_safe_address = find_value(uv_registration_info, "SAFE_address");
-		UniValue uv_last_reg_height = find_value(uv_registration_info, "last_reg_height");
-		UniValue uv_valid_thru_height = find_value(uv_registration_info, "valid_thru_height");
+		UniValue uv_one_node(UniValue::VOBJ);
+		std::string safe_address = str_safe_address(vp_safenodes.at(i).first);
 		
-		if (!uv_last_reg_height.isNull() && uv_valid_thru_height.get_int() >= current_height)
+		if (safe_address != "invalid" && vp_safenodes.at(i).second >= current_height)
 		{
-			uv_one_node.push_back(Pair("safekey", vs_safekeys.at(i)));
-			uv_one_node.push_back(Pair("SAFE_address", uv_safe_address));
+			uv_one_node.push_back(Pair("safekey", vp_safenodes.at(i).first));
+			uv_one_node.push_back(Pair("SAFE_address", safe_address));
 			node_count++;
 			if (fAddressIndex)
 			{
-				UniValue uv_collateral_info = getcollateralinfo(params, false);
+				UniValue gci_params(UniValue::VARR);
+				gci_params.push_back(vp_safenodes.at(i).first);
+				UniValue uv_collateral_info = getcollateralinfo(gci_params, false);
 				UniValue uv_collateral = find_value(uv_collateral_info, "collateral");
 				UniValue uv_balance = find_value(uv_collateral_info, "current_balance");
 				UniValue uv_tier = find_value(uv_collateral_info, "tier");
@@ -112,6 +112,45 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
 
     return nErr;
 }
+/**
+ * @brief Advance a handshake on a non-blocking socket by one step, without waiting.
+ * 
+ * @param eRoutine SSL_ACCEPT or SSL_CONNECT.
+ * @param ssl pointer to an SSL instance.
+ * @param nWant set to SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE when the handshake is still in progress.
+ * @return int returns 1 when the handshake is complete, 0 when it has to be retried once the socket is ready, -1 on error.
+ */
+int TLSManager::handshakeStep(SSLConnectionRoutine eRoutine, SSL* ssl, int& nWant)
+{
+    int nErr = 0;
+    ERR_clear_error(); // clear the error queue
+
+    switch (eRoutine) {
+    case SSL_CONNECT:
+        nErr = SSL_connect(ssl);
+        break;
+
+    case SSL_ACCEPT:
+        nErr = SSL_accept(ssl);
+        break;
+
+    default:
+        return -1;
+    }
+
+    if (nErr == 1)
+        return 1;
+
+    int sslErr = SSL_get_error(ssl, nErr);
+
+    if (sslErr != SSL_ERROR_WANT_READ && sslErr != SSL_ERROR_WANT_WRITE) {
+        LogPrint("net", "TLS: WARNING: %s: %s: ssl_err_code: %s; errno: %s\n", __FILE__, __func__, ERR_error_string(sslErr, NULL), strerror(errno));
+        return -1;
+    }
+
+    nWant = sslErr;
+    return 0;
+}
 /**
  * @brief establish TLS connection to an address
  * 
@@ -281,47 +320,115 @@ SSL* TLSManager::accept(SOCKET hSocket, const CAddress& addr)
 
     return ssl;
 }
+/**
+ * @brief prepare a server side TLS session whose handshake is then driven by handshakeStep from the socket handler
+ * 
+ * @param hSocket the non-blocking TLS socket.
+ * @param addr incoming address.
+ * @return SSL* returns pointer to the ssl object if successful, otherwise returns NULL
+ */
+SSL* TLSManager::startAccept(SOCKET hSocket, const CAddress& addr)
+{
+    LogPrint("net", "TLS: starting handshake with %s (tid = %X)\n", addr.ToString(), pthread_self());
+
+    SSL* ssl = NULL;
+
+    if ((ssl = SSL_new(tls_ctx_server))) {
+        if (!SSL_set_fd(ssl, hSocket)) {
+            SSL_free(ssl);
+            ssl = NULL;
+        }
+    }
+
+    if (!ssl)
+        LogPrintf("TLS: ERROR: %s: %s: failed to create TLS session for %s\n", __FILE__, __func__, addr.ToString());
+
+    return ssl;
+}
+/**
+ * @brief Add an address to the pool, or refresh its time if it is already there.
+ * 
+ * @param strAddr The address.
+ * @param nTime time in msec of the failed TLS attempt.
+ */
+void NonTLSPool::insert(const std::string& strAddr, int64_t nTime)
+{
+    int64_t nBucket = nTime / NON_TLS_POOL_SLOT;
+
+    mapAddrTime[strAddr] = nTime;
+    vWheel[nBucket % vWheel.size()].push_back(strAddr);
+    if (nNextBucket == -1 || nBucket < nNextBucket)
+        nNextBucket = nBucket;
+}
+/**
+ * @brief Remove the addresses older than NON_TLS_POOL_EXPIRY, walking only the buckets that became due since the last call.
+ * 
+ * @param nNow current time in msec.
+ * @param vExpired receives the removed addresses.
+ */
+void NonTLSPool::expire(int64_t nNow, std::vector<std::string>& vExpired)
+{
+    if (nNextBucket == -1)
+        return;
+
+    // newest bucket that can contain an expired entry, it is partially due and gets revisited next time
+    int64_t nLastBucket = (nNow - NON_TLS_POOL_EXPIRY) / NON_TLS_POOL_SLOT;
+
+    for (int64_t nBucket = nNextBucket; nBucket <= nLastBucket; nBucket++) {
+        std::vector<std::string>& vSlot = vWheel[nBucket % vWheel.size()];
+        std::vector<std::string> vKeep;
+
+        for (const std::string& strAddr : vSlot) {
+            std::unordered_map<std::string, int64_t>::iterator it = mapAddrTime.find(strAddr);
+            if (it == mapAddrTime.end() || it->second / NON_TLS_POOL_SLOT < nBucket)
+                continue; // erased, or a stale copy left behind by a refresh
+            if (it->second / NON_TLS_POOL_SLOT == nBucket && nNow - it->second >= NON_TLS_POOL_EXPIRY) {
+                vExpired.push_back(strAddr);
+                mapAddrTime.erase(it);
+            } else
+                vKeep.push_back(strAddr); // not due yet, or a later bucket sharing this slot
+        }
+        vSlot.swap(vKeep);
+    }
+
+    if (mapAddrTime.empty()) {
+        for (std::vector<std::string>& vSlot : vWheel)
+            vSlot.clear();
+        nNextBucket = -1;
+    } else if (nLastBucket > nNextBucket)
+        nNextBucket = nLastBucket;
+}
 /**
  * @brief Determines whether a string exists in the non-TLS address pool.
  * 
  * @param strAddr The address.
- * @param vPool Pool to search in.
+ * @param pool Pool to search in.
  * @param cs reference to the corresponding CCriticalSection.
  * @return true returns true if address exists in the given pool.
  * @return false returns false if address doesnt exist in the given pool.
  */
-bool TLSManager::isNonTLSAddr(const string& strAddr, const vector<NODE_ADDR>& vPool, CCriticalSection& cs)
+bool TLSManager::isNonTLSAddr(const string& strAddr, const NonTLSPool& pool, CCriticalSection& cs)
 {
     LOCK(cs);
-    return (find(vPool.begin(), vPool.end(), NODE_ADDR(strAddr)) != vPool.end());
+    return pool.contains(strAddr);
 }
 /**
  * @brief Removes non-TLS node addresses based on timeout.
  * 
- * @param vPool 
+ * @param pool 
  * @param cs 
  */
-void TLSManager::cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection& cs)
+void TLSManager::cleanNonTLSPool(NonTLSPool& pool, CCriticalSection& cs)
 {
-    LOCK(cs);
-
-    vector<NODE_ADDR> vDeleted;
+    vector<string> vDeleted;
 
-    for (const NODE_ADDR &nodeAddr : vPool) {
-        if ((GetTimeMillis() - nodeAddr.time) >= 900000) {
-            vDeleted.push_back(nodeAddr);
-            LogPrint("net", "TLS: Node %s is deleted from the non-TLS pool\n", nodeAddr.ipAddr);
-        }
+    {
+        LOCK(cs);
+        pool.expire(GetTimeMillis(), vDeleted);
     }
 
-    for (const NODE_ADDR &nodeAddrDeleted : vDeleted) {
-        vPool.erase(
-            remove(
-                vPool.begin(),
-                vPool.end(),
-                nodeAddrDeleted),
-            vPool.end());
-    }
+    for (const string& strAddr : vDeleted)
+        LogPrint("net", "TLS: Node %s is deleted from the non-TLS pool\n", strAddr);
 }
 
 /**
@@ -335,9 +442,6 @@ void TLSManager::cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection
  */
 int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
 {
-    //
-    // Receive
-    //
     bool recvSet = false, sendSet = false, errorSet = false;
 
     {
@@ -351,6 +455,22 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
         errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
     }
 
+    return threadSocketHandler(pnode, recvSet, sendSet, errorSet);
+}
+/**
+ * @brief Handles send and recieve functionality in TLS Sockets once readiness is known (select() or epoll).
+ * 
+ * @param pnode reference to the CNode object.
+ * @param recvSet the socket is readable.
+ * @param sendSet the socket is writable.
+ * @param errorSet the socket has a pending error.
+ * @return int returns -1 when socket is invalid. returns 0 otherwise.
+ */
+int TLSManager::threadSocketHandler(CNode* pnode, bool recvSet, bool sendSet, bool errorSet)
+{
+    //
+    // Receive
+    //
     if (recvSet || errorSet) {
         TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
         if (lockRecv) {
@@ -402,6 +522,9 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
                             if (!pnode->fDisconnect)
                                 LogPrintf("ERROR: SSL_read %s\n", ERR_error_string(nRet, NULL));
                             pnode->CloseSocketDisconnect();
+                        } else if (nRet == SSL_ERROR_WANT_READ) {
+                            // the socket is drained, wait for the next readiness event
+                            pnode->fRecvReady = false;
                         } else {
                             // preventive measure from exhausting CPU usage
                             //
@@ -412,7 +535,8 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
                             if (!pnode->fDisconnect)
                                 LogPrintf("ERROR: socket recv %s\n", NetworkErrorString(nRet));
                             pnode->CloseSocketDisconnect();
-                        }
+                        } else if (nRet == WSAEWOULDBLOCK)
+                            pnode->fRecvReady = false;
                     }
                 }
             }
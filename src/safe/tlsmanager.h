@@ -15,6 +15,7 @@
 #include "../net.h"
 #include "sync.h"
 #include <boost/filesystem/path.hpp>
+#include <unordered_map>
 #include <boost/signals2/signal.hpp>
 #ifdef WIN32
 #include <string.h>
@@ -37,6 +38,33 @@ bool operator==(const _NODE_ADDR b) const
 }
 } NODE_ADDR, *PNODE_ADDR;
 
+/** How long (in msec) an address that failed TLS is retried in non-TLS mode. */
+static const int64_t NON_TLS_POOL_EXPIRY = 900000;
+/** Width (in msec) of one time wheel slot of the non-TLS pools. */
+static const int64_t NON_TLS_POOL_SLOT = 60000;
+
+/**
+ * @brief Addresses that failed a TLS handshake. Lookups and inserts are hashed, and expiry walks
+ * a time wheel of NON_TLS_POOL_SLOT wide buckets so only entries that are due get touched.
+ * Erased or re-inserted addresses leave stale wheel entries behind that are dropped lazily.
+ */
+class NonTLSPool
+{
+public:
+    NonTLSPool() : nNextBucket(-1), vWheel(NON_TLS_POOL_EXPIRY / NON_TLS_POOL_SLOT + 2) {}
+
+    bool contains(const std::string& strAddr) const { return mapAddrTime.count(strAddr) != 0; }
+    size_t size() const { return mapAddrTime.size(); }
+    void insert(const std::string& strAddr, int64_t nTime);
+    void erase(const std::string& strAddr) { mapAddrTime.erase(strAddr); }
+    void expire(int64_t nNow, std::vector<std::string>& vExpired);
+
+private:
+    std::unordered_map<std::string, int64_t> mapAddrTime;
+    int64_t nNextBucket; // oldest bucket that may still hold live entries, -1 while empty
+    std::vector<std::vector<std::string> > vWheel;
+};
+
 /**
  * @brief A class to wrap some of Safecoin specific TLS functionalities used in the net.cpp
  * 
@@ -45,6 +73,8 @@ class TLSManager
 {
 public:
      int waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl, int timeoutSec);
+     int handshakeStep(SSLConnectionRoutine eRoutine, SSL* ssl, int& nWant);
+     SSL* startAccept(SOCKET hSocket, const CAddress& addr);
      SSL* connect(SOCKET hSocket, const CAddress& addrConnect);
      SSL_CTX* initCtx(
         TLSContextType ctxType,
@@ -54,9 +84,10 @@ public:
 
      bool prepareCredentials();
      SSL* accept(SOCKET hSocket, const CAddress& addr);
-     bool isNonTLSAddr(const string& strAddr, const vector<NODE_ADDR>& vPool, CCriticalSection& cs);
-     void cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection& cs);
+     bool isNonTLSAddr(const string& strAddr, const NonTLSPool& pool, CCriticalSection& cs);
+     void cleanNonTLSPool(NonTLSPool& pool, CCriticalSection& cs);
      int threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError);
+     int threadSocketHandler(CNode* pnode, bool recvSet, bool sendSet, bool errorSet);
      bool initialize();
 };
 }
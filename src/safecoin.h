@@ -31,12 +31,19 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "uthash.h"
 #include "utlist.h"
 
 int32_t gettxout_scriptPubKey(uint8_t *scriptPubkey,int32_t maxsize,uint256 txid,int32_t n);
 void safecoin_event_rewind(struct safecoin_state *sp,char *symbol,int32_t height);
-void safecoin_connectblock(CBlockIndex *pindex,CBlock& block);
+void safecoin_connectblock(CBlockIndex *pindex,CBlock& block,const CBlockUndo *blockundo = 0);
 
 #include "safecoin_structs.h"
 #include "safecoin_globals.h"
@@ -217,10 +224,12 @@ int32_t memread(void *dest,int32_t size,uint8_t *filedata,long *fposp,long datal
     return(-1);
 }
 
-int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,long *fposp,long datalen,char *symbol,char *dest)
+// records are parsed in place, filedata is normally a private mapping of the state file.
+// With externalonly set only the effects that live outside of sp and its events are applied, this is used for the part of the file a state snapshot already covers.
+int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,long *fposp,long datalen,char *symbol,char *dest,int32_t externalonly)
 {
     static int32_t errs;
-    int32_t func= -1,ht,notarized_height,MoMdepth,num,matched=0; uint256 MoM,notarized_hash,notarized_desttxid; uint8_t pubkeys[64][33]; long fpos = *fposp;
+    int32_t func= -1,ht,notarized_height,MoMdepth,num,matched=0; uint256 MoM,notarized_hash,notarized_desttxid; uint8_t (*pubkeys)[33]; long fpos = *fposp;
     if ( fpos < datalen )
     {
         func = filedata[fpos++];
@@ -233,13 +242,20 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
         {
             if ( (num= filedata[fpos++]) <= 64 )
             {
-                if ( memread(pubkeys,33*num,filedata,&fpos,datalen) != 33*num )
+                if ( fpos+33*num > datalen )
                     errs++;
                 else
                 {
+                    pubkeys = (uint8_t (*)[33])&filedata[fpos];
+                    fpos += 33*num;
                     //printf("updated %d pubkeys at %s ht.%d\n",num,symbol,ht);
                     if ( (SAFECOIN_EXTERNAL_NOTARIES != 0 && matched != 0) || (strcmp(symbol,"SAFE") == 0 && SAFECOIN_EXTERNAL_NOTARIES == 0) )
-                        safecoin_eventadd_pubkeys(sp,symbol,ht,num,pubkeys);
+                    {
+                        if ( externalonly == 0 )
+                            safecoin_eventadd_pubkeys(sp,symbol,ht,num,pubkeys);
+                        else if ( sp != 0 )
+                            safecoin_notarysinit(ht,pubkeys,num);
+                    }
                 }
             } else printf("illegal num.%d\n",num);
         }
@@ -265,7 +281,8 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
                 memset(&MoM,0,sizeof(MoM));
                 MoMdepth = 0;
             }
-            safecoin_eventadd_notarized(sp,symbol,ht,dest,notarized_hash,notarized_desttxid,notarized_height,MoM,MoMdepth);
+            if ( externalonly == 0 )
+                safecoin_eventadd_notarized(sp,symbol,ht,dest,notarized_hash,notarized_desttxid,notarized_height,MoM,MoMdepth);
         }
         else if ( func == 'U' ) // deprecated
         {
@@ -283,7 +300,8 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
             int32_t kheight;
             if ( memread(&kheight,sizeof(kheight),filedata,&fpos,datalen) != sizeof(kheight) )
                 errs++;
-             safecoin_eventadd_safeheight(sp,symbol,ht,kheight,0);
+            if ( externalonly == 0 )
+                safecoin_eventadd_safeheight(sp,symbol,ht,kheight,0);
         }
         else if ( func == 'T' )
         {
@@ -294,11 +312,12 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
                 errs++;
             //if ( matched != 0 ) global independent states -> inside *sp
             //printf("%s.%d load[%s] ht.%d t.%u\n",ASSETCHAINS_SYMBOL,ht,symbol,kheight,ktimestamp);
-            safecoin_eventadd_safeheight(sp,symbol,ht,kheight,ktimestamp);
+            if ( externalonly == 0 )
+                safecoin_eventadd_safeheight(sp,symbol,ht,kheight,ktimestamp);
         }
         else if ( func == 'R' )
         {
-            uint16_t olen,v; uint64_t ovalue; uint256 txid; uint8_t opret[16384*4];
+            uint16_t olen,v; uint64_t ovalue; uint256 txid; uint8_t *opret;
             if ( memread(&txid,sizeof(txid),filedata,&fpos,datalen) != sizeof(txid) )
                 errs++;
             if ( memread(&v,sizeof(v),filedata,&fpos,datalen) != sizeof(v) )
@@ -307,17 +326,20 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
                 errs++;
             if ( memread(&olen,sizeof(olen),filedata,&fpos,datalen) != sizeof(olen) )
                 errs++;
-            if ( olen < sizeof(opret) )
+            if ( olen < 16384*4 && fpos+olen <= datalen )
             {
-                if ( memread(opret,olen,filedata,&fpos,datalen) != olen )
-                    errs++;
+                opret = &filedata[fpos];
+                fpos += olen;
                 if ( 0 && ASSETCHAINS_SYMBOL[0] != 0 && matched != 0 )
                 {
                     int32_t i;  for (i=0; i<olen; i++)
                         printf("%02x",opret[i]);
                     printf(" %s.%d load[%s] opret[%c] len.%d %.8f\n",ASSETCHAINS_SYMBOL,ht,symbol,opret[0],olen,(double)ovalue/COIN);
                 }
-                safecoin_eventadd_opreturn(sp,symbol,ht,txid,ovalue,v,opret,olen); // global shared state -> global PAX
+                if ( externalonly == 0 )
+                    safecoin_eventadd_opreturn(sp,symbol,ht,txid,ovalue,v,opret,olen); // global shared state -> global PAX
+                else if ( sp != 0 )
+                    safecoin_opreturn(ht,ovalue,opret,olen,txid,v,symbol);
             } else
             {
                 int32_t i;
@@ -338,7 +360,10 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
             {
                 //if ( matched != 0 ) global shared state -> global PVALS
                 //printf("%s load[%s] prices %d\n",ASSETCHAINS_SYMBOL,symbol,ht);
-                safecoin_eventadd_pricefeed(sp,symbol,ht,pvals,numpvals);
+                if ( externalonly == 0 )
+                    safecoin_eventadd_pricefeed(sp,symbol,ht,pvals,numpvals);
+                else if ( sp != 0 && numpvals == sizeof(((struct safecoin_event_pricefeed *)0)->prices)/sizeof(uint32_t) )
+                    safecoin_pvals(ht,pvals,numpvals);
                 //printf("load pvals ht.%d numpvals.%d\n",ht,numpvals);
             } else printf("error loading pvals[%d]\n",numpvals);
         } // else printf("[%s] %s illegal func.(%d %c)\n",ASSETCHAINS_SYMBOL,symbol,func,func);
@@ -348,6 +373,18 @@ int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,
     return(-1);
 }
 
+static FILE *safecoin_statefp,*safecoin_statedirty; static int32_t safecoin_statebatch;
+
+// while a block is being connected the state file is flushed once at the end instead of after every record
+void safecoin_stateflush()
+{
+    if ( safecoin_statedirty != 0 )
+    {
+        fflush(safecoin_statedirty);
+        safecoin_statedirty = 0;
+    }
+}
+
 void safecoin_stateupdate(int32_t height,uint8_t notarypubs[][33],uint8_t numnotaries,uint8_t notaryid,uint256 txhash,uint64_t voutmask,uint8_t numvouts,uint32_t *pvals,uint8_t numpvals,int32_t SAFEheight,uint32_t SAFEtimestamp,uint64_t opretvalue,uint8_t *opretbuf,uint16_t opretlen,uint16_t vout,uint256 MoM,int32_t MoMdepth)
 {
     static FILE *fp; static int32_t errs,didinit; static uint256 zero;
@@ -379,6 +416,7 @@ void safecoin_stateupdate(int32_t height,uint8_t notarypubs[][33],uint8_t numnot
                     ;
             }
         } else fp = fopen(fname,"wb+");
+        safecoin_statefp = fp;
         SAFECOIN_INITDONE = (uint32_t)time(NULL);
     }
     if ( height <= 0 )
@@ -501,7 +539,9 @@ void safecoin_stateupdate(int32_t height,uint8_t notarypubs[][33],uint8_t numnot
                 safecoin_eventadd_notarized(sp,symbol,height,dest,sp->NOTARIZED_HASH,sp->NOTARIZED_DESTTXID,sp->NOTARIZED_HEIGHT,sp->MoM,sp->MoMdepth);
             }
         }
-        fflush(fp);
+        if ( safecoin_statebatch == 0 )
+            fflush(fp);
+        else safecoin_statedirty = fp;
     }
 }
 
@@ -793,12 +833,132 @@ int32_t safecoin_notarycmp(uint8_t *scriptPubKey,int32_t scriptlen,uint8_t pubke
     return(-1);
 }
 
-void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
+// Per tx results of the read only pass over a block. Everything here depends only on the block, its undo data and the notary set,
+// so it can be computed on several threads before the state updates are applied in block order.
+struct safecoin_txscan
+{
+    uint64_t signedmask;
+    int32_t needlookup;
+    std::vector<int32_t> vouts; // vouts safecoin_voutupdate can act on: pay to pubkey and OP_RETURN
+};
+
+#define SAFECOIN_BLOCKSCAN_MINTX 64
+
+int32_t safecoin_txscan_vins(struct safecoin_txscan *scan,const CTransaction &tx,const CTxUndo *txundo,int32_t height,int32_t i,uint8_t pubkeys[64][33],int32_t numnotaries,uint8_t rmd160[20])
+{
+    uint8_t scriptPubKey[35]; int32_t j,k,m,scriptlen,numvins = tx.vin.size();
+    scan->signedmask = (height < 91400) ? 1 : 0;
+    scan->needlookup = 0;
+    if ( i == 0 || numvins == 0 )
+        return(0);
+    if ( txundo == 0 || txundo->vprevout.size() != numvins )
+    {
+        // import and other unorthodox txs have no undo data for their vins, the caller has to look the prevouts up
+        scan->needlookup = 1;
+        return(-1);
+    }
+    for (j=0; j<numvins; j++)
+    {
+        const CScript &script = txundo->vprevout[j].txout.scriptPubKey;
+        // same truncation as gettxout_scriptPubKey so matching is unchanged
+        if ( (scriptlen= (int32_t)script.size()) > sizeof(scriptPubKey) )
+            scriptlen = sizeof(scriptPubKey);
+        for (m=0; m<scriptlen; m++)
+            scriptPubKey[m] = script[m];
+        if ( scriptlen > 0 && (k= safecoin_notarycmp(scriptPubKey,scriptlen,pubkeys,numnotaries,rmd160)) >= 0 )
+            scan->signedmask |= (1LL << k);
+    }
+    return(0);
+}
+
+void safecoin_txscan_lookup(struct safecoin_txscan *scan,const CTransaction &tx,int32_t height,int32_t i,uint8_t pubkeys[64][33],int32_t numnotaries,uint8_t rmd160[20])
+{
+    uint8_t scriptPubKey[35]; int32_t j,k,scriptlen,numvins = tx.vin.size();
+    scan->signedmask = (height < 91400) ? 1 : 0;
+    scan->needlookup = 0;
+    for (j=0; j<numvins; j++)
+    {
+        if ( i == 0 && j == 0 )
+            continue;
+        if ( (scriptlen= gettxout_scriptPubKey(scriptPubKey,sizeof(scriptPubKey),tx.vin[j].prevout.hash,tx.vin[j].prevout.n)) > 0 )
+        {
+            if ( (k= safecoin_notarycmp(scriptPubKey,scriptlen,pubkeys,numnotaries,rmd160)) >= 0 )
+                scan->signedmask |= (1LL << k);
+        }
+    }
+}
+
+void safecoin_txscan_vouts(struct safecoin_txscan *scan,const CTransaction &tx)
+{
+    int32_t j,len,numvouts = tx.vout.size();
+    scan->vouts.clear();
+    for (j=0; j<numvouts; j++)
+    {
+        const CScript &script = tx.vout[j].scriptPubKey;
+        if ( (len= (int32_t)script.size()) < sizeof(uint32_t) || len > 10001 )
+            continue;
+        if ( script[0] == 0x6a || (len == 35 && script[0] == 33 && script[34] == 0xac) )
+            scan->vouts.push_back(j);
+    }
+}
+
+static void safecoin_blockscan_range(std::vector<struct safecoin_txscan> *scans,const CBlock *block,const CBlockUndo *blockundo,int32_t height,uint8_t (*pubkeys)[33],int32_t numnotaries,uint8_t *rmd160,int32_t starti,int32_t endi)
+{
+    int32_t i;
+    for (i=starti; i<endi; i++)
+    {
+        safecoin_txscan_vins(&(*scans)[i],block->vtx[i],(i > 0 && blockundo != 0 && i-1 < blockundo->vtxundo.size()) ? &blockundo->vtxundo[i-1] : 0,height,i,pubkeys,numnotaries,rmd160);
+        safecoin_txscan_vouts(&(*scans)[i],block->vtx[i]);
+    }
+}
+
+/* Fills scans[firsti..] for the block. The vin side uses the spent outputs recorded in the block undo data instead of a
+ GetTransaction per vin; large blocks are split across nScriptCheckThreads threads. Txs without undo data fall back to the
+ prevout lookup on the calling thread, which already holds cs_main. */
+void safecoin_blockscan(std::vector<struct safecoin_txscan> &scans,const CBlock &block,const CBlockUndo *blockundo,int32_t height,uint8_t pubkeys[64][33],int32_t numnotaries,uint8_t rmd160[20],int32_t firsti)
+{
+    int32_t i,n,nThreads,chunk,txn_count = block.vtx.size();
+    scans.resize(txn_count);
+    if ( (n= txn_count - firsti) <= 0 )
+        return;
+    nThreads = (n >= SAFECOIN_BLOCKSCAN_MINTX && nScriptCheckThreads > 1) ? nScriptCheckThreads : 1;
+    if ( nThreads > n / (SAFECOIN_BLOCKSCAN_MINTX/2) )
+        nThreads = n / (SAFECOIN_BLOCKSCAN_MINTX/2);
+    if ( nThreads <= 1 )
+        safecoin_blockscan_range(&scans,&block,blockundo,height,pubkeys,numnotaries,rmd160,firsti,txn_count);
+    else
+    {
+        std::vector<std::thread> threads;
+        chunk = (n + nThreads - 1) / nThreads;
+        for (i=firsti+chunk; i<txn_count; i+=chunk)
+            threads.emplace_back(safecoin_blockscan_range,&scans,&block,blockundo,height,pubkeys,numnotaries,rmd160,i,std::min(i+chunk,txn_count));
+        safecoin_blockscan_range(&scans,&block,blockundo,height,pubkeys,numnotaries,rmd160,firsti,firsti+chunk);
+        for (auto &thread : threads)
+            thread.join();
+    }
+    for (i=firsti; i<txn_count; i++)
+        if ( scans[i].needlookup != 0 )
+            safecoin_txscan_lookup(&scans[i],block.vtx[i],height,i,pubkeys,numnotaries,rmd160);
+}
+
+// read only pass used by the zcbenchmark types "blockscanlookup" and "blockscanundo" (blockundo set), returns the number of vouts handed to safecoin_voutupdate
+int32_t safecoin_blockscan_bench(CBlockIndex *pindex,const CBlock &block,const CBlockUndo *blockundo)
+{
+    std::vector<struct safecoin_txscan> scans; uint8_t pubkeys[64][33],rmd160[20]; int32_t i,numnotaries,numvouts = 0;
+    numnotaries = safecoin_notaries(pubkeys,pindex->GetHeight(),pindex->GetBlockTime());
+    calc_rmd160_sha256(rmd160,pubkeys[0],33);
+    safecoin_blockscan(scans,block,blockundo,pindex->GetHeight(),pubkeys,numnotaries,rmd160,0);
+    for (i=0; i<scans.size(); i++)
+        numvouts += scans[i].vouts.size();
+    return(numvouts);
+}
+
+void safecoin_connectblock(CBlockIndex *pindex,CBlock& block,const CBlockUndo *blockundo)
 {
     static int32_t hwmheight;
     uint64_t signedmask,voutmask; char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
-    uint8_t scriptbuf[10001],pubkeys[64][33],rmd160[20],scriptPubKey[35]; uint256 zero,btctxid,txhash;
-    int32_t i,j,k,numnotaries,notarized,scriptlen,isratification,nid,numvalid,specialtx,notarizedheight,notaryid,len,numvouts,numvins,height,txn_count;
+    uint8_t scriptbuf[10001],pubkeys[64][33],rmd160[20]; uint256 zero,btctxid,txhash; std::vector<struct safecoin_txscan> scans;
+    int32_t i,j,k,vi,numnotaries,notarized,isratification,nid,numvalid,specialtx,notarizedheight,notaryid,len,numvouts,numvins,height,txn_count;
     memset(&zero,0,sizeof(zero));
     safecoin_init(pindex->GetHeight());
     SAFECOIN_INITDONE = (uint32_t)time(NULL);
@@ -828,31 +988,16 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
     {
         height = pindex->GetHeight();
         txn_count = block.vtx.size();
+        safecoin_statebatch = 1;
+        safecoin_blockscan(scans,block,blockundo,height,pubkeys,numnotaries,rmd160,0);
         for (i=0; i<txn_count; i++)
         {
             txhash = block.vtx[i].GetHash();
             numvouts = block.vtx[i].vout.size();
             notaryid = -1;
             voutmask = specialtx = notarizedheight = isratification = notarized = 0;
-            signedmask = (height < 91400) ? 1 : 0;
+            signedmask = scans[i].signedmask;
             numvins = block.vtx[i].vin.size();
-            for (j=0; j<numvins; j++)
-            {
-                if ( i == 0 && j == 0 )
-                    continue;
-                if ( (scriptlen= gettxout_scriptPubKey(scriptPubKey,sizeof(scriptPubKey),block.vtx[i].vin[j].prevout.hash,block.vtx[i].vin[j].prevout.n)) > 0 )
-                {
-                    if ( (k= safecoin_notarycmp(scriptPubKey,scriptlen,pubkeys,numnotaries,rmd160)) >= 0 )
-                        signedmask |= (1LL << k);
-                    else if ( 0 && numvins >= 17 )
-                    {
-                        int32_t k;
-                        for (k=0; k<scriptlen; k++)
-                            printf("%02x",scriptPubKey[k]);
-                        printf(" scriptPubKey doesnt match any notary vini.%d of %d\n",j,numvins);
-                    }
-                } //else printf("cant get scriptPubKey for ht.%d txi.%d vin.%d\n",height,i,j);
-            }
             numvalid = bitweight(signedmask);
             if ( (((height < 90000 || (signedmask & 1) != 0) && numvalid >= SAFECOIN_MINRATIFY) ||
                   (numvalid >= SAFECOIN_MINRATIFY && ASSETCHAINS_SYMBOL[0] != 0) ||
@@ -880,37 +1025,18 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
                 notarized = 1;
             }
             if ( IS_SAFECOIN_NOTARY != 0 && ASSETCHAINS_SYMBOL[0] == 0 )
-                printf("(tx.%d: ",i);
-            for (j=0; j<numvouts; j++)
             {
-                /*if ( i == 0 && j == 0 )
-                {
-                    uint8_t *script = (uint8_t *)&block.vtx[0].vout[numvouts-1].scriptPubKey[0];
-                    if ( numvouts <= 2 || script[0] != 0x6a )
-                    {
-                        if ( numvouts == 2 && block.vtx[0].vout[1].nValue != 0 )
-                        {
-                            fprintf(stderr,"ht.%d numvouts.%d value %.8f\n",height,numvouts,dstr(block.vtx[0].vout[1].nValue));
-                            if ( height >= 235300 && block.vtx[0].vout[1].nValue >= 100000*COIN )
-                                block.vtx[0].vout[1].nValue = 0;
-                            break;
-                        }
-                    }
-                }*/
-                if ( IS_SAFECOIN_NOTARY != 0 && ASSETCHAINS_SYMBOL[0] == 0 )
+                printf("(tx.%d: ",i);
+                for (j=0; j<numvouts; j++)
                     printf("%.8f ",dstr(block.vtx[i].vout[j].nValue));
+            }
+            // only pay to pubkey and OP_RETURN vouts can change state, the scan already picked them out
+            for (vi=0; vi<scans[i].vouts.size(); vi++)
+            {
+                j = scans[i].vouts[vi];
                 len = block.vtx[i].vout[j].scriptPubKey.size();
-                if ( len >= sizeof(uint32_t) && len <= sizeof(scriptbuf) )
-                {
-                    memcpy(scriptbuf,(uint8_t *)&block.vtx[i].vout[j].scriptPubKey[0],len);
-                    notaryid = safecoin_voutupdate(&isratification,notaryid,scriptbuf,len,height,txhash,i,j,&voutmask,&specialtx,&notarizedheight,(uint64_t)block.vtx[i].vout[j].nValue,notarized,signedmask,(uint32_t)chainActive.LastTip()->GetBlockTime());
-                    if ( 0 && i > 0 )
-                    {
-                        for (k=0; k<len; k++)
-                            printf("%02x",scriptbuf[k]);
-                        printf(" <- notaryid.%d ht.%d i.%d j.%d numvouts.%d numvins.%d voutmask.%llx txid.(%s)\n",notaryid,height,i,j,numvouts,numvins,(long long)voutmask,txhash.ToString().c_str());
-                    }
-                }
+                memcpy(scriptbuf,(uint8_t *)&block.vtx[i].vout[j].scriptPubKey[0],len);
+                notaryid = safecoin_voutupdate(&isratification,notaryid,scriptbuf,len,height,txhash,i,j,&voutmask,&specialtx,&notarizedheight,(uint64_t)block.vtx[i].vout[j].nValue,notarized,signedmask,(uint32_t)chainActive.LastTip()->GetBlockTime());
             }
             if ( IS_SAFECOIN_NOTARY != 0 && ASSETCHAINS_SYMBOL[0] == 0 )
                 printf(") ");
@@ -948,6 +1074,8 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
                         safecoin_stateupdate(height,pubkeys,numvalid,0,txhash,0,0,0,0,0,0,0,0,0,0,zero,0);
                         printf("RATIFIED! >>>>>>>>>> new notaries.%d newheight.%d from height.%d\n",numvalid,(((height+SAFECOIN_ELECTION_GAP/2)/SAFECOIN_ELECTION_GAP)+1)*SAFECOIN_ELECTION_GAP,height);
                     } else printf("signedmask.%llx numvalid.%d wt.%d numnotaries.%d\n",(long long)signedmask,numvalid,bitweight(signedmask),numnotaries);
+                    // pubkeys now holds the candidate notaries and later txs in this block are matched against them
+                    safecoin_blockscan(scans,block,blockundo,height,pubkeys,numnotaries,rmd160,i+1);
                 }
             }
         }
@@ -955,6 +1083,14 @@ void safecoin_connectblock(CBlockIndex *pindex,CBlock& block)
             printf("%s ht.%d\n",ASSETCHAINS_SYMBOL[0] == 0 ? "SAFE" : ASSETCHAINS_SYMBOL,height);
         if ( pindex->GetHeight() == hwmheight )
             safecoin_stateupdate(height,0,0,0,zero,0,0,0,0,height,(uint32_t)pindex->nTime,0,0,0,0,zero,0);
+        safecoin_statebatch = 0;
+        safecoin_stateflush();
+        if ( pindex->GetHeight() == hwmheight && (height % SAFECOIN_STATESNAP_INTERVAL) == 0 && safecoin_statefp != 0 && IsInitialBlockDownload() == 0 )
+        {
+            char fname[512];
+            safecoin_statefname(fname,ASSETCHAINS_SYMBOL,(char *)"safecoinstate");
+            safecoin_statesnap_save(sp,safecoin_statefp,fname,height);
+        }
     } else fprintf(stderr,"safecoin_connectblock: unexpected null pindex\n");
     //SAFECOIN_INITDONE = (uint32_t)time(NULL);
     //fprintf(stderr,"%s end connect.%d\n",ASSETCHAINS_SYMBOL,pindex->GetHeight());
@@ -1125,114 +1125,69 @@ std::vector<std::tuple<std::string, uint32_t, std::vector<pair<std::string, uint
 }
 
 
-// replacement for safecoin_safeids() - new one using kvsearch
+// replacement for safecoin_safeids() - new one aggregating the registration records indexed by safecoin_kvupdate
 std::vector<std::tuple<std::string, uint32_t, std::vector<pair<std::string, uint32_t>>>> vt_safecoin_safeids_new(int32_t height, int32_t width)
 {
-  int32_t i, j, nonz, block_height, scan_range;
-  scan_range=height-750000;
-    CBlockIndex *pindex;
-    uint8_t pubkey33[33];
+    std::map<std::pair<int32_t,std::string>,struct safecoin_safeid_reg>::iterator it;
     std::vector<std::tuple<std::string, uint32_t, std::vector<pair<std::string, uint32_t>>>> vt;
-    std::vector<std::string> vs_pubkeys;
-    std::vector<uint32_t> vu_pubkey_blocks_count;
-    std::vector<std::vector<pair<std::string, uint32_t>>> vvp_pubkey_safeids;
-        
-    for (i = nonz = 0; i < scan_range; i++)
+    std::vector<std::pair<std::string, std::string>> vp_records; // (keyname, safeid) registered within the window
+    std::unordered_map<std::string, uint32_t> pubkey_index; // pubkey -> position in vt
+    std::vector<std::unordered_map<std::string, uint32_t>> safeid_index; // per pubkey, safeid -> position in its safeids
+    std::map<int32_t, std::vector<std::string>> notaries_at; // few distinct safeheights, so memoize the notaries lists
+    
+    // only records registered after height-width can match, the index is ordered by registration height
+    portable_mutex_lock(&SAFECOIN_KV_mutex);
+    for (it = SAFECOIN_SAFEIDS.lower_bound(std::make_pair(height - width + 1, std::string())); it != SAFECOIN_SAFEIDS.end(); it++)
     {
-        if (height-i <= 0)
+        if (height <= it->second.expiry)
+            vp_records.push_back(std::make_pair(it->first.second, it->second.safeid));
+    }
+    portable_mutex_unlock(&SAFECOIN_KV_mutex);
+    
+    for (int32_t i = 0; i < vp_records.size(); i++)
+    {
+        // keyname is parent pubkey + 7 digit zero padded safeheight + "1", exactly as the search used to build it
+        const std::string &s_keyname = vp_records[i].first;
+        if (s_keyname.size() != 66 + 7 + 1 || s_keyname[73] != '1')
             continue;
-        block_height = height - scan_range + i + 1;
-        if ((pindex = safecoin_chainactive(block_height)) != 0) // to be sure it's a valid block_height
+        int32_t j, block_height = 0;
+        for (j = 66; j < 73; j++)
         {
-			// loop through all notary pubkeys
-			std::vector<std::string> vs_all_pubkeys = vs_safecoin_notaries(block_height, 0);
-			
-			for (int j = 0; j < vs_all_pubkeys.size(); j++)
-			{
-				std::string s_current_pubkey = vs_all_pubkeys.at(j);
-				std::string s_current_block_height = ((block_height < 1000000)?"0":"") +  std::to_string(block_height);
-				std::string s_search_keyname = s_current_pubkey + s_current_block_height + "1";
-				
-				int32_t flags = 1, keylen;
-				uint8_t value[IGUANA_MAXSCRIPTSIZE*8];
-				uint256 pubs;
-				int32_t valuesize;
-				std::string keystr;
-				keylen = s_search_keyname.length();
-				uint8_t key[keylen];
-				int32_t heightp;
-				memcpy(key, s_search_keyname.c_str(), keylen);
-				
-				valuesize = safecoin_kvsearch((uint256 *)&pubs, height, (uint32_t *)&flags, (int32_t *)&heightp, (uint8_t *)&value, key, keylen);
-
-				if (valuesize > 0 && (height-heightp) < width) // key name found
-				{
-					std::string s_safeid;
-					char *valuestr;
-					s_safeid.resize(valuesize);
-					valuestr = (char *)s_safeid.data();
-					memcpy (valuestr, value, valuesize);
-					
-					// we should store this safeid
-					std::vector<std::string>::iterator it;
-
-					// check if pubkey is already in the result list
-					it = std::find(vs_pubkeys.begin(), vs_pubkeys.end(), s_current_pubkey);
-					if (it != vs_pubkeys.end())
-					{
-						// found !
-						// get the element index
-						uint32_t index = std::distance(vs_pubkeys.begin(), it);
-						
-						// increase the block count
-						vu_pubkey_blocks_count.at(index) = vu_pubkey_blocks_count.at(index) + 1;
-						
-						// get this pubkey safeids
-						std::vector<pair<std::string, uint32_t>> vp_safeids = vvp_pubkey_safeids.at(index);
-						
-						// check if extracted safeid is already in the current pubkey safeids list
-						auto p = find_if(vp_safeids.begin(), vp_safeids.end(), [&s_safeid](const pair<string, uint32_t>& r){return r.first == s_safeid;});
-
-						if (p != vp_safeids.end())
-						{
-							// found safeid entry within current pubkey 
-							
-							// get the element index
-							uint32_t p_index = std::distance(vp_safeids.begin(), p);
-							
-							// // increase the safeid block count 
-							(vvp_pubkey_safeids.at(index)).at(p_index).second = vp_safeids.at(p_index).second + 1;
-						}
-						else
-						{
-							// not found, add safeid and block count of 1 to the current pubkey	
-							(vvp_pubkey_safeids.at(index)).push_back(std::make_pair(s_safeid, 1));
-						}
-					}
-					else
-					{
-						// not found
-						// insert both pubkey and safeid, block counts of 1
-						vs_pubkeys.push_back(s_current_pubkey);
-						vu_pubkey_blocks_count.push_back(1);
-						std::vector<pair<std::string, uint32_t>> vp_init_safeid;
-						vp_init_safeid.push_back(std::make_pair(s_safeid, 1));
-						vvp_pubkey_safeids.push_back(vp_init_safeid);
-					}
-				}	
-			}
+            if (s_keyname[j] < '0' || s_keyname[j] > '9')
+                break;
+            block_height = block_height * 10 + (s_keyname[j] - '0');
+        }
+        if (j != 73 || block_height <= 750000 || block_height > height)
+            continue;
+        std::string s_current_pubkey = s_keyname.substr(0, 66);
+        
+        if (notaries_at.count(block_height) == 0)
+            notaries_at[block_height] = vs_safecoin_notaries(block_height, 0);
+        std::vector<std::string> &vs_all_pubkeys = notaries_at[block_height];
+        if (std::find(vs_all_pubkeys.begin(), vs_all_pubkeys.end(), s_current_pubkey) == vs_all_pubkeys.end())
+            continue;
+        
+        const std::string &s_safeid = vp_records[i].second;
+        std::unordered_map<std::string, uint32_t>::iterator p = pubkey_index.find(s_current_pubkey);
+        if (p == pubkey_index.end())
+        {
+            // insert both pubkey and safeid, block counts of 1
+            p = pubkey_index.insert(std::make_pair(s_current_pubkey, (uint32_t)vt.size())).first;
+            vt.push_back(std::make_tuple(s_current_pubkey, (uint32_t)0, std::vector<pair<std::string, uint32_t>>()));
+            safeid_index.push_back(std::unordered_map<std::string, uint32_t>());
+        }
+        std::get<1>(vt[p->second])++;
+        
+        std::vector<pair<std::string, uint32_t>> &vp_safeids = std::get<2>(vt[p->second]);
+        std::unordered_map<std::string, uint32_t>::iterator q = safeid_index[p->second].find(s_safeid);
+        if (q != safeid_index[p->second].end())
+            vp_safeids[q->second].second++;
+        else
+        {
+            safeid_index[p->second].insert(std::make_pair(s_safeid, (uint32_t)vp_safeids.size()));
+            vp_safeids.push_back(std::make_pair(s_safeid, 1));
         }
     }
-    
-    // join pubkeys and safeids in result tuple
-    for (unsigned k = 0; k < vs_pubkeys.size(); k++)
-    {
-		std::tuple<std::string, uint32_t, std::vector<pair<std::string, uint32_t>>> tup;
-		std::get<0>(tup) = vs_pubkeys.at(k);
-		std::get<1>(tup) = vu_pubkey_blocks_count.at(k);
-		std::get<2>(tup) = vvp_pubkey_safeids.at(k);
-		vt.push_back(tup);
-	}
     return vt;
 }
 
@@ -1384,6 +1339,58 @@ uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint25
     return(0);
 }
 
+// interest of one input whose txheight and locktime are resolved
+uint64_t safecoin_interest_input_accrue(struct safecoin_interest_input &in,uint32_t tiptime)
+{
+    in.interest = 0;
+    //if ( in.locktime != 0 )
+    //    in.interest = safecoin_interest(in.txheight,in.value,in.locktime,tiptime);
+    return(in.interest);
+}
+
+/*
+ Batched safecoin_accrued_interest. Everything is resolved under a single cs_main lock, heights come from the coins view (pcoinsTip when view is null)
+ rather than a GetTransaction per input, and only inputs whose locktime was not preset or whose coins are gone cost a tx read, once per distinct txid.
+ */
+uint64_t safecoin_accrued_interest_batch(std::vector<struct safecoin_interest_input> &inputs,int32_t tipheight,const CCoinsViewCache *view)
+{
+    LOCK(cs_main);
+    std::map<uint256,std::pair<int32_t,uint32_t> > txinfo; std::map<uint256,std::pair<int32_t,uint32_t> >::iterator it;
+    uint64_t sum = 0; uint32_t tiptime = 0; CBlockIndex *pindex; const CCoins *coins; CTransaction tx; uint256 hashBlock; int32_t i;
+    if ( (pindex= chainActive[tipheight]) != 0 )
+        tiptime = (uint32_t)pindex->nTime;
+    else fprintf(stderr,"cant find height[%d]\n",tipheight);
+    if ( view == 0 )
+        view = pcoinsTip;
+    for (i=0; i<inputs.size(); i++)
+    {
+        struct safecoin_interest_input &in = inputs[i];
+        in.interest = 0;
+        if ( in.txheight == 0 && (coins= view->AccessCoins(in.txid)) != 0 && coins->IsAvailable(in.vout) != 0 && coins->nHeight > 0 && coins->nHeight != MEMPOOL_HEIGHT )
+        {
+            in.txheight = coins->nHeight;
+            if ( in.value == 0 )
+                in.value = coins->vout[in.vout].nValue;
+        }
+        if ( in.txheight == 0 || in.locktime == 0 )
+        {
+            if ( (it= txinfo.find(in.txid)) == txinfo.end() )
+            {
+                std::pair<int32_t,uint32_t> info(0,0);
+                if ( GetTransaction(in.txid,tx,hashBlock,true) != 0 && (pindex= safecoin_getblockindex(hashBlock)) != 0 )
+                    info = std::make_pair((int32_t)pindex->GetHeight(),(uint32_t)tx.nLockTime);
+                it = txinfo.insert(std::make_pair(in.txid,info)).first;
+            }
+            if ( in.txheight == 0 )
+                in.txheight = it->second.first;
+            if ( in.locktime == 0 )
+                in.locktime = it->second.second;
+        }
+        sum += safecoin_interest_input_accrue(in,tiptime);
+    }
+    return(sum);
+}
+
 int32_t safecoin_nextheight()
 {
     CBlockIndex *pindex; int32_t ht,longest = safecoin_longestchain();
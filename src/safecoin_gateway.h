@@ -1101,7 +1101,7 @@ const char *safecoin_opreturn(int32_t height,uint64_t value,uint8_t *opretbuf,in
     return(typestr);
 }
 
-int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,long *fposp,long datalen,char *symbol,char *dest);
+int32_t safecoin_parsestatefiledata(struct safecoin_state *sp,uint8_t *filedata,long *fposp,long datalen,char *symbol,char *dest,int32_t externalonly=0);
 
 void safecoin_stateind_set(struct safecoin_state *sp,uint32_t *inds,int32_t n,uint8_t *filedata,long datalen,char *symbol,char *dest)
 {
@@ -1243,11 +1243,66 @@ uint8_t *OS_fileptr(long *allocsizep,char *fname)
     return((uint8_t *)retptr);
 }
 
+#ifndef _WIN32
+static long OS_mapsize(long filesize)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    return(((filesize + pagesize - 1) / pagesize + 1) * pagesize);
+}
+#endif
+
+// Private, copy on write mapping of a file. At least one zeroed page follows the data, like the 64 spare bytes OS_loadfile allocates, so parsers may look slightly past the end.
+uint8_t *OS_mapfile(long *filesizep,char *fname)
+{
+#ifndef _WIN32
+    int fd; struct stat st; uint8_t *ptr; long mapsize;
+    *filesizep = 0;
+    if ( (fd= open(fname,O_RDONLY)) < 0 )
+        return(0);
+    if ( fstat(fd,&st) != 0 || st.st_size == 0 )
+    {
+        close(fd);
+        return(0);
+    }
+    mapsize = OS_mapsize(st.st_size);
+    if ( (ptr= (uint8_t *)mmap(0,mapsize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0)) == MAP_FAILED )
+    {
+        close(fd);
+        return(0);
+    }
+    if ( mmap(ptr,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,0) == MAP_FAILED )
+    {
+        munmap(ptr,mapsize);
+        close(fd);
+        return(0);
+    }
+    close(fd);
+    *filesizep = st.st_size;
+    return(ptr);
+#else
+    long allocsize; uint8_t *ptr;
+    if ( (ptr= OS_fileptr(&allocsize,fname)) != 0 )
+        *filesizep = allocsize;
+    return(ptr);
+#endif
+}
+
+void OS_unmapfile(uint8_t *ptr,long filesize)
+{
+    if ( ptr == 0 )
+        return;
+#ifndef _WIN32
+    munmap(ptr,OS_mapsize(filesize));
+#else
+    free(ptr);
+#endif
+}
+
 long safecoin_stateind_validate(struct safecoin_state *sp,char *indfname,uint8_t *filedata,long datalen,uint32_t *prevpos100p,uint32_t *indcounterp,char *symbol,char *dest)
 {
     FILE *fp; long fsize,lastfpos=0,fpos=0; uint8_t *inds,func; int32_t i,n; uint32_t offset,tmp,prevpos100 = 0;
     *indcounterp = *prevpos100p = 0;
-    if ( (inds= OS_fileptr(&fsize,indfname)) != 0 )
+    if ( (inds= OS_mapfile(&fsize,indfname)) != 0 )
     {
         lastfpos = 0;
         fprintf(stderr,"inds.%p validate %s fsize.%ld datalen.%ld n.%ld lastfpos.%ld\n",inds,indfname,fsize,datalen,fsize / sizeof(uint32_t),lastfpos);
@@ -1279,11 +1334,11 @@ long safecoin_stateind_validate(struct safecoin_state *sp,char *indfname,uint8_t
             if ( sp != 0 )
                 safecoin_stateind_set(sp,(uint32_t *)inds,n,filedata,fpos,symbol,dest);
             //printf("free inds.%p %s validated[%d] fpos.%ld datalen.%ld, offset %ld vs fsize.%ld\n",inds,indfname,i,fpos,datalen,i * sizeof(uint32_t),fsize);
-            free(inds);
+            OS_unmapfile(inds,fsize);
             return(fpos);
         } else printf("wrong filesize %s %ld\n",indfname,fsize);
     }
-    free(inds);
+    OS_unmapfile(inds,fsize);
     fprintf(stderr,"indvalidate return -1\n");
     return(-1);
 }
@@ -1307,13 +1362,174 @@ long safecoin_indfile_update(FILE *indfp,uint32_t *prevpos100p,long lastfpos,lon
     return(newfpos);
 }
 
+/*
+ A state snapshot is sp as it was after replaying the first fpos bytes of the state file: its scalars, NPOINTS and events. On startup only the
+ effects that live outside of sp (notary elections, price feeds, opreturns incl. KV) are replayed for that prefix, and the rest of the file is parsed
+ normally. tailhash ties the snapshot to the state file contents in front of fpos, checksum covers everything after the header.
+ */
+
+#define SAFECOIN_STATESNAP_MAGIC 0x50414e53
+#define SAFECOIN_STATESNAP_VERSION 1
+#define SAFECOIN_STATESNAP_INTERVAL 1000
+#define SAFECOIN_STATESNAP_TAIL 4096
+
+struct safecoin_statesnap_hdr
+{
+    uint32_t magic,version,statesize,pointsize;
+    int64_t fpos;
+    int32_t height,numpoints,numevents,eventsize;
+    uint8_t tailhash[32],checksum[32];
+};
+
+static void safecoin_statesnap_fname(char *snapfname,char *fname,int32_t maxlen)
+{
+    safecopy(snapfname,fname,maxlen-5);
+    strcat(snapfname,".snap");
+}
+
+int32_t safecoin_statesnap_save(struct safecoin_state *sp,FILE *fp,char *fname,int32_t height)
+{
+    struct safecoin_statesnap_hdr H; struct safecoin_state S; char snapfname[1024],tmpfname[1024]; uint8_t *buf,*ptr; long len,taillen; int32_t i; FILE *snapfp;
+    if ( sp == 0 || fp == 0 )
+        return(-1);
+    fflush(fp);
+    memset(&H,0,sizeof(H));
+    H.magic = SAFECOIN_STATESNAP_MAGIC;
+    H.version = SAFECOIN_STATESNAP_VERSION;
+    H.statesize = sizeof(S);
+    H.pointsize = sizeof(*sp->NPOINTS);
+    fseek(fp,0,SEEK_END);
+    if ( (H.fpos= ftell(fp)) <= 0 )
+        return(-1);
+    H.height = height;
+    H.numpoints = sp->NUM_NPOINTS;
+    H.numevents = sp->Safecoin_numevents;
+    for (i=0; i<sp->Safecoin_numevents; i++)
+        H.eventsize += sp->Safecoin_events[i]->len;
+    taillen = (H.fpos < SAFECOIN_STATESNAP_TAIL) ? H.fpos : SAFECOIN_STATESNAP_TAIL;
+    len = sizeof(S) + (long)H.numpoints*H.pointsize + H.eventsize;
+    if ( (buf= (uint8_t *)malloc(len > taillen ? len : taillen)) == 0 )
+        return(-1);
+    fseek(fp,H.fpos - taillen,SEEK_SET);
+    if ( fread(buf,1,taillen,fp) != taillen )
+    {
+        fseek(fp,0,SEEK_END);
+        free(buf);
+        return(-1);
+    }
+    fseek(fp,0,SEEK_END);
+    vcalc_sha256(0,H.tailhash,buf,(int32_t)taillen);
+    S = *sp;
+    S.NPOINTS = 0;
+    S.MoMPOINTS = 0;
+    S.Safecoin_events = 0;
+    ptr = buf;
+    memcpy(ptr,&S,sizeof(S)), ptr += sizeof(S);
+    if ( H.numpoints > 0 )
+        memcpy(ptr,sp->NPOINTS,(long)H.numpoints*H.pointsize), ptr += (long)H.numpoints*H.pointsize;
+    for (i=0; i<sp->Safecoin_numevents; i++)
+        memcpy(ptr,sp->Safecoin_events[i],sp->Safecoin_events[i]->len), ptr += sp->Safecoin_events[i]->len;
+    vcalc_sha256(0,H.checksum,buf,(int32_t)len);
+    safecoin_statesnap_fname(snapfname,fname,sizeof(snapfname));
+    safecopy(tmpfname,snapfname,sizeof(tmpfname)-4);
+    strcat(tmpfname,".tmp");
+    if ( (snapfp= fopen(tmpfname,"wb")) == 0 )
+    {
+        free(buf);
+        return(-1);
+    }
+    if ( fwrite(&H,1,sizeof(H),snapfp) != sizeof(H) || fwrite(buf,1,len,snapfp) != len )
+    {
+        fclose(snapfp);
+        free(buf);
+        remove(tmpfname);
+        return(-1);
+    }
+    fclose(snapfp);
+    free(buf);
+    if ( rename(tmpfname,snapfname) != 0 )
+        return(-1);
+    fprintf(stderr,"saved %s ht.%d fpos.%lld npoints.%d events.%d\n",snapfname,height,(long long)H.fpos,H.numpoints,H.numevents);
+    return(0);
+}
+
+// returns the state file offset the snapshot covers after restoring sp from it, 0 if there is no usable snapshot
+long safecoin_statesnap_load(struct safecoin_state *sp,char *fname,uint8_t *filedata,long datalen)
+{
+    struct safecoin_statesnap_hdr H; struct safecoin_state S; struct safecoin_event *ep; char snapfname[1024]; uint8_t *snapdata,*ptr,hash[32]; long snaplen,len,taillen; int32_t i;
+    if ( sp == 0 || sp->NUM_NPOINTS != 0 || sp->Safecoin_numevents != 0 )
+        return(0);
+    safecoin_statesnap_fname(snapfname,fname,sizeof(snapfname));
+    if ( (snapdata= OS_mapfile(&snaplen,snapfname)) == 0 )
+        return(0);
+    memcpy(&H,snapdata,snaplen < sizeof(H) ? snaplen : sizeof(H));
+    len = sizeof(S) + (long)H.numpoints*H.pointsize + H.eventsize;
+    if ( snaplen < sizeof(H) || H.magic != SAFECOIN_STATESNAP_MAGIC || H.version != SAFECOIN_STATESNAP_VERSION || H.statesize != sizeof(S) || H.pointsize != sizeof(*sp->NPOINTS) || H.numpoints < 0 || H.numevents < 0 || H.fpos <= 0 || H.fpos > datalen || snaplen != sizeof(H) + len )
+    {
+        fprintf(stderr,"ignoring %s, does not match %s\n",snapfname,fname);
+        OS_unmapfile(snapdata,snaplen);
+        return(0);
+    }
+    ptr = &snapdata[sizeof(H)];
+    vcalc_sha256(0,hash,ptr,(int32_t)len);
+    if ( memcmp(hash,H.checksum,sizeof(hash)) != 0 )
+    {
+        fprintf(stderr,"ignoring %s, checksum mismatch\n",snapfname);
+        OS_unmapfile(snapdata,snaplen);
+        return(0);
+    }
+    taillen = (H.fpos < SAFECOIN_STATESNAP_TAIL) ? H.fpos : SAFECOIN_STATESNAP_TAIL;
+    vcalc_sha256(0,hash,&filedata[H.fpos - taillen],(int32_t)taillen);
+    if ( memcmp(hash,H.tailhash,sizeof(hash)) != 0 )
+    {
+        fprintf(stderr,"ignoring %s, %s was rewritten\n",snapfname,fname);
+        OS_unmapfile(snapdata,snaplen);
+        return(0);
+    }
+    memcpy(&S,ptr,sizeof(S)), ptr += sizeof(S);
+    S.NPOINTS = 0;
+    S.NUM_NPOINTS = 0;
+    S.MoMPOINTS = 0;
+    S.NUM_MoMPOINTS = S.MAX_MoMDEPTH = S.prevMoMheight = 0;
+    S.Safecoin_events = 0;
+    S.Safecoin_numevents = 0;
+    *sp = S;
+    if ( H.numpoints > 0 )
+    {
+        sp->NPOINTS = (struct notarized_checkpoint *)malloc((long)H.numpoints * sizeof(*sp->NPOINTS));
+        memcpy(sp->NPOINTS,ptr,(long)H.numpoints * sizeof(*sp->NPOINTS)), ptr += (long)H.numpoints * sizeof(*sp->NPOINTS);
+        for (i=0; i<H.numpoints; i++)
+        {
+            sp->NUM_NPOINTS = i+1;
+            safecoin_MoMpoints_add(sp,i);
+        }
+    }
+    if ( H.numevents > 0 )
+    {
+        sp->Safecoin_events = (struct safecoin_event **)calloc(H.numevents,sizeof(*sp->Safecoin_events));
+        for (i=0; i<H.numevents; i++)
+        {
+            // events are stored back to back, each starting with its own header
+            ep = (struct safecoin_event *)ptr;
+            sp->Safecoin_events[i] = (struct safecoin_event *)calloc(1,ep->len);
+            memcpy(sp->Safecoin_events[i],ep,ep->len);
+            sp->Safecoin_events[i]->related = 0;
+            ptr += ep->len;
+        }
+        sp->Safecoin_numevents = H.numevents;
+    }
+    OS_unmapfile(snapdata,snaplen);
+    fprintf(stderr,"loaded %s ht.%d fpos.%lld of %ld npoints.%d events.%d\n",snapfname,H.height,(long long)H.fpos,datalen,H.numpoints,H.numevents);
+    return((long)H.fpos);
+}
+
 int32_t safecoin_faststateinit(struct safecoin_state *sp,char *fname,char *symbol,char *dest)
 {
-    FILE *indfp; char indfname[1024]; uint8_t *filedata; long validated=-1,datalen,fpos,lastfpos; uint32_t tmp,prevpos100,indcounter,starttime; int32_t func,finished = 0;
+    FILE *indfp; char indfname[1024]; uint8_t *filedata; long validated=-1,datalen,fpos,lastfpos,snapfpos; uint32_t tmp,prevpos100,indcounter,starttime; int32_t func,finished = 0;
     starttime = (uint32_t)time(NULL);
     safecopy(indfname,fname,sizeof(indfname)-4);
     strcat(indfname,".ind");
-    if ( (filedata= OS_fileptr(&datalen,fname)) != 0 )
+    if ( (filedata= OS_mapfile(&datalen,fname)) != 0 )
     {
         if ( 1 )//datalen >= (1LL << 32) || GetArg("-genind",0) != 0 || (validated= safecoin_stateind_validate(0,indfname,filedata,datalen,&prevpos100,&indcounter,symbol,dest)) < 0 )
         {
@@ -1322,6 +1538,11 @@ int32_t safecoin_faststateinit(struct safecoin_state *sp,char *fname,char *symbo
             if ( (indfp= fopen(indfname,"wb")) != 0 )
                 fwrite(&prevpos100,1,sizeof(prevpos100),indfp), indcounter++;
             fprintf(stderr,"processing %s %ldKB, validated.%ld\n",fname,datalen/1024,validated);
+            if ( (snapfpos= safecoin_statesnap_load(sp,fname,filedata,datalen)) > 0 )
+            {
+                while ( fpos < snapfpos && (func= safecoin_parsestatefiledata(sp,filedata,&fpos,snapfpos,symbol,dest,1)) >= 0 )
+                    lastfpos = safecoin_indfile_update(indfp,&prevpos100,lastfpos,fpos,func,&indcounter);
+            }
             while ( (func= safecoin_parsestatefiledata(sp,filedata,&fpos,datalen,symbol,dest)) >= 0 )
             {
                 lastfpos = safecoin_indfile_update(indfp,&prevpos100,lastfpos,fpos,func,&indcounter);
@@ -1365,7 +1586,7 @@ int32_t safecoin_faststateinit(struct safecoin_state *sp,char *fname,char *symbo
                 }
             }
         } else printf("safecoin_faststateinit unexpected case\n");
-        free(filedata);
+        OS_unmapfile(filedata,datalen);
         return(finished == 1);
     }
     return(-1);
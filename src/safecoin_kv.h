@@ -55,6 +55,73 @@ uint64_t safecoin_kvfee(uint32_t flags,int32_t opretlen,int32_t keylen)
     return(fee);
 }
 
+// secondary index over SafeNode registrations in SAFECOIN_KV, protected by SAFECOIN_KV_mutex
+// safekey -> (registration height, kvkey) -> flags for every 66 byte record, the last one is the registration in effect
+// entries leave together with their SAFECOIN_KV record, so an older record takes over when the latest is expired or overwritten
+// (registration height, kvkey) -> safeid for every live registration record, used by the safeids aggregation
+struct safecoin_safeid_reg { std::string safeid; int32_t expiry; };
+std::map<std::string,std::map<std::pair<int32_t,std::string>,uint32_t> > SAFECOIN_SAFENODES;
+std::map<std::pair<int32_t,std::string>,struct safecoin_safeid_reg> SAFECOIN_SAFEIDS;
+
+void safecoin_safenode_unindex(uint8_t *kvkey,uint16_t keylen,uint8_t *value,uint16_t valuesize,int32_t height)
+{
+    std::map<std::string,std::map<std::pair<int32_t,std::string>,uint32_t> >::iterator it;
+    if ( value == 0 || valuesize != 66 )
+        return;
+    SAFECOIN_SAFEIDS.erase(std::make_pair(height,std::string((char *)kvkey,keylen)));
+    if ( (it= SAFECOIN_SAFENODES.find(std::string((char *)value,valuesize))) != SAFECOIN_SAFENODES.end() )
+    {
+        it->second.erase(std::make_pair(height,std::string((char *)kvkey,keylen)));
+        if ( it->second.empty() != 0 )
+            SAFECOIN_SAFENODES.erase(it);
+    }
+}
+
+void safecoin_safenode_index(uint8_t *kvkey,uint16_t keylen,uint8_t *value,uint16_t valuesize,int32_t height,uint32_t flags)
+{
+    std::string safekey;
+    if ( value == 0 || valuesize != 66 )
+        return;
+    safekey = std::string((char *)value,valuesize);
+    SAFECOIN_SAFEIDS[std::make_pair(height,std::string((char *)kvkey,keylen))] = { safekey, height + safecoin_kvduration(flags) };
+    SAFECOIN_SAFENODES[safekey][std::make_pair(height,std::string((char *)kvkey,keylen))] = flags;
+}
+
+// latest registration of safekey, unless it expired before current_height; current_height 0 returns it even once expired
+int32_t safecoin_safenode_lookup(const std::string &safekey,int32_t current_height,int32_t *heightp,int32_t *durationp,uint32_t *flagsp)
+{
+    std::map<std::string,std::map<std::pair<int32_t,std::string>,uint32_t> >::iterator it; int32_t retval = -1;
+    *heightp = *durationp = 0;
+    *flagsp = 0;
+    portable_mutex_lock(&SAFECOIN_KV_mutex);
+    if ( (it= SAFECOIN_SAFENODES.find(safekey)) != SAFECOIN_SAFENODES.end() )
+    {
+        const std::pair<const std::pair<int32_t,std::string>,uint32_t> &reg = *it->second.rbegin();
+        if ( reg.first.first + safecoin_kvduration(reg.second) >= current_height )
+        {
+            *heightp = reg.first.first;
+            *durationp = safecoin_kvduration(reg.second);
+            *flagsp = reg.second;
+            retval = 0;
+        }
+    }
+    portable_mutex_unlock(&SAFECOIN_KV_mutex);
+    return(retval);
+}
+
+int32_t safecoin_safenodes_active(std::vector<std::pair<std::string,int32_t> > &safenodes,int32_t current_height)
+{
+    std::map<std::string,std::map<std::pair<int32_t,std::string>,uint32_t> >::iterator it; int32_t expiry;
+    safenodes.clear();
+    portable_mutex_lock(&SAFECOIN_KV_mutex);
+    safenodes.reserve(SAFECOIN_SAFENODES.size());
+    for (it=SAFECOIN_SAFENODES.begin(); it!=SAFECOIN_SAFENODES.end(); it++)
+        if ( (expiry= it->second.rbegin()->first.first + safecoin_kvduration(it->second.rbegin()->second)) >= current_height )
+            safenodes.push_back(std::make_pair(it->first,expiry));
+    portable_mutex_unlock(&SAFECOIN_KV_mutex);
+    return((int32_t)safenodes.size());
+}
+
 int32_t safecoin_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen)
 {
     struct safecoin_kv *ptr; int32_t duration,retval = -1;
@@ -69,6 +136,7 @@ int32_t safecoin_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flag
         //fprintf(stderr,"duration.%d flags.%d current.%d ht.%d keylen.%d valuesize.%d\n",duration,ptr->flags,current_height,ptr->height,ptr->keylen,ptr->valuesize);
         if ( current_height > (ptr->height + duration) )
         {
+            safecoin_safenode_unindex(ptr->key,ptr->keylen,ptr->value,ptr->valuesize,ptr->height);
             HASH_DELETE(hh,SAFECOIN_KV,ptr);
             if ( ptr->value != 0 )
                 free(ptr->value);
@@ -184,36 +252,20 @@ void safecoin_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
             bool is_valid_beacon_kv = true;
 
             // CHECK FOR DUPLICATES
-            portable_mutex_lock(&SAFECOIN_KV_mutex);
             int32_t current_height = height;
-            struct safecoin_kv *s;
+            int32_t saved_on_height,saved_duration; uint32_t saved_flags;
             
-            for(s = SAFECOIN_KV; s != NULL; s = (safecoin_kv*)s->hh.next)
+            // the safenode index holds the latest registration per safeid, so any earlier one is within the gap only if this one is
+            if (valuesize == 66 && safecoin_safenode_lookup(sid, current_height, &saved_on_height, &saved_duration, &saved_flags) == 0 && (current_height - saved_on_height <= REGISTRATION_GAP))
             {
-                int32_t saved_on_height = s->height;
-                uint8_t *value_ptr = s->value;
-                uint16_t value_size = s->valuesize;
-                
-                // skip checking against records with invalid safeid size or height too much in the past
-                if (value_size == 66 && (current_height - saved_on_height <= REGISTRATION_GAP))
+                // same safeid saved within the search range
+                is_valid_beacon_kv = false;
+                if (LogAcceptCategory("safenodes"))
                 {
-                    std::string str_saved_safeid = std::string((char*)value_ptr, (int)value_size);
-                    // LogPrintf("COMPARATION: SAVED_SID %s VS SID %s\n", str_saved_safeid.c_str(), sid.c_str());
-                    if (sid == str_saved_safeid)
-                    {
-                        // same safeid saved within the search range
-                        is_valid_beacon_kv = false;
-                        if (LogAcceptCategory("safenodes"))
-                        {
-                            LogPrint("safenodes", "SAFENODES: Premature safeid registration renewal rejected at block height %u: safeid %s found at block height %u\n", current_height, sid.c_str(), saved_on_height);
-                        }
-                        break;
-                    }
-                } 
+                    LogPrint("safenodes", "SAFENODES: Premature safeid registration renewal rejected at block height %u: safeid %s found at block height %u\n", current_height, sid.c_str(), saved_on_height);
+                }
             }
             
-            portable_mutex_unlock(&SAFECOIN_KV_mutex);
-            
             if (is_valid_beacon_kv && 0) // we are skipping collateral check for now
             {
 				// COLLATERAL CHECK
@@ -320,6 +372,8 @@ void safecoin_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
 				//LogPrintf("KV add.(%s) (%s)\n",ptr->key,valueptr);
 			}
 				
+			if ( newflag == 0 )
+				safecoin_safenode_unindex(ptr->key,ptr->keylen,ptr->value,ptr->valuesize,ptr->height);
 			if ( newflag != 0 || (ptr->flags & SAFECOIN_KVPROTECTED) == 0 )
 			{
 				if ( ptr->value != 0 )
@@ -343,6 +397,9 @@ void safecoin_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
 			memcpy(&ptr->pubkey,&pubkey,sizeof(ptr->pubkey));
 			ptr->height = height;
 			ptr->flags = flags; // jl777 used to or in KVPROTECTED
+			safecoin_safenode_index(ptr->key,ptr->keylen,ptr->value,ptr->valuesize,ptr->height,ptr->flags);
+			if ( ptr->valuesize == 66 )
+				SafeNodeStatusInvalidate();
             
             portable_mutex_unlock(&SAFECOIN_KV_mutex);
            
@@ -334,19 +334,73 @@ int32_t safecoin_chosennotary(int32_t *notaryidp,int32_t height,uint8_t *pubkey3
 
 //struct safecoin_state *safecoin_stateptr(char *symbol,char *dest);
 
-struct notarized_checkpoint *safecoin_npptr_for_height(int32_t height, int *idx)
+// reference linear scan, kept for benchmark_npptr_lookup
+struct notarized_checkpoint *safecoin_npptr_scan(struct safecoin_state *sp,int32_t height,int *idx)
 {
-    char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; int32_t i; struct safecoin_state *sp; struct notarized_checkpoint *np = 0;
-    if ( (sp= safecoin_stateptr(symbol,dest)) != 0 )
+    int32_t i; struct notarized_checkpoint *np = 0;
+    for (i=sp->NUM_NPOINTS-1; i>=0; i--)
     {
-        for (i=sp->NUM_NPOINTS-1; i>=0; i--)
-        {
-            *idx = i;
-            np = &sp->NPOINTS[i];
-            if ( np->MoMdepth != 0 && height > np->notarized_height-(np->MoMdepth&0xffff) && height <= np->notarized_height )
-                return(np);
-        }
+        *idx = i;
+        np = &sp->NPOINTS[i];
+        if ( np->MoMdepth != 0 && height > np->notarized_height-(np->MoMdepth&0xffff) && height <= np->notarized_height )
+            return(np);
+    }
+    *idx = -1;
+    return(0);
+}
+
+// first MoMPOINTS position whose notarized_height is >= height
+int32_t safecoin_MoMpoints_lowerbound(struct safecoin_state *sp,int32_t height)
+{
+    int32_t lo = 0,hi = sp->NUM_MoMPOINTS,mid;
+    while ( lo < hi )
+    {
+        mid = lo + (hi - lo) / 2;
+        if ( sp->NPOINTS[sp->MoMPOINTS[mid]].notarized_height < height )
+            lo = mid + 1;
+        else hi = mid;
+    }
+    return(lo);
+}
+
+// same result as safecoin_npptr_scan: the latest checkpoint whose MoM covers height
+struct notarized_checkpoint *safecoin_npptr_search(struct safecoin_state *sp,int32_t height,int *idx)
+{
+    int32_t i,best = -1; struct notarized_checkpoint *np;
+    for (i=safecoin_MoMpoints_lowerbound(sp,height); i<sp->NUM_MoMPOINTS; i++)
+    {
+        np = &sp->NPOINTS[sp->MoMPOINTS[i]];
+        if ( np->notarized_height-sp->MAX_MoMDEPTH >= height )
+            break;
+        if ( height > np->notarized_height-(np->MoMdepth&0xffff) && sp->MoMPOINTS[i] > best )
+            best = sp->MoMPOINTS[i];
     }
+    *idx = best;
+    return(best >= 0 ? &sp->NPOINTS[best] : 0);
+}
+
+void safecoin_MoMpoints_add(struct safecoin_state *sp,int32_t i)
+{
+    int32_t pos; struct notarized_checkpoint *np = &sp->NPOINTS[i];
+    if ( np->MoM.IsNull() == 0 )
+        sp->prevMoMheight = np->notarized_height;
+    if ( np->MoMdepth == 0 )
+        return;
+    // ties keep NPOINTS order, so insert after every point notarizing the same height
+    pos = safecoin_MoMpoints_lowerbound(sp,np->notarized_height+1);
+    sp->MoMPOINTS = (int32_t *)realloc(sp->MoMPOINTS,(sp->NUM_MoMPOINTS+1) * sizeof(*sp->MoMPOINTS));
+    memmove(&sp->MoMPOINTS[pos+1],&sp->MoMPOINTS[pos],(sp->NUM_MoMPOINTS - pos) * sizeof(*sp->MoMPOINTS));
+    sp->MoMPOINTS[pos] = i;
+    sp->NUM_MoMPOINTS++;
+    if ( (np->MoMdepth&0xffff) > sp->MAX_MoMDEPTH )
+        sp->MAX_MoMDEPTH = (np->MoMdepth&0xffff);
+}
+
+struct notarized_checkpoint *safecoin_npptr_for_height(int32_t height, int *idx)
+{
+    char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
+    if ( (sp= safecoin_stateptr(symbol,dest)) != 0 )
+        return(safecoin_npptr_search(sp,height,idx));
     *idx = -1;
     return(0);
 }
@@ -368,17 +422,9 @@ struct notarized_checkpoint *safecoin_npptr_at(int idx)
 
 int32_t safecoin_prevMoMheight()
 {
-    static uint256 zero;
-    char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; int32_t i; struct safecoin_state *sp; struct notarized_checkpoint *np = 0;
+    char symbol[SAFECOIN_ASSETCHAIN_MAXLEN],dest[SAFECOIN_ASSETCHAIN_MAXLEN]; struct safecoin_state *sp;
     if ( (sp= safecoin_stateptr(symbol,dest)) != 0 )
-    {
-        for (i=sp->NUM_NPOINTS-1; i>=0; i--)
-        {
-            np = &sp->NPOINTS[i];
-            if ( np->MoM != zero )
-                return(np->notarized_height);
-        }
-    }
+        return(sp->prevMoMheight);
     return(0);
 }
 
@@ -466,6 +512,7 @@ int32_t safecoin_notarizeddata(int32_t nHeight,uint256 *notarized_hashp,uint256
             }
             if ( flag == 0 )
             {
+                // NPOINTS are not rewound on a reorg, so they are not sorted by nHeight and need the scan
                 np = 0;
                 for (i=0; i<sp->NUM_NPOINTS; i++)
                 {
@@ -514,6 +561,7 @@ void safecoin_notarized_update(struct safecoin_state *sp,int32_t nHeight,int32_t
     sp->NOTARIZED_DESTTXID = np->notarized_desttxid = notarized_desttxid;
     sp->MoM = np->MoM = MoM;
     sp->MoMdepth = np->MoMdepth = MoMdepth;
+    safecoin_MoMpoints_add(sp,sp->NUM_NPOINTS-1);
     portable_mutex_unlock(&safecoin_mutex);
 }
 
@@ -123,8 +123,18 @@ struct safecoin_state
     uint32_t SAVEDTIMESTAMP;
     uint64_t deposited,issued,withdrawn,approved,redeemed,shorted;
     struct notarized_checkpoint *NPOINTS; int32_t NUM_NPOINTS,last_NPOINTSi;
+    int32_t *MoMPOINTS,NUM_MoMPOINTS,MAX_MoMDEPTH,prevMoMheight; // NPOINTS indices with MoMdepth, ordered by notarized_height
     struct safecoin_event **Safecoin_events; int32_t Safecoin_numevents;
     uint32_t RTbufs[64][3]; uint64_t RTmask;
 };
 
+// one outpoint for safecoin_accrued_interest_batch, callers holding the funding tx preset locktime (and txheight when confirmed)
+struct safecoin_interest_input
+{
+    uint256 txid;
+    uint64_t value,interest;
+    int32_t vout,txheight;
+    uint32_t locktime;
+};
+
 #endif /* SAFECOIN_STRUCTS_H */
@@ -11,10 +11,15 @@
 #include "pow.h"
 #include "uint256.h"
 #include "core_io.h"
+#include "base58.h"
+#include "crypto/common.h"
 
 #include <stdint.h>
 
 #include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <queue>
 
 using namespace std;
 
@@ -29,6 +34,8 @@ static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCEINDEX = 'e';
+static const char DB_ADDRESSBALANCEBEST = 'E';
 static const char DB_TIMESTAMPINDEX = 'T';	//changed from S
 static const char DB_BLOCKHASHINDEX = 'h';	//changed from z
 static const char DB_SPENTINDEX = 'p';
@@ -328,13 +335,25 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
 }
 
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                                           const CAddressUnspentKey *pafter, size_t limit) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    // resume after the last output of a previous page, which may have been spent since
+    if (pafter != NULL) {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, *pafter));
+        pair<char, CAddressUnspentKey> keyObj;
+        if (pcursor->Valid() && pcursor->GetKey(keyObj) && keyObj.first == DB_ADDRESSUNSPENTINDEX && keyObj.second.hashBytes == pafter->hashBytes &&
+            keyObj.second.txhash == pafter->txhash && keyObj.second.index == pafter->index) {
+            pcursor->Next();
+        }
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (limit == 0 || nRead < limit)) {
         boost::this_thread::interruption_point();
         try {
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -348,6 +367,7 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
                     CAddressUnspentValue nValue;
                     pcursor->GetValue(nValue);
                     unspentOutputs.push_back(make_pair(indexKey, nValue));
+                    nRead++;
                     pcursor->Next();
                 } catch (const std::exception& e) {
                     return error("failed to get address unspent value");
@@ -376,19 +396,117 @@ bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKe
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadAddressBalanceIndex(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    // an address that was never paid has no entry
+    if (!Read(make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(type, addressHash)), value))
+        value.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressBalanceBestBlock(uint256 &hashBlock) {
+    if (!Read(DB_ADDRESSBALANCEBEST, hashBlock))
+        hashBlock.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::UpdateAddressBalanceIndex(const std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> >&vect, const uint256 &hashBlock) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCEINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, it->first), it->second);
+        }
+    }
+    batch.Write(DB_ADDRESSBALANCEBEST, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::RebuildAddressBalanceIndex(const uint256 &hashBlock) {
+    // not a block hash, so a rebuild that is cut short is started again by the next block
+    if (!Write(DB_ADDRESSBALANCEBEST, uint256S("1"), true))
+        return false;
+
+    std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> > vect;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        CDBBatch batch(*this);
+        pcursor->Seek(DB_ADDRESSBALANCEINDEX);
+        while (pcursor->Valid()) {
+            std::pair<char, CAddressIndexIteratorKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_ADDRESSBALANCEINDEX)
+                break;
+            batch.Erase(key);
+            pcursor->Next();
+        }
+        if (!WriteBatch(batch))
+            return false;
+    }
+
+    // the address index is ordered by address, so each total is complete when the address changes
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_ADDRESSINDEX);
+    CAddressIndexIteratorKey address;
+    CAddressBalanceValue value;
+    std::set<uint256> txids;
+    while (true) {
+        std::pair<char, CAddressIndexKey> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX;
+        if (!fValid || key.second.type != address.type || key.second.hashBytes != address.hashBytes) {
+            if (!value.IsNull())
+                vect.push_back(std::make_pair(address, value));
+            if (!fValid || vect.size() >= 10000) {
+                CDBBatch batch(*this);
+                for (std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+                    batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, it->first), it->second);
+                if (!WriteBatch(batch))
+                    return false;
+                vect.clear();
+            }
+            if (!fValid)
+                break;
+            address = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            txids.clear();
+        }
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+        value.balance += nValue;
+        if (nValue > 0)
+            value.received += nValue;
+        if (txids.insert(key.second.txhash).second)
+            value.txcount++;
+        pcursor->Next();
+    }
+    return Write(DB_ADDRESSBALANCEBEST, hashBlock, true);
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+                                    int start, int end,
+                                    const CAddressIndexKey *pafter, size_t limit) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    // a page always resumes at or above the start height it was read from
+    if (pafter != NULL) {
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pafter));
+        pair<char, CAddressIndexKey> keyObj;
+        if (pcursor->Valid() && pcursor->GetKey(keyObj) && keyObj.first == DB_ADDRESSINDEX && keyObj.second.hashBytes == pafter->hashBytes &&
+            keyObj.second.blockHeight == pafter->blockHeight && keyObj.second.txindex == pafter->txindex &&
+            keyObj.second.txhash == pafter->txhash && keyObj.second.index == pafter->index &&
+            keyObj.second.spending == pafter->spending) {
+            pcursor->Next();
+        }
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (limit == 0 || nRead < limit)) {
         boost::this_thread::interruption_point();
         try {
             pair<char, CAddressIndexKey> keyObj;
@@ -405,6 +523,7 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                     pcursor->GetValue(nValue);
 
                     addressIndex.push_back(make_pair(indexKey, nValue));
+                    nRead++;
                     pcursor->Next();
                 } catch (const std::exception& e) {
                     return error("failed to get address index value");
@@ -422,106 +541,132 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
 
 bool getAddressFromIndex(const int &type, const uint160 &hash, std::string &address);
 
-UniValue CBlockTreeDB::Snapshot(int top)
+typedef std::pair<int, uint160> CSnapshotAddress;
+
+struct CSnapshotAddressHasher
+{
+    size_t operator()(const CSnapshotAddress &addr) const { return ReadLE64(addr.second.begin()) ^ addr.first; }
+};
+
+typedef std::pair<CAmount, CSnapshotAddress> CSnapshotEntry;
+
+static const size_t SNAPSHOT_EXPORT_CHUNK = 1000;
+
+UniValue CBlockTreeDB::Snapshot(int top, const std::string &exportfile)
 {
     int64_t total = 0; int64_t totalAddresses = 0; std::string address;
-    int64_t utxos = 0; int64_t ignoredAddresses;
-    boost::scoped_ptr<CDBIterator> iter(NewIterator());
-    std::map <std::string, CAmount> addressAmounts;
-    std::vector <std::pair<CAmount, std::string>> vaddr;
+    int64_t utxos = 0; int64_t ignoredAddresses = 0; int64_t startingHeight;
+    boost::scoped_ptr<CDBIterator> iter;
+    boost::unordered_map<CSnapshotAddress, CAmount, CSnapshotAddressHasher> addressAmounts;
+    std::set<CSnapshotAddress> ignoredSet;
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("start_time", (int) time(NULL)));
 
-    std::map <std::string,int> ignoredMap = {
-	{"RiyjoN1oU2LUcEtSJC16AXuusZxcHriZNq", 1}	//Exploited coins - BURNED
+    const char *ignored[] = {
+        "RiyjoN1oU2LUcEtSJC16AXuusZxcHriZNq"	//Exploited coins - BURNED
     };
+    for (size_t i = 0; i < sizeof(ignored)/sizeof(*ignored); i++) {
+        CSnapshotAddress addr;
+        if (CBitcoinAddress(ignored[i]).GetIndexKey(addr.second, addr.first))
+            ignoredSet.insert(addr);
+    }
 
-    int64_t startingHeight = chainActive.Height();
-    //fprintf(stderr, "Starting snapshot at height %lli\n", startingHeight);
-    for (iter->SeekToLast(); iter->Valid(); iter->Prev())
     {
-        boost::this_thread::interruption_point();
-        try
-        {
-            std::vector<unsigned char> slKey = std::vector<unsigned char>();
-            pair<char, CAddressIndexIteratorKey> keyObj;
-            iter->GetKey(keyObj);
-
-            char chType = keyObj.first;
-            CAddressIndexIteratorKey indexKey = keyObj.second;
-
-            //fprintf(stderr, "chType=%d\n", chType);
-            if (chType == DB_ADDRESSUNSPENTINDEX)
-            {
-                try {
-                    CAmount nValue;
-                    iter->GetValue(nValue);
-
-                    getAddressFromIndex(indexKey.type, indexKey.hashBytes, address);
+        // The address index is written under cs_main while connecting blocks, so pinning a
+        // read snapshot here gives a view that matches startingHeight. The walk itself runs
+        // without cs_main and does not stall block processing.
+        LOCK(cs_main);
+        startingHeight = chainActive.Height();
+        iter.reset(NewSnapshotIterator());
+    }
 
-                    std::map <std::string, int>::iterator ignored = ignoredMap.find(address);
-                    if (ignored != ignoredMap.end()) {
-                    fprintf(stderr,"ignoring %s\n", address.c_str());
-                    ignoredAddresses++;
-                    continue;
-                    }
+    for (iter->Seek(DB_ADDRESSUNSPENTINDEX); iter->Valid(); iter->Next())
+    {
+        boost::this_thread::interruption_point();
+        pair<char, CAddressIndexIteratorKey> keyObj;
+        if (!iter->GetKey(keyObj) || keyObj.first != DB_ADDRESSUNSPENTINDEX)
+            break;
 
-                    std::map <std::string, CAmount>::iterator pos = addressAmounts.find(address);
-                    if (pos == addressAmounts.end()) {
-                    // insert new address + utxo amount
-                    //fprintf(stderr, "inserting new address %s with amount %li\n", address.c_str(), nValue);
-                    addressAmounts[address] = nValue;
-                    totalAddresses++;
-                    } else {
-                    // update unspent tally for this address
-                    //fprintf(stderr, "updating address %s with new utxo amount %li\n", address.c_str(), nValue);
-                    addressAmounts[address] += nValue;
-                    }
-                    //fprintf(stderr,"{\"%s\", %.8f},\n",address.c_str(),(double)nValue/COIN);
-                    // total += nValue;
-                    utxos++;
-                } catch (const std::exception& e) {
-                    fprintf(stderr, "DONE %s: LevelDB addressindex exception! - %s\n", __func__, e.what());
-                    break;
-                }
-	        }
-        } catch (const std::exception& e) {
-	        fprintf(stderr, "DONE reading index entries\n");
+        CAmount nValue;
+        if (!iter->GetValue(nValue)) {
+            fprintf(stderr, "DONE %s: LevelDB addressindex exception!\n", __func__);
             break;
         }
-    }
 
-    UniValue addresses(UniValue::VARR);
-    //fprintf(stderr, "total=%f, totalAddresses=%li, utxos=%li, ignored=%li\n", (double) total / COIN, totalAddresses, utxos, ignoredAddresses);
-
-    for (std::pair<std::string, CAmount> element : addressAmounts) {
-	vaddr.push_back( make_pair(element.second, element.first) );
+        CSnapshotAddress addr(keyObj.second.type, keyObj.second.hashBytes);
+        if (ignoredSet.count(addr) != 0) {
+            ignoredAddresses++;
+            continue;
+        }
+        addressAmounts[addr] += nValue;
+        utxos++;
     }
+    iter.reset();
+    totalAddresses = addressAmounts.size();
+
+    // Keep only the richest entries in a bounded min-heap when a top N was requested,
+    // otherwise every address is ranked.
+    std::vector<CSnapshotEntry> vaddr;
+    if (top > 0) {
+        std::priority_queue<CSnapshotEntry, std::vector<CSnapshotEntry>, std::greater<CSnapshotEntry> > heap;
+        for (const auto &element : addressAmounts) {
+            CSnapshotEntry entry(element.second, element.first);
+            if (heap.size() < (size_t)top)
+                heap.push(entry);
+            else if (heap.top() < entry) {
+                heap.pop();
+                heap.push(entry);
+            }
+        }
+        vaddr.reserve(heap.size());
+        for (; !heap.empty(); heap.pop())
+            vaddr.push_back(heap.top());
+    } else {
+        vaddr.reserve(addressAmounts.size());
+        for (const auto &element : addressAmounts)
+            vaddr.push_back(CSnapshotEntry(element.second, element.first));
+    }
+    addressAmounts.clear();
     std::sort(vaddr.rbegin(), vaddr.rend());
 
-    UniValue obj(UniValue::VOBJ);
     UniValue addressesSorted(UniValue::VARR);
-    int topN = 0;
-    for (std::vector<std::pair<CAmount, std::string>>::iterator it = vaddr.begin(); it!=vaddr.end(); ++it) {
-	UniValue obj(UniValue::VOBJ);
-	obj.push_back( make_pair("addr", it->second.c_str() ) );
-	char amount[32];
-	sprintf(amount, "%.8f", (double) it->first / COIN);
-	obj.push_back( make_pair("amount", amount) );
-	total += it->first;
-	addressesSorted.push_back(obj);
-	topN++;
-	// If requested, only show top N addresses in output JSON
- 	if (top == topN)
-	    break;
+    if (!exportfile.empty()) {
+        // Stream the ranking out in fixed size chunks instead of building one large JSON array
+        FILE *fp = fopen(exportfile.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("Cannot open snapshot export file " + exportfile);
+        std::string chunk;
+        for (size_t i = 0; i < vaddr.size(); i++) {
+            getAddressFromIndex(vaddr[i].second.first, vaddr[i].second.second, address);
+            chunk += strprintf("%s %.8f\n", address, (double) vaddr[i].first / COIN);
+            total += vaddr[i].first;
+            if ((i + 1) % SNAPSHOT_EXPORT_CHUNK == 0 || i + 1 == vaddr.size()) {
+                fwrite(chunk.data(), 1, chunk.size(), fp);
+                chunk.clear();
+            }
+        }
+        fclose(fp);
+        result.push_back(make_pair("filename", exportfile));
+    } else {
+        for (std::vector<CSnapshotEntry>::iterator it = vaddr.begin(); it != vaddr.end(); ++it) {
+            UniValue obj(UniValue::VOBJ);
+            getAddressFromIndex(it->second.first, it->second.second, address);
+            obj.push_back( make_pair("addr", address) );
+            char amount[32];
+            sprintf(amount, "%.8f", (double) it->first / COIN);
+            obj.push_back( make_pair("amount", amount) );
+            total += it->first;
+            addressesSorted.push_back(obj);
+        }
     }
 
-    if (top)
+    if (top && totalAddresses > top)
 	totalAddresses = top;
 
     if (totalAddresses > 0) {
 	// Array of all addreses with balances
-        result.push_back(make_pair("addresses", addressesSorted));
+        if (exportfile.empty())
+            result.push_back(make_pair("addresses", addressesSorted));
 	// Total amount in this snapshot, which is less than circulating supply if top parameter is used
         result.push_back(make_pair("total", (double) total / COIN ));
 	// Average amount in each address of this snapshot
@@ -535,8 +680,8 @@ UniValue CBlockTreeDB::Snapshot(int top)
     result.push_back(make_pair("ignored_addresses", ignoredAddresses));
     // The snapshot began at this block height
     result.push_back(make_pair("start_height", startingHeight));
-    // The snapshot finished at this block height
-    result.push_back(make_pair("ending_height", chainActive.Height()));
+    // The snapshot reflects the index as of start_height; the chain may have moved on since
+    result.push_back(make_pair("ending_height", startingHeight));
     return(result);
 }
 
@@ -62,6 +62,9 @@ CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     // of transactions in the pool
     nCheckFrequency = 0;
 
+    fTrackTemplateChanges = false;
+    fTemplateChangesOverflow = false;
+
     minerPolicyEstimator = new CBlockPolicyEstimator(_minRelayFee);
 }
 
@@ -96,6 +99,37 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+extern uint32_t ASSETCHAINS_CC;
+bool Getscriptaddress(char *destaddr,const CScript &scriptPubKey);
+
+void CTxMemPool::addAddressOutputs(const CTransaction &tx)
+{
+    if (ASSETCHAINS_CC == 0)
+        return;
+    char coinaddr[64];
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        if (Getscriptaddress(coinaddr, tx.vout[i].scriptPubKey))
+            mapAddressOutputs[coinaddr].insert(COutPoint(tx.GetHash(), i));
+    }
+}
+
+void CTxMemPool::removeAddressOutputs(const CTransaction &tx)
+{
+    if (ASSETCHAINS_CC == 0)
+        return;
+    char coinaddr[64];
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        if (!Getscriptaddress(coinaddr, tx.vout[i].scriptPubKey))
+            continue;
+        addressOutputsMap::iterator it = mapAddressOutputs.find(coinaddr);
+        if (it == mapAddressOutputs.end())
+            continue;
+        it->second.erase(COutPoint(tx.GetHash(), i));
+        if (it->second.empty())
+            mapAddressOutputs.erase(it);
+    }
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
     // Add to memory pool without checking anything.
@@ -116,7 +150,9 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+    addAddressOutputs(tx);
     nTransactionsUpdated++;
+    NotifyTemplateChange(hash);
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
@@ -355,11 +391,13 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
+            removeAddressOutputs(tx);
             removed.push_back(tx);
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
             mapTx.erase(hash);
             nTransactionsUpdated++;
+            NotifyTemplateChange(hash);
             minerPolicyEstimator->removeTx(hash);
             removeAddressIndex(hash);
             removeSpentIndex(hash);
@@ -563,9 +601,27 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapAddressOutputs.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    if (fTrackTemplateChanges) {
+        vTemplateChanges.clear();
+        fTemplateChangesOverflow = true;
+    }
+}
+
+void CTxMemPool::NotifyTemplateChange(const uint256& hash)
+{
+    if (!fTrackTemplateChanges || fTemplateChangesOverflow)
+        return;
+    // nobody has asked for a template in a while, let the next one rebuild from scratch
+    if (vTemplateChanges.size() > 2 * mapTx.size() + 10000) {
+        vTemplateChanges.clear();
+        fTemplateChangesOverflow = true;
+        return;
+    }
+    vTemplateChanges.push_back(hash);
 }
 
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const
@@ -724,6 +780,25 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+bool CTxMemPool::getSpender(const COutPoint& outpoint, uint256& spender, uint32_t& nIn) const
+{
+    LOCK(cs);
+    std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.find(outpoint);
+    if (it == mapNextTx.end()) return false;
+    spender = it->second.ptx->GetHash();
+    nIn = it->second.n;
+    return true;
+}
+
+bool CTxMemPool::getAddressOutputs(const std::string& coinaddr, std::vector<COutPoint>& outputs) const
+{
+    LOCK(cs);
+    addressOutputsMap::const_iterator it = mapAddressOutputs.find(coinaddr);
+    if (it == mapAddressOutputs.end()) return false;
+    outputs.insert(outputs.end(), it->second.begin(), it->second.end());
+    return true;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -168,10 +169,24 @@ private:
     typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
     mapSpentIndexInserted mapSpentInserted;
 
+    //! Outputs of the pool's transactions by the address of their script, for the CC contracts.
+    //! Only kept when ASSETCHAINS_CC is set.
+    typedef std::map<std::string, std::set<COutPoint> > addressOutputsMap;
+    addressOutputsMap mapAddressOutputs;
+
+    void addAddressOutputs(const CTransaction &tx);
+    void removeAddressOutputs(const CTransaction &tx);
+
 public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    //! Journal of txids added to or removed from mapTx, consumed by the block template builder in
+    //! miner.cpp. Only kept once fTrackTemplateChanges is set; fTemplateChangesOverflow asks for a rebuild.
+    bool fTrackTemplateChanges;
+    bool fTemplateChangesOverflow;
+    std::vector<uint256> vTemplateChanges;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -202,6 +217,7 @@ public:
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void removeWithoutBranchId(uint32_t nMemPoolBranchId);
     void clear();
+    void NotifyTemplateChange(const uint256& hash);
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
@@ -239,6 +255,12 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /** The pool transaction spending outpoint, and which of its inputs does */
+    bool getSpender(const COutPoint& outpoint, uint256& spender, uint32_t& nIn) const;
+
+    /** The outputs of pool transactions paying to coinaddr, on CC chains only */
+    bool getAddressOutputs(const std::string& coinaddr, std::vector<COutPoint>& outputs) const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -526,6 +526,93 @@ TEST(WalletTests, FindMySaplingNotes) {
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
 
+// A Sapling output to pa with only what trial decryption looks at filled in
+static OutputDescription EncryptedSaplingOutput(const libzcash::SaplingPaymentAddress& pa, CAmount value) {
+    libzcash::SaplingNote note(pa, value);
+    libzcash::SaplingNotePlaintext pt(note, {});
+    auto res = pt.encrypt(pa.pk_d);
+    OutputDescription od;
+    od.cm = note.cm().get();
+    od.ephemeralKey = res->second.get_epk();
+    od.encCiphertext = res->first;
+    return od;
+}
+
+TEST(WalletTests, FindMySaplingNotesBatch) {
+    TestWallet wallet;
+
+    // Two keys in the wallet and one that is not
+    std::vector<libzcash::SaplingExtendedSpendingKey> sks;
+    for (unsigned char i = 0; i < 3; i++) {
+        std::vector<unsigned char, secure_allocator<unsigned char>> rawSeed(32, i);
+        HDSeed seed(rawSeed);
+        sks.push_back(libzcash::SaplingExtendedSpendingKey::Master(seed));
+    }
+    ASSERT_TRUE(wallet.AddSaplingZKey(sks[0], sks[0].DefaultAddress()));
+    ASSERT_TRUE(wallet.AddSaplingZKey(sks[1], sks[1].DefaultAddress()));
+    std::vector<libzcash::SaplingIncomingViewingKey> ivks;
+    for (int i = 1; i >= 0; i--) {
+        ivks.push_back(sks[i].expsk.full_viewing_key().in_viewing_key());
+    }
+
+    // Transactions with outputs to either key, the other one and an output
+    // whose epk is not a point, plus one without Sapling outputs
+    std::vector<CTransaction> vtxStore;
+    for (uint32_t i = 0; i < 6; i++) {
+        CMutableTransaction mtx;
+        mtx.fOverwintered = true;
+        mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+        mtx.nVersion = SAPLING_TX_VERSION;
+        mtx.nLockTime = i;
+        if (i != 3) {
+            mtx.vShieldedOutput.push_back(EncryptedSaplingOutput(sks[i % 3].DefaultAddress(), 1000 + i));
+            mtx.vShieldedOutput.push_back(EncryptedSaplingOutput(sks[2].DefaultAddress(), 2000 + i));
+            OutputDescription bad = EncryptedSaplingOutput(sks[0].DefaultAddress(), 3000 + i);
+            bad.ephemeralKey = uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+            mtx.vShieldedOutput.push_back(bad);
+            mtx.vShieldedOutput.push_back(EncryptedSaplingOutput(sks[(i + 1) % 2].DefaultAddress(), 4000 + i));
+        }
+        vtxStore.push_back(mtx);
+    }
+    std::vector<const CTransaction*> vtx;
+    for (const CTransaction& tx : vtxStore) {
+        vtx.push_back(&tx);
+    }
+
+    for (int nThreads = 1; nThreads <= 4; nThreads++) {
+        auto results = wallet.FindMySaplingNotes(vtx, ivks, nThreads);
+        ASSERT_EQ(vtx.size(), results.size());
+        for (size_t i = 0; i < vtx.size(); i++) {
+            auto single = wallet.FindMySaplingNotes(*vtx[i]);
+            EXPECT_TRUE(single.first == results[i].first);
+            EXPECT_TRUE(single.second == results[i].second);
+            EXPECT_TRUE(wallet.FindMySaplingNotes(*vtx[i], ivks) == results[i]);
+
+            // the outputs to our keys and nothing else, each with the key that decrypts it
+            size_t nExpected = 0;
+            for (uint32_t j = 0; j < vtx[i]->vShieldedOutput.size(); j++) {
+                SaplingOutPoint op {vtx[i]->GetHash(), j};
+                auto it = results[i].first.find(op);
+                bool fOurs = (j == 0 && i % 3 != 2) || j == 3;
+                ASSERT_EQ(fOurs, it != results[i].first.end());
+                if (fOurs) {
+                    nExpected++;
+                    int k = j == 0 ? i % 3 : (i + 1) % 2;
+                    EXPECT_EQ(sks[k].expsk.full_viewing_key().in_viewing_key(), it->second.ivk);
+                }
+            }
+            EXPECT_EQ(nExpected, results[i].first.size());
+        }
+    }
+
+    // No keys, no notes
+    auto none = wallet.FindMySaplingNotes(vtx, std::vector<libzcash::SaplingIncomingViewingKey>(), 2);
+    ASSERT_EQ(vtx.size(), none.size());
+    for (auto& result : none) {
+        EXPECT_TRUE(result.first.empty());
+    }
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     CWallet wallet;
 
@@ -31,6 +31,12 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys);
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys);
 
 
+void static EnsureWalletIsNotRescanning()
+{
+    if (pwalletMain->fRescanInProgress)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: Wallet is currently rescanning, try again once it has finished.");
+}
+
 std::string static EncodeDumpTime(int64_t nTime) {
     return DateTimeStrFormat("%Y-%m-%dT%H:%M:%SZ", nTime);
 }
@@ -99,10 +105,6 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
     string strSecret = params[0].get_str();
     string strLabel = "";
     if (params.size() > 1)
@@ -119,7 +121,13 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
+    CBlockIndex *pindexRescan;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+        EnsureWalletIsNotRescanning();
+
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
@@ -135,10 +143,12 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        pindexRescan = chainActive.Genesis();
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+    // outside the locks, so the node keeps going while the rescan is far from the tip
+    if (fRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
     }
 
     return EncodeDestination(vchAddress);
@@ -169,6 +179,8 @@ UniValue importaddress(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
+    EnsureWalletIsNotRescanning();
+
     CScript script;
 
     CTxDestination dest = DecodeDestination(params[0].get_str());
@@ -268,6 +280,7 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
+    EnsureWalletIsNotRescanning();
 
     ifstream file;
     file.open(params[0].get_str().c_str(), std::ios::in | std::ios::ate);
@@ -602,6 +615,7 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
+    EnsureWalletIsNotRescanning();
 
     // Whether to perform rescan after import
     bool fRescan = true;
@@ -693,6 +707,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
+    EnsureWalletIsNotRescanning();
 
     // Whether to perform rescan after import
     bool fRescan = true;
@@ -33,6 +33,7 @@
 #include "consensus/upgrades.h"
 
 #include "sodium.h"
+#include "safecoin_structs.h"
 
 #include <stdint.h>
 
@@ -41,6 +42,7 @@
 #include <univalue.h>
 
 #include <numeric>
+#include <thread>
 
 
 using namespace std;
@@ -95,6 +97,33 @@ void EnsureWalletIsUnlocked()
 }
 
 uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint256 hash,int32_t n,int32_t checkheight,uint64_t checkvalue,int32_t tipheight);
+uint64_t safecoin_accrued_interest_batch(std::vector<struct safecoin_interest_input> &inputs,int32_t tipheight,const CCoinsViewCache *view);
+uint64_t safecoin_interest_input_accrue(struct safecoin_interest_input &in,uint32_t tiptime);
+
+/**
+ * Queue every locktimed output of vecOutputs for a single safecoin_accrued_interest_batch call,
+ * batchind maps each output to its slot in inputs or -1.
+ */
+static void AccruedInterestBatch(const vector<COutput> &vecOutputs,std::vector<struct safecoin_interest_input> &inputs,std::vector<int32_t> &batchind,bool fSpendableOnly)
+{
+    CBlockIndex *tipindex;
+    batchind.assign(vecOutputs.size(),-1);
+    if ( mapBlockIndex.count(pcoinsTip->GetBestBlock()) == 0 || (tipindex= chainActive.LastTip()) == 0 )
+        return;
+    for (size_t k=0; k<vecOutputs.size(); k++)
+    {
+        const COutput &out = vecOutputs[k];
+        if ( out.tx->nLockTime == 0 || (fSpendableOnly && !out.fSpendable) )
+            continue;
+        struct safecoin_interest_input in;
+        in.txid = out.tx->GetHash(), in.vout = out.i, in.value = out.tx->vout[out.i].nValue;
+        in.interest = 0, in.txheight = 0, in.locktime = out.tx->nLockTime;
+        batchind[k] = (int32_t)inputs.size();
+        inputs.push_back(in);
+    }
+    if ( inputs.size() > 0 )
+        safecoin_accrued_interest_batch(inputs,(int32_t)tipindex->GetHeight(),0);
+}
 
 void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
 {
@@ -2722,8 +2751,12 @@ UniValue listunspent(const UniValue& params, bool fHelp)
     vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
     LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, true, destinations.size() ? &destinations : NULL);
+    std::vector<struct safecoin_interest_input> interests; std::vector<int32_t> batchind;
+    AccruedInterestBatch(vecOutputs,interests,batchind,false);
+    size_t k = 0;
     for (const COutput& out : vecOutputs) {
+        int32_t ind = batchind[k++];
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
 
@@ -2757,16 +2790,12 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         entry.push_back(Pair("amount", ValueFromAmount(nValue)));
         if ( out.tx->nLockTime != 0 )
         {
-            BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-            CBlockIndex *tipindex,*pindex = it->second;
-            uint64_t interest; uint32_t locktime;
-            if ( pindex != 0 && (tipindex= chainActive.LastTip()) != 0 )
+            if ( ind >= 0 )
             {
-                interest = safecoin_accrued_interest(&txheight,&locktime,out.tx->GetHash(),out.i,0,nValue,(int32_t)tipindex->GetHeight());
+                txheight = interests[ind].txheight;
                 //interest = safecoin_interest(txheight,nValue,out.tx->nLockTime,tipindex->nTime);
-                entry.push_back(Pair("interest",ValueFromAmount(interest)));
+                entry.push_back(Pair("interest",ValueFromAmount(interests[ind].interest)));
             }
-            //fprintf(stderr,"nValue %.8f pindex.%p tipindex.%p locktime.%u txheight.%d pindexht.%d\n",(double)nValue/COIN,pindex,chainActive.LastTip(),locktime,txheight,pindex->GetHeight());
         }
         else if ( chainActive.LastTip() != 0 )
             txheight = (chainActive.LastTip()->GetHeight() - out.nDepth - 1);
@@ -2784,25 +2813,21 @@ uint64_t safecoin_interestsum()
 #ifdef ENABLE_WALLET
     if ( ASSETCHAINS_SYMBOL[0] == 0 && GetBoolArg("-disablewallet", false) == 0 )
     {
-        uint64_t interest,sum = 0; int32_t txheight; uint32_t locktime;
-        vector<COutput> vecOutputs;
+        uint64_t sum = 0; uint32_t tiptime = 0; CBlockIndex *tipindex;
+        std::vector<CWalletUTXO> inputs;
         assert(pwalletMain != NULL);
         LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-        for (const COutput& out : vecOutputs)
+        // the wallet keeps value, locktime and block of its locktimed outputs, so this is one pass without tx lookups
+        pwalletMain->AvailableInterestInputs(inputs);
+        if ( (tipindex= chainActive.LastTip()) != 0 )
+            tiptime = (uint32_t)tipindex->nTime;
+        for (size_t i=0; i<inputs.size(); i++)
         {
-            CAmount nValue = out.tx->vout[out.i].nValue;
-            if ( out.tx->nLockTime != 0 && out.fSpendable != 0 )
-            {
-                BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-                CBlockIndex *tipindex,*pindex = it->second;
-                if ( pindex != 0 && (tipindex= chainActive.LastTip()) != 0 )
-                {
-                    interest = safecoin_accrued_interest(&txheight,&locktime,out.tx->GetHash(),out.i,0,nValue,(int32_t)tipindex->GetHeight());
-                    //interest = safecoin_interest(pindex->GetHeight(),nValue,out.tx->nLockTime,tipindex->nTime);
-                    sum += interest;
-                }
-            }
+            struct safecoin_interest_input in;
+            in.txid = inputs[i].outpoint.hash, in.vout = inputs[i].outpoint.n, in.value = inputs[i].nValue;
+            in.locktime = inputs[i].nLockTime, in.interest = 0;
+            in.txheight = (inputs[i].pindex != 0 && chainActive.Contains(inputs[i].pindex)) ? inputs[i].pindex->GetHeight() : 0;
+            sum += safecoin_interest_input_accrue(in,tiptime);
         }
         SAFECOIN_INTERESTSUM = sum;
         SAFECOIN_WALLETBALANCE = pwalletMain->GetBalance();
@@ -3159,14 +3184,23 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
             auto amount = AmountFromValue(params[2]);
-            sample_times.push_back(benchmark_sendtoaddress(amount));
+            // with a UTXO count, from a synthetic wallet of that size instead of this one
+            int nUtxos = 0;
+            if (params.size() >= 4) {
+                nUtxos = params[3].get_int();
+            }
+            sample_times.push_back(benchmark_sendtoaddress(amount, nUtxos));
         } else if (benchmarktype == "loadwallet") {
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
             sample_times.push_back(benchmark_loadwallet());
         } else if (benchmarktype == "listunspent") {
-            sample_times.push_back(benchmark_listunspent());
+            int nUtxos = 0;
+            if (params.size() >= 3) {
+                nUtxos = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_listunspent(nUtxos));
         } else if (benchmarktype == "createsaplingspend") {
             sample_times.push_back(benchmark_create_sapling_spend());
         } else if (benchmarktype == "createsaplingoutput") {
@@ -3175,6 +3209,60 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_verify_sapling_spend());
         } else if (benchmarktype == "verifysaplingoutput") {
             sample_times.push_back(benchmark_verify_sapling_output());
+        } else if (benchmarktype == "npptrscan" || benchmarktype == "npptrsearch") {
+            // Number of notarized checkpoints to look up 10000 heights in
+            int nPoints = 10000;
+            if (params.size() >= 3) {
+                nPoints = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_npptr_lookup(nPoints, benchmarktype == "npptrsearch"));
+        } else if (benchmarktype == "blockscanlookup" || benchmarktype == "blockscanundo") {
+            // Number of blocks back from the tip to scan
+            int nBlocks = 1000;
+            if (params.size() >= 3) {
+                nBlocks = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_safecoin_blockscan(nBlocks, benchmarktype == "blockscanundo"));
+        } else if (benchmarktype == "tlsstalledhandshakes") {
+            // Number of silent inbound connections left mid-handshake while a real peer connects
+            int nStalled = 100;
+            if (params.size() >= 3) {
+                nStalled = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_tls_stalled_handshakes(nStalled));
+        } else if (benchmarktype == "selectpeers" || benchmarktype == "epollpeers") {
+            // Number of idle peers the socket loop polls (thread cpu time for 10000 messages)
+            int nPeers = 100;
+            if (params.size() >= 3) {
+                nPeers = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_socket_poll(nPeers, benchmarktype == "epollpeers"));
+        } else if (benchmarktype == "blocktemplatecold" || benchmarktype == "blocktemplate") {
+            // Template latency against the current mempool, from scratch or after a previous template
+            sample_times.push_back(benchmark_block_template(benchmarktype == "blocktemplatecold"));
+        } else if (benchmarktype == "saplingtrialdecrypt") {
+            // A block's worth of outputs against the given number of keys, on -par threads
+            int nOutputs = 1000;
+            int nKeys = 10;
+            if (params.size() >= 3) {
+                nOutputs = params[2].get_int();
+            }
+            if (params.size() >= 4) {
+                nKeys = params[3].get_int();
+            }
+            sample_times.push_back(benchmark_sapling_trial_decryption(nOutputs, nKeys, std::max(1, nScriptCheckThreads)));
+        } else if (benchmarktype == "cceval") {
+            // CC input validation over a block range; run with 1 thread and with more to see the scaling
+            int nStartHeight = params[2].get_int();
+            int nBlocks = 100;
+            int nThreads = std::max(1, nScriptCheckThreads);
+            if (params.size() >= 4) {
+                nBlocks = params[3].get_int();
+            }
+            if (params.size() >= 5) {
+                nThreads = params[4].get_int();
+            }
+            sample_times.push_back(benchmark_cc_eval(nStartHeight, nBlocks, nThreads));
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
@@ -3628,7 +3716,7 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, true, destinations.size() ? &destinations : NULL);
 
     for (const COutput& out : vecOutputs) {
         if (out.nDepth < minDepth) {
@@ -4418,7 +4506,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 
     // Get available utxos
     vector<COutput> vecOutputs;
-    pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, true);
+    pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, true, destinations.size() ? &destinations : NULL);
 
     // Find unspent coinbase utxos and update estimated size
     for (const COutput& out : vecOutputs) {
@@ -4745,7 +4833,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     if (useAnyUTXO || taddrs.size() > 0) {
         // Get available utxos
         vector<COutput> vecOutputs;
-        pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, false);
+        pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, false, taddrs.size() ? &taddrs : NULL);
         
         // Find unspent utxos and update estimated size
         for (const COutput& out : vecOutputs) {
@@ -5080,20 +5168,16 @@ struct safecoin_staking
     CScript scriptPubKey;
 };
 
-struct safecoin_staking *safecoin_addutxo(struct safecoin_staking *array,int32_t *numkp,int32_t *maxkp,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk)
+// staking candidates kept across safecoin_staked calls, refreshed from pwalletMain->vStakingChanges
+static std::map<COutPoint,struct safecoin_staking> mapStakingCandidates;
+static std::set<uint256> setStakingImmature; // coinbase txids to look at again once they mature
+
+void safecoin_addutxo(struct safecoin_staking *kp,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk)
 {
-    uint256 hash; uint32_t segid32; struct safecoin_staking *kp;
+    uint256 hash; uint32_t segid32;
     segid32 = safecoin_stakehash(&hash,address,hashbuf,txid,vout);
-    if ( *numkp >= *maxkp )
-    {
-        *maxkp += 1000;
-        array = (struct safecoin_staking *)realloc(array,sizeof(*array) * (*maxkp));
-        //fprintf(stderr,"realloc max.%d array.%p\n",*maxkp,array);
-    }
-    kp = &array[(*numkp)++];
-    //fprintf(stderr,"kp.%p num.%d\n",kp,*numkp);
-    memset(kp,0,sizeof(*kp));
-    strcpy(kp->address,address);
+    strncpy(kp->address,address,sizeof(kp->address)-1);
+    kp->address[sizeof(kp->address)-1] = 0;
     kp->txid = txid;
     kp->vout = vout;
     kp->hashval = UintToArith256(hash);
@@ -5101,7 +5185,67 @@ struct safecoin_staking *safecoin_addutxo(struct safecoin_staking *array,int32_t
     kp->segid32 = segid32;
     kp->nValue = nValue;
     kp->scriptPubKey = pk;
-    return(array);
+}
+
+/* Recompute the staking candidates contributed by one wallet tx and drop the ones it spends. The block time comes from
+ the wallet tx's hashBlock, so no GetTransaction is needed. Caller holds cs_main and cs_wallet. */
+void safecoin_stakingrefresh(const uint256 &txid,uint8_t *hashbuf)
+{
+    std::map<uint256,CWalletTx>::const_iterator it; std::map<COutPoint,struct safecoin_staking>::iterator kit; CBlockIndex *pindex; CTxDestination address; int32_t i,nDepth;
+    for (kit=mapStakingCandidates.lower_bound(COutPoint(txid,0)); kit!=mapStakingCandidates.end() && kit->first.hash == txid; )
+        mapStakingCandidates.erase(kit++);
+    setStakingImmature.erase(txid);
+    if ( (it= pwalletMain->mapWallet.find(txid)) == pwalletMain->mapWallet.end() )
+        return;
+    const CWalletTx &wtx = it->second;
+    if ( (nDepth= wtx.GetDepthInMainChain()) < 0 )
+        return;
+    for (const CTxIn &txin : wtx.vin)
+        mapStakingCandidates.erase(txin.prevout);
+    if ( nDepth < 1 || CheckFinalTx(wtx) == 0 )
+        return;
+    if ( wtx.IsCoinBase() != 0 && wtx.GetBlocksToMaturity() > 0 )
+    {
+        setStakingImmature.insert(txid);
+        return;
+    }
+    if ( (pindex= safecoin_getblockindex(wtx.hashBlock)) == 0 )
+        return;
+    for (i=0; i<wtx.vout.size(); i++)
+    {
+        const CTxOut &txout = wtx.vout[i];
+        if ( txout.nValue < COIN || (pwalletMain->IsMine(txout) & ISMINE_SPENDABLE) == ISMINE_NO )
+            continue;
+        if ( pwalletMain->IsSpent(txid,i) != 0 || pwalletMain->IsLockedCoin(txid,i) != 0 )
+            continue;
+        if ( ExtractDestination(txout.scriptPubKey,address) == 0 || IsMine(*pwalletMain,address) == 0 )
+            continue;
+        safecoin_addutxo(&mapStakingCandidates[COutPoint(txid,i)],(uint32_t)pindex->nTime,(uint64_t)txout.nValue,txid,i,(char *)CBitcoinAddress(address).ToString().c_str(),hashbuf,txout.scriptPubKey);
+    }
+}
+
+// bring the staking candidates up to date with the wallet; only a reorg, an erased tx or a stale journal rescans mapWallet
+void safecoin_stakingsync(uint8_t *hashbuf)
+{
+    std::vector<uint256> vchanges;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pwalletMain->cs_wallet);
+    if ( pwalletMain->fTrackStakingChanges == 0 || pwalletMain->fStakingChangesOverflow != 0 )
+    {
+        mapStakingCandidates.clear();
+        setStakingImmature.clear();
+        pwalletMain->vStakingChanges.clear();
+        pwalletMain->fTrackStakingChanges = true;
+        pwalletMain->fStakingChangesOverflow = false;
+        for (const auto &item : pwalletMain->mapWallet)
+            safecoin_stakingrefresh(item.first,hashbuf);
+        LogPrint("pow","rebuilt %d staking candidates from %d wallet txs\n",(int32_t)mapStakingCandidates.size(),(int32_t)pwalletMain->mapWallet.size());
+        return;
+    }
+    vchanges.swap(pwalletMain->vStakingChanges);
+    vchanges.insert(vchanges.end(),setStakingImmature.begin(),setStakingImmature.end());
+    for (const uint256 &txid : vchanges)
+        safecoin_stakingrefresh(txid,hashbuf);
 }
 
 arith_uint256 _safecoin_eligible(struct safecoin_staking *kp,arith_uint256 ratio,uint32_t blocktime,int32_t iter,int32_t minage,int32_t segid,int32_t nHeight,uint32_t prevtime)
@@ -5152,10 +5296,18 @@ uint32_t safecoin_eligible(arith_uint256 bnTarget,arith_uint256 ratio,struct saf
     return(0);
 }
 
+// eligibility search over kps [start,end); every kp is a private copy so safecoin_eligible can update its hashval
+void safecoin_eligible_range(std::vector<struct safecoin_staking> *kps,std::vector<uint32_t> *eligibles,arith_uint256 bnTarget,arith_uint256 ratio,int32_t nHeight,uint32_t blocktime,uint32_t prevtime,int32_t minage,const uint8_t *segidbuf,int32_t start,int32_t end)
+{
+    uint8_t hashbuf[256]; int32_t i;
+    memcpy(hashbuf,segidbuf,sizeof(hashbuf));
+    for (i=start; i<end; i++)
+        (*eligibles)[i] = safecoin_eligible(bnTarget,ratio,&(*kps)[i],nHeight,blocktime,prevtime,minage,hashbuf);
+}
+
 int32_t safecoin_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blocktimep,uint32_t *txtimep,uint256 *utxotxidp,int32_t *utxovoutp,uint64_t *utxovaluep,uint8_t *utxosig)
 {
-    static struct safecoin_staking *array; static int32_t numkp,maxkp; static uint32_t lasttime;
-    set<CBitcoinAddress> setAddress; struct safecoin_staking *kp; int32_t winners,segid,minage,nHeight,counter=0,i,m,siglen=0,nMinDepth = 1,nMaxDepth = 99999999; vector<COutput> vecOutputs; uint32_t block_from_future_rejecttime,besttime,eligible,eligible2,earliest = 0; CScript best_scriptPubKey; arith_uint256 mindiff,ratio,bnTarget; CBlockIndex *tipindex,*pindex; CTxDestination address; bool fNegative,fOverflow; uint8_t hashbuf[256]; CTransaction tx; uint256 hashBlock;
+    std::vector<struct safecoin_staking> kps; std::vector<uint32_t> eligibles; struct safecoin_staking *kp; int32_t winners,minage,nHeight,numkp,nthreads,chunk,counter=0,i,m,siglen=0; uint32_t block_from_future_rejecttime,besttime,prevtime,eligible,earliest = 0; CScript best_scriptPubKey; arith_uint256 mindiff,ratio,bnTarget; CBlockIndex *tipindex; bool fNegative,fOverflow; uint8_t hashbuf[256]; int64_t nStart,nElapsed;
     if (!EnsureWalletIsAvailable(0))
         return 0;
 
@@ -5163,73 +5315,55 @@ int32_t safecoin_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *bloc
     mindiff.SetCompact(SAFECOIN_MINDIFF_NBITS,&fNegative,&fOverflow);
     ratio = (mindiff / bnTarget);
     assert(pwalletMain != NULL);
-    LOCK2(cs_main, pwalletMain->cs_wallet);
     *utxovaluep = 0;
     memset(utxotxidp,0,sizeof(*utxotxidp));
     memset(utxovoutp,0,sizeof(*utxovoutp));
     memset(utxosig,0,72);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-    if ( (tipindex= chainActive.Tip()) == 0 )
-        return(0);
-    nHeight = tipindex->GetHeight() + 1;
-    if ( (minage= nHeight*3) > 6000 ) // about 100 blocks
-        minage = 6000;
-    safecoin_segids(hashbuf,nHeight-101,100);
-    if ( *blocktimep < tipindex->nTime+60 )
-        *blocktimep = tipindex->nTime+60;
-    //fprintf(stderr,"Start scan of utxo for staking %u ht.%d\n",(uint32_t)time(NULL),nHeight);
-    if ( time(NULL) > lasttime+600 || array == 0 )
+    memset(hashbuf,0,sizeof(hashbuf));
     {
-        if ( array != 0 )
-        {
-            free(array);
-            array = 0;
-            maxkp = numkp = 0;
-            lasttime = 0;
-        }
-        for (const COutput& out : vecOutputs)
-        {
-            if ( (tipindex= chainActive.Tip()) == 0 || tipindex->GetHeight()+1 > nHeight )
-            {
-                fprintf(stderr,"chain tip changed during staking loop t.%u counter.%d\n",(uint32_t)time(NULL),counter);
-                return(0);
-            }
-            counter++;
-            if ( out.nDepth < nMinDepth || out.nDepth > nMaxDepth )
-            {
-                fprintf(stderr,"safecoin_staked invalid depth %d\n",(int32_t)out.nDepth);
-                continue;
-            }
-            CAmount nValue = out.tx->vout[out.i].nValue;
-            if ( nValue < COIN  || !out.fSpendable )
-                continue;
-            const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-            if ( ExtractDestination(pk,address) != 0 )
-            {
-                if ( IsMine(*pwalletMain,address) == 0 )
-                    continue;
-                if ( GetTransaction(out.tx->GetHash(),tx,hashBlock,true) != 0 && (pindex= safecoin_getblockindex(hashBlock)) != 0 )
-                {
-                    array = safecoin_addutxo(array,&numkp,&maxkp,(uint32_t)pindex->nTime,(uint64_t)nValue,out.tx->GetHash(),out.i,(char *)CBitcoinAddress(address).ToString().c_str(),hashbuf,(CScript)pk);
-                    //fprintf(stderr,"addutxo numkp.%d vs max.%d\n",numkp,maxkp);
-                }
-            }
-        }
-        lasttime = (uint32_t)time(NULL);
-//fprintf(stderr,"finished kp data of utxo for staking %u ht.%d numkp.%d maxkp.%d\n",(uint32_t)time(NULL),nHeight,numkp,maxkp);
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        if ( (tipindex= chainActive.Tip()) == 0 )
+            return(0);
+        nHeight = tipindex->GetHeight() + 1;
+        if ( (minage= nHeight*3) > 6000 ) // about 100 blocks
+            minage = 6000;
+        safecoin_segids(hashbuf,nHeight-101,100);
+        if ( *blocktimep < tipindex->nTime+60 )
+            *blocktimep = tipindex->nTime+60;
+        safecoin_stakingsync(hashbuf);
+        kps.reserve(mapStakingCandidates.size());
+        for (const auto &item : mapStakingCandidates)
+            kps.push_back(item.second);
+    }
+    // the search itself runs without cs_main/cs_wallet so RPC is not blocked while a large wallet is scanned
+    counter = numkp = (int32_t)kps.size();
+    eligibles.resize(numkp);
+    prevtime = (uint32_t)tipindex->nTime+27;
+    nthreads = std::max(1,std::min(nScriptCheckThreads,numkp / 1000));
+    nStart = GetTimeMicros();
+    if ( nthreads > 1 )
+    {
+        std::vector<std::thread> threads;
+        chunk = (numkp + nthreads - 1) / nthreads;
+        for (i=0; i<numkp; i+=chunk)
+            threads.emplace_back(safecoin_eligible_range,&kps,&eligibles,bnTarget,ratio,nHeight,*blocktimep,prevtime,minage,hashbuf,i,std::min(i+chunk,numkp));
+        for (auto &thread : threads)
+            thread.join();
+    } else safecoin_eligible_range(&kps,&eligibles,bnTarget,ratio,nHeight,*blocktimep,prevtime,minage,hashbuf,0,numkp);
+    nElapsed = GetTimeMicros() - nStart;
+    LogPrint("pow","ht.%d staking scan of %d candidates in %.3fms (%.0f candidates/s) threads.%d\n",nHeight,numkp,0.001 * nElapsed,nElapsed > 0 ? 1000000.0 * numkp / nElapsed : 0.,nthreads);
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    if ( chainActive.Tip() != tipindex )
+    {
+        fprintf(stderr,"chain tip changed during staking loop t.%u counter.%d\n",(uint32_t)time(NULL),counter);
+        return(0);
     }
-//fprintf(stderr,"numkp.%d blocktime.%u\n",numkp,*blocktimep);
     block_from_future_rejecttime = (uint32_t)GetAdjustedTime() + 57;
     for (i=winners=0; i<numkp; i++)
     {
-        if ( (tipindex= chainActive.Tip()) == 0 || tipindex->GetHeight()+1 > nHeight )
-        {
-            fprintf(stderr,"chain tip changed during staking loop t.%u counter.%d\n",(uint32_t)time(NULL),counter);
-            return(0);
-        }
-        kp = &array[i];
-        if ( (eligible2= safecoin_eligible(bnTarget,ratio,kp,nHeight,*blocktimep,(uint32_t)tipindex->nTime+27,minage,hashbuf)) == 0 )
+        if ( eligibles[i] == 0 )
             continue;
+        kp = &kps[i];
         eligible = safecoin_stake(0,bnTarget,nHeight,kp->txid,kp->vout,0,(uint32_t)tipindex->nTime+27,kp->address);
 //fprintf(stderr,"i.%d %u vs %u\n",i,eligible2,eligible);
         if ( eligible > 0 )
@@ -5268,13 +5402,6 @@ int32_t safecoin_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *bloc
             }
         } //else fprintf(stderr,"utxo not eligible\n");
     }
-    if ( numkp < 10000 && array != 0 )
-    {
-        free(array);
-        array = 0;
-        maxkp = numkp = 0;
-        lasttime = 0;
-    }
     if ( earliest != 0 )
     {
         bool signSuccess; SignatureData sigdata; uint64_t txfee; uint8_t *ptr; uint256 revtxid,utxotxid;
@@ -25,6 +25,8 @@
 #include "zcash/zip32.h"
 
 #include <assert.h>
+#include <atomic>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -445,6 +447,10 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    {
+        LOCK(cs_wallet);
+        InvalidateWalletUTXOs(); // outputs to it may be ours now
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -572,12 +578,22 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
         IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     } else {
         DecrementNoteWitnesses(pindex);
+        // block times and spends under the cached staking candidates and the UTXO index may have changed
+        LOCK(cs_wallet);
+        InvalidateStakingCandidates();
+        InvalidateWalletUTXOs();
     }
     UpdateSaplingNullifierNoteMapForBlock(pblock);
 }
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    {
+        LOCK(cs_wallet);
+        // keep the old best block until the rescan is done, so a restart picks it up again
+        if (fRescanInProgress)
+            return;
+    }
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
@@ -962,11 +978,20 @@ void CWallet::ClearNoteWitnessCache()
     //fprintf(stderr,"Clear witness cache\n");
 }
 
+// Notes a rescan has witnessed up to nRescanHeight are still behind it; only the rescan moves them on.
+template<typename NoteData>
+bool NoteBehindRescan(const NoteData* nd, int nRescanHeight)
+{
+    return nd->witnessHeight >= 0 && nd->witnessHeight <= nRescanHeight;
+}
+
 template<typename NoteDataMap>
-void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, int nRescanHeight = -1)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        if (NoteBehindRescan(nd, nRescanHeight))
+            continue;
         // Only increment witnesses that are behind the current height
         if (nd->witnessHeight < indexHeight) {
             // Check the validity of the cache
@@ -990,10 +1015,12 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
 }
 
 template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment, int nRescanHeight = -1)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        if (NoteBehindRescan(nd, nRescanHeight))
+            continue;
         if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
@@ -1035,10 +1062,12 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
 
 
 template<typename NoteDataMap>
-void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, int nRescanHeight = -1)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        if (NoteBehindRescan(nd, nRescanHeight))
+            continue;
         if (nd->witnessHeight < indexHeight) {
             nd->witnessHeight = indexHeight;
             // Check the validity of the cache
@@ -1054,9 +1083,12 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      SaplingMerkleTree& saplingTree)
 {
     LOCK(cs_wallet);
+    // the rescan adds its blocks with the locks held and nRescanHeight reset, tip
+    // updates that come in while it waits without them see nRescanHeight set
+    int64_t& nWitnessCacheSize = (nRescanWitnessCacheSize >= 0 && nRescanHeight < 0) ? this->nRescanWitnessCacheSize : this->nWitnessCacheSize;
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize);
-       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize);
+       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight);
+       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight);
     }
 
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
@@ -1082,7 +1114,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 
                 // Increment existing witnesses
                 for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize, note_commitment);
+                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize, note_commitment, nRescanHeight);
                 }
 
                 // If this is our note, witness it
@@ -1099,7 +1131,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 
             // Increment existing witnesses
             for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize, note_commitment);
+                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize, note_commitment, nRescanHeight);
             }
 
             // If this is our note, witness it
@@ -1112,8 +1144,8 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 
     // Update witness heights
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize);
+        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight);
+        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight);
     }
 
     // For performance reasons, we write out the witness cache in
@@ -1122,12 +1154,14 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 }
 
 template<typename NoteDataMap>
-bool DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+bool DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, int nRescanHeight = -1)
 {
     extern int32_t SAFECOIN_REWIND;
 
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        if (NoteBehindRescan(nd, nRescanHeight))
+            continue;
         // Only decrement witnesses that are not above the current height
         if (nd->witnessHeight <= indexHeight) {
             // Check the validity of the cache
@@ -1173,9 +1207,9 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        if (!::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize))
+        if (!::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight))
             needsRescan = true;
-        if (!::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize))
+        if (!::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->GetHeight(), nWitnessCacheSize, nRescanHeight))
             needsRescan = true;
     }
     nWitnessCacheSize -= 1;
@@ -1438,6 +1472,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        // called after keys are imported, which may make more outputs ours
+        InvalidateWalletUTXOs();
     }
 }
 
@@ -1571,6 +1607,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        // may replace a transaction the index has, or spend one of its outputs
+        fWalletUTXOsDirty = true;
     }
     else
     {
@@ -1669,6 +1707,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        NotifyStakingChange(hash);
+        UpdateWalletUTXOs(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1729,30 +1769,41 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * If fUpdate is true, existing transactions will be updated.
  */
 bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+    if (fExisted && !fUpdate) return false;
+    CWalletTxScan scan;
+    scan.fIsMine = !fExisted && IsMine(tx);
+    scan.sproutNoteData = FindMySproutNotes(tx);
+    if (pblock)
+        std::tie(scan.saplingNoteData, scan.saplingAddressesToAdd) = FindMySaplingNotesInBlock(tx, *pblock);
+    else
+        std::tie(scan.saplingNoteData, scan.saplingAddressesToAdd) = FindMySaplingNotes(tx);
+    return AddToWalletIfInvolvingMe(tx, pblock, fUpdate, scan);
+}
+
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, CWalletTxScan& scan)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
-        auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
-        auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
-        for (const auto &addressToAdd : addressesToAdd) {
+        for (const auto &addressToAdd : scan.saplingAddressesToAdd) {
             if (!AddSaplingIncomingViewingKey(addressToAdd.second, addressToAdd.first)) {
                 return false;
             }
         }
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
+        if (fExisted || scan.fIsMine || IsFromMe(tx) || scan.sproutNoteData.size() > 0 || scan.saplingNoteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
 
-            if (sproutNoteData.size() > 0) {
-                wtx.SetSproutNoteData(sproutNoteData);
+            if (scan.sproutNoteData.size() > 0) {
+                wtx.SetSproutNoteData(scan.sproutNoteData);
             }
 
-            if (saplingNoteData.size() > 0) {
-                wtx.SetSaplingNoteData(saplingNoteData);
+            if (scan.saplingNoteData.size() > 0) {
+                wtx.SetSaplingNoteData(scan.saplingNoteData);
             }
 
             // Get merkle branch if transaction was found in a block
@@ -1776,6 +1827,158 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
         return; // Not one of ours
 
     MarkAffectedTransactionsDirty(tx);
+    SafeNodeStatusInvalidate();
+}
+
+void CWallet::NotifyStakingChange(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet); // vStakingChanges
+    if (!fTrackStakingChanges || fStakingChangesOverflow)
+        return;
+    // nobody has tried to stake in a while, let the next attempt rebuild from scratch
+    if (vStakingChanges.size() > 2 * mapWallet.size() + 10000) {
+        InvalidateStakingCandidates();
+        return;
+    }
+    vStakingChanges.push_back(hash);
+}
+
+void CWallet::InvalidateStakingCandidates()
+{
+    AssertLockHeld(cs_wallet); // vStakingChanges
+    if (fTrackStakingChanges) {
+        vStakingChanges.clear();
+        fStakingChangesOverflow = true;
+    }
+}
+
+void CWallet::InvalidateWalletUTXOs()
+{
+    AssertLockHeld(cs_wallet); // mapWalletUTXOs
+    mapWalletUTXOs.clear();
+    mapWalletUTXOsByDest.clear();
+    fWalletUTXOsDirty = true;
+}
+
+std::map<COutPoint, CWalletUTXO>::iterator CWallet::EraseWalletUTXO(std::map<COutPoint, CWalletUTXO>::iterator it) const
+{
+    if (IsValidDestination(it->second.dest)) {
+        std::map<CTxDestination, std::set<COutPoint>>::iterator di = mapWalletUTXOsByDest.find(it->second.dest);
+        if (di != mapWalletUTXOsByDest.end()) {
+            di->second.erase(it->first);
+            if (di->second.empty())
+                mapWalletUTXOsByDest.erase(di);
+        }
+    }
+    return mapWalletUTXOs.erase(it);
+}
+
+void CWallet::UpdateWalletUTXOs(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet); // mapWalletUTXOs
+    if (fWalletUTXOsDirty)
+        return;
+
+    const CBlockIndex* pindex = NULL;
+    if (!wtx.hashBlock.IsNull() && wtx.nIndex != -1) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end())
+            pindex = mi->second;
+    }
+    uint256 hash = wtx.GetHash();
+    for (uint32_t i = 0; i < wtx.vout.size(); i++) {
+        COutPoint outpoint(hash, i);
+        std::map<COutPoint, CWalletUTXO>::iterator it = mapWalletUTXOs.find(outpoint);
+        if (it != mapWalletUTXOs.end())
+            EraseWalletUTXO(it);
+        isminetype mine = IsMine(wtx.vout[i]);
+        if (mine == ISMINE_NO)
+            continue;
+        CWalletUTXO& utxo = mapWalletUTXOs[outpoint];
+        utxo.outpoint = outpoint;
+        utxo.pwtx = &wtx;
+        utxo.nValue = wtx.vout[i].nValue;
+        utxo.nLockTime = wtx.nLockTime;
+        utxo.pindex = pindex;
+        utxo.fCoinBase = wtx.IsCoinBase();
+        utxo.nUnlockTime = utxo.fCoinBase ? wtx.UnlockTime(0) : 0;
+        utxo.mine = mine;
+        if (!ExtractDestination(wtx.vout[i].scriptPubKey, utxo.dest))
+            utxo.dest = CNoDestination();
+        if (IsValidDestination(utxo.dest))
+            mapWalletUTXOsByDest[utxo.dest].insert(outpoint);
+    }
+}
+
+void CWallet::RebuildWalletUTXOs() const
+{
+    AssertLockHeld(cs_wallet); // mapWalletUTXOs
+    if (!fWalletUTXOsDirty)
+        return;
+    fWalletUTXOsDirty = false;
+    mapWalletUTXOs.clear();
+    mapWalletUTXOsByDest.clear();
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateWalletUTXOs(it->second);
+    LogPrint("selectcoins", "%s: %u outputs of %u transactions\n", __func__, mapWalletUTXOs.size(), mapWallet.size());
+}
+
+/**
+ * IsSpent for an output of the UTXO index. fSpentInBlock is set when one of
+ * the spends is mined, as only a disconnected block could make it unspent
+ * again, and that rebuilds the index.
+ */
+bool CWallet::IsWalletUTXOSpent(const COutPoint& outpoint, bool& fSpentInBlock) const
+{
+    bool fSpent = false;
+    fSpentInBlock = false;
+    std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end()) {
+            int nDepth = mit->second.GetDepthInMainChain();
+            fSpent |= nDepth >= 0;
+            fSpentInBlock |= nDepth > 0;
+        }
+    }
+    return fSpent;
+}
+
+/**
+ * The spendable locktimed outputs AvailableCoins(vCoins, false, NULL, true)
+ * would give, as the interest sum needs them, from the UTXO index.
+ */
+void CWallet::AvailableInterestInputs(std::vector<CWalletUTXO>& vInputs)
+{
+    AssertLockHeld(cs_main); // chainActive, mempool lookups
+    AssertLockHeld(cs_wallet); // mapWalletUTXOs
+    vInputs.clear();
+    RebuildWalletUTXOs();
+
+    int nTipHeight = chainActive.Height();
+    std::map<COutPoint, CWalletUTXO>::iterator it = mapWalletUTXOs.begin();
+    while (it != mapWalletUTXOs.end()) {
+        const CWalletUTXO& in = it->second;
+        if (in.nLockTime == 0 || (in.mine & ISMINE_SPENDABLE) == ISMINE_NO) {
+            ++it;
+            continue;
+        }
+        bool fSpentInBlock;
+        bool fSpent = IsWalletUTXOSpent(it->first, fSpentInBlock);
+        if (fSpentInBlock) {
+            it = EraseWalletUTXO(it);
+            continue;
+        }
+        ++it;
+        if (fSpent || IsLockedCoin(in.outpoint.hash, in.outpoint.n))
+            continue;
+        int nHeight = (in.pindex != NULL && chainActive.Contains(in.pindex)) ? in.pindex->GetHeight() : 0;
+        if (nHeight == 0 && !mempool.exists(in.outpoint.hash))
+            continue;
+        if (in.fCoinBase && (nHeight == 0 || COINBASE_MATURITY > nTipHeight - nHeight + 1 || in.nUnlockTime > nTipHeight))
+            continue;
+        vInputs.push_back(in);
+    }
 }
 
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
@@ -1813,7 +2016,12 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            // the outputs it spent are unspent again
+            InvalidateStakingCandidates();
+            InvalidateWalletUTXOs();
+        }
     }
     return;
 }
@@ -1869,13 +2077,22 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
 mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
+    return FindMySproutNotes(tx, mapNoteDecryptors);
+}
+
+/**
+ * As above, trying the given decryptors. A rescan copies mapNoteDecryptors once
+ * so its worker threads do not serialise on cs_SpendingKeyStore.
+ */
+mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx, const NoteDecryptorMap& decryptors) const
+{
     uint256 hash = tx.GetHash();
 
     mapSproutNoteData_t noteData;
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
         auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
         for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+            for (const NoteDecryptorMap::value_type& item : decryptors) {
                 try {
                     auto address = item.first;
                     JSOutPoint jsoutpt {hash, i, j};
@@ -1917,35 +2134,140 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
+    std::vector<SaplingIncomingViewingKey> ivks;
+    if (!tx.vShieldedOutput.empty()) {
+        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+            ivks.push_back(it->first);
+        }
+    }
+    return FindMySaplingNotes(tx, ivks);
+}
+
+/**
+ * As above, trying the given incoming viewing keys. cs_SpendingKeyStore is
+ * only taken for outputs that decrypt.
+ */
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx,
+    const std::vector<SaplingIncomingViewingKey>& ivks) const
+{
+    return FindMySaplingNotes(std::vector<const CTransaction*>(1, &tx), ivks, 1)[0];
+}
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+/**
+ * FindMySaplingNotes for a batch of transactions, such as the ones in a block.
+ * The outputs are shared out over up to nThreads threads, each trying all of
+ * the keys on one output at a time.
+ */
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(
+    const std::vector<const CTransaction*>& vtx,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    int nThreads) const
+{
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> results(vtx.size());
+    if (ivks.empty())
+        return results;
+
+    // (tx, output) for every output in the batch
+    std::vector<std::pair<size_t, uint32_t>> vOutputs;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        for (uint32_t j = 0; j < vtx[i]->vShieldedOutput.size(); j++) {
+            vOutputs.push_back(std::make_pair(i, j));
+        }
+    }
+    std::vector<boost::optional<SaplingNotePlaintext>> vPlaintexts(vOutputs.size());
+    std::vector<size_t> vIvkIndex(vOutputs.size());
+    std::atomic<size_t> nNext(0);
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
-            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-            if (!result) {
-                continue;
+    auto trialDecrypt = [&]() {
+        size_t k;
+        while ((k = nNext++) < vOutputs.size()) {
+            const OutputDescription& output = vtx[vOutputs[k].first]->vShieldedOutput[vOutputs[k].second];
+            try {
+                vPlaintexts[k] = SaplingNotePlaintext::trial_decrypt(output.encCiphertext, ivks, output.ephemeralKey, output.cm, vIvkIndex[k]);
+            } catch (const std::exception &exc) {
+                LogPrintf("FindMySaplingNotes(): Unexpected error while testing decrypt:\n");
+                LogPrintf("%s\n", exc.what());
             }
-            auto address = ivk.address(result.get().d);
+        }
+    };
+    nThreads = std::min<int>(nThreads, vOutputs.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++) {
+        threads.emplace_back(trialDecrypt);
+    }
+    trialDecrypt();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t k = 0; k < vOutputs.size(); k++) {
+        if (!vPlaintexts[k]) {
+            continue;
+        }
+        auto& result = results[vOutputs[k].first];
+        const SaplingIncomingViewingKey& ivk = ivks[vIvkIndex[k]];
+        auto address = ivk.address(vPlaintexts[k]->d);
+        {
+            LOCK(cs_SpendingKeyStore);
             if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                viewingKeysToAdd[address.get()] = ivk;
+                result.second[address.get()] = ivk;
             }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
         }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {vtx[vOutputs[k].first]->GetHash(), vOutputs[k].second};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        result.first.insert(std::make_pair(op, nd));
     }
+    return results;
+}
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+/**
+ * FindMySaplingNotes for a transaction in block. The first call for a block
+ * trial-decrypts all of its outputs at once on -par threads, and the other
+ * transactions in it are answered from that.
+ */
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotesInBlock(const CTransaction& tx, const CBlock& block)
+{
+    AssertLockHeld(cs_wallet); // mapSaplingBatchNotes
+    if (tx.vShieldedOutput.empty()) {
+        return std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>();
+    }
+
+    uint256 hashBlock = block.GetHash();
+    std::vector<SaplingIncomingViewingKey> ivks;
+    {
+        LOCK(cs_SpendingKeyStore);
+        if (hashBlock != hashSaplingBatchBlock || nSaplingBatchKeys != mapSaplingFullViewingKeys.size()) {
+            for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+                ivks.push_back(it->first);
+            }
+            nSaplingBatchKeys = ivks.size();
+            hashSaplingBatchBlock.SetNull();
+        }
+    }
+    if (hashSaplingBatchBlock.IsNull()) {
+        std::vector<const CTransaction*> vtx;
+        for (const CTransaction& btx : block.vtx) {
+            if (!btx.vShieldedOutput.empty()) {
+                vtx.push_back(&btx);
+            }
+        }
+        auto results = FindMySaplingNotes(vtx, ivks, std::max(1, nScriptCheckThreads));
+        mapSaplingBatchNotes.clear();
+        for (size_t i = 0; i < vtx.size(); i++) {
+            mapSaplingBatchNotes[vtx[i]->GetHash()] = results[i];
+        }
+        hashSaplingBatchBlock = hashBlock;
+    }
+
+    auto it = mapSaplingBatchNotes.find(tx.GetHash());
+    if (it == mapSaplingBatchNotes.end()) {
+        return FindMySaplingNotes(tx);
+    }
+    return it->second;
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
@@ -2669,10 +2991,93 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+/** A block read from disk and run through the key-only part of AddToWalletIfInvolvingMe ahead of the rescan. */
+struct CWalletRescanBlock
+{
+    CBlockIndex* pindex;
+    CBlock block;
+    std::vector<CWalletTxScan> vtxScan;
+};
+
+/** The blocks a rescan works on at a time, and the worker threads reading them ahead. */
+struct CWalletRescanChunk
+{
+    std::vector<CWalletRescanBlock> vBlocks;
+    std::atomic<size_t> nNext;
+    std::vector<std::thread> threads;
+
+    // stops and joins the workers if the rescan leaves early, e.g. on an exception
+    ~CWalletRescanChunk()
+    {
+        nNext = vBlocks.size();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+};
+
+static const size_t WALLET_RESCAN_CHUNK_BLOCKS = 100;
+
+static void ThreadScanRescanChunk(CWallet* pwallet, CWalletRescanChunk* pchunk,
+                                  const NoteDecryptorMap* sproutDecryptors,
+                                  const std::vector<SaplingIncomingViewingKey>* saplingIvks)
+{
+    size_t i;
+    while ((i = pchunk->nNext++) < pchunk->vBlocks.size()) {
+        CWalletRescanBlock& scan = pchunk->vBlocks[i];
+        ReadBlockFromDisk(scan.block, scan.pindex, 1);
+        scan.vtxScan.resize(scan.block.vtx.size());
+        for (size_t j = 0; j < scan.block.vtx.size(); j++) {
+            const CTransaction& tx = scan.block.vtx[j];
+            CWalletTxScan& txScan = scan.vtxScan[j];
+            txScan.fIsMine = pwallet->IsMine(tx);
+            if (!sproutDecryptors->empty())
+                txScan.sproutNoteData = pwallet->FindMySproutNotes(tx, *sproutDecryptors);
+        }
+        if (!saplingIvks->empty()) {
+            // the blocks are already spread over the workers, so one thread per block here
+            std::vector<const CTransaction*> vtx;
+            for (const CTransaction& tx : scan.block.vtx)
+                vtx.push_back(&tx);
+            auto saplingResults = pwallet->FindMySaplingNotes(vtx, *saplingIvks, 1);
+            for (size_t j = 0; j < vtx.size(); j++)
+                std::tie(scan.vtxScan[j].saplingNoteData, scan.vtxScan[j].saplingAddressesToAdd) = saplingResults[j];
+        }
+    }
+}
+
+// Queue the blocks from pindex on and start reading and scanning them on -par worker threads. Needs cs_main.
+static void StartRescanChunk(CWallet* pwallet, CWalletRescanChunk& chunk, CBlockIndex* pindex,
+                             const NoteDecryptorMap* sproutDecryptors,
+                             const std::vector<SaplingIncomingViewingKey>* saplingIvks)
+{
+    AssertLockHeld(cs_main);
+    chunk.vBlocks.clear();
+    chunk.nNext = 0;
+    for (; pindex && chunk.vBlocks.size() < WALLET_RESCAN_CHUNK_BLOCKS; pindex = chainActive.Next(pindex)) {
+        chunk.vBlocks.emplace_back();
+        chunk.vBlocks.back().pindex = pindex;
+    }
+    int nThreads = std::min<int>(std::max(1, nScriptCheckThreads), chunk.vBlocks.size());
+    for (int i = 0; i < nThreads; i++)
+        chunk.threads.emplace_back(ThreadScanRescanChunk, pwallet, &chunk, sproutDecryptors, saplingIvks);
+}
+
+static void FinishRescanChunk(CWalletRescanChunk& chunk)
+{
+    for (std::thread& thread : chunk.threads)
+        thread.join();
+    chunk.threads.clear();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and checked against the wallet's keys a chunk ahead on
+ * worker threads, and added to the wallet in block order. If the caller does
+ * not hold cs_main and cs_wallet, they are released while waiting for a chunk
+ * that is deeper than MAX_REORG_LENGTH below the tip.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -2684,64 +3089,132 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 
     std::vector<uint256> myTxHashes;
 
+    NoteDecryptorMap sproutDecryptors;
+    std::vector<SaplingIncomingViewingKey> saplingIvks;
+    CWalletRescanChunk chunks[2];
+    int nChunk = 0;
+
     {
         LOCK2(cs_main, cs_wallet);
 
-        // no need to read and scan block, if block was created before
-        // our wallet birthday (as adjusted for block time variability)
-        while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
-            pindex = chainActive.Next(pindex);
+        if (fRescanInProgress) {
+            LogPrintf("ScanForWalletTransactions(): another rescan is in progress\n");
+            return -1;
+        }
+        fRescanInProgress = true;
+        nRescanWitnessCacheSize = nWitnessCacheSize;
+        // however the rescan ends, with the locks still held
+        auto endRescan = [this]() {
+            nWitnessCacheSize = std::max(nWitnessCacheSize, nRescanWitnessCacheSize);
+            nRescanWitnessCacheSize = -1;
+            nRescanHeight = -1;
+            fRescanInProgress = false;
+        };
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.LastTip(), false);
-        while (pindex)
-        {
-            if (pindex->GetHeight() % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        try {
+            // no need to read and scan block, if block was created before
+            // our wallet birthday (as adjusted for block time variability)
+            while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
+                pindex = chainActive.Next(pindex);
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex,1);
-            for (CTransaction& tx : block.vtx)
+            ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+            double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+            double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.LastTip(), false);
+
+            // The keys do not change during the rescan (new Sapling addresses map to
+            // existing viewing keys), so the workers get a copy of them.
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
-                }
+                LOCK(cs_SpendingKeyStore);
+                sproutDecryptors = mapNoteDecryptors;
+                for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it)
+                    saplingIvks.push_back(it->first);
             }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (NetworkUpgradeActive(pindex->pprev->GetHeight(), Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+            StartRescanChunk(this, chunks[nChunk], pindex, &sproutDecryptors, &saplingIvks);
+            while (!chunks[nChunk].vBlocks.empty())
+            {
+                CWalletRescanChunk& chunk = chunks[nChunk];
+                CWalletRescanChunk& next = chunks[nChunk ^ 1];
+                CBlockIndex* pindexLast = chunk.vBlocks.back().pindex;
+
+                // A chunk no reorg can reach is waited for without the locks, so the node
+                // keeps serving. Tip updates in the meantime leave the notes the rescan has
+                // not caught up on to it.
+                bool fRelease = pindexLast->GetHeight() + (int)MAX_REORG_LENGTH < chainActive.Height();
+                if (fRelease) {
+                    nRescanHeight = chunk.vBlocks.front().pindex->GetHeight() - 1;
+                    LEAVE_CRITICAL_SECTION(cs_wallet);
+                    LEAVE_CRITICAL_SECTION(cs_main);
                 }
-            }
-            // Increment note witness caches
-            ChainTip(pindex, &block, sproutTree, saplingTree, true);
+                FinishRescanChunk(chunk);
+                if (fRelease) {
+                    ENTER_CRITICAL_SECTION(cs_main);
+                    ENTER_CRITICAL_SECTION(cs_wallet);
+                    nRescanHeight = -1;
+                    if (!chainActive.Contains(pindexLast)) {
+                        LogPrintf("ScanForWalletTransactions(): block %s was disconnected during the rescan\n", pindexLast->GetBlockHash().ToString());
+                        needsRescan = true;
+                        break;
+                    }
+                }
+
+                // read the next chunk while this one is added to the wallet
+                StartRescanChunk(this, next, chainActive.Next(pindexLast), &sproutDecryptors, &saplingIvks);
+
+                for (CWalletRescanBlock& scan : chunk.vBlocks)
+                {
+                    pindex = scan.pindex;
+                    if (pindex->GetHeight() % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                    CBlock& block = scan.block;
+                    for (size_t i = 0; i < block.vtx.size(); i++)
+                    {
+                        if (AddToWalletIfInvolvingMe(block.vtx[i], &block, fUpdate, scan.vtxScan[i])) {
+                            myTxHashes.push_back(block.vtx[i].GetHash());
+                            ret++;
+                        }
+                    }
+
+                    SproutMerkleTree sproutTree;
+                    SaplingMerkleTree saplingTree;
+                    // This should never fail: we should always be able to get the tree
+                    // state on the path to the tip of our chain
+                    assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                    if (pindex->pprev) {
+                        if (NetworkUpgradeActive(pindex->pprev->GetHeight(), Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
+                            assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                        }
+                    }
+                    // Increment note witness caches
+                    ChainTip(pindex, &block, sproutTree, saplingTree, true);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    if (GetTime() >= nNow + 60) {
+                        nNow = GetTime();
+                        LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    }
+                }
+                chunk.vBlocks.clear();
+                nChunk ^= 1;
             }
-        }
 
-        // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
-        // Do not flush the wallet here for performance reasons.
-        CWalletDB walletdb(strWalletFile, "r+", false);
-        for (auto hash : myTxHashes) {
-            CWalletTx wtx = mapWallet[hash];
-            if (!wtx.mapSaplingNoteData.empty()) {
-                if (!wtx.WriteToDisk(&walletdb)) {
-                    LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
+            // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
+            // Do not flush the wallet here for performance reasons.
+            CWalletDB walletdb(strWalletFile, "r+", false);
+            for (auto hash : myTxHashes) {
+                CWalletTx wtx = mapWallet[hash];
+                if (!wtx.mapSaplingNoteData.empty()) {
+                    if (!wtx.WriteToDisk(&walletdb)) {
+                        LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
+                    }
                 }
             }
-        }
 
+        } catch (...) {
+            endRescan();
+            throw;
+        }
+        endRescan();
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
@@ -3186,71 +3659,102 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
  * populate vCoins with vector of available COutputs.
  */
 uint64_t safecoin_interestnew(int32_t txheight,uint64_t nValue,uint32_t nLockTime,uint32_t tiptime);
-uint64_t safecoin_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint256 hash,int32_t n,int32_t checkheight,uint64_t checkvalue,int32_t tipheight);
 
-void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, bool fIncludeCoinBase) const
+/**
+ * Walks the UTXO index rather than every output of mapWallet. With
+ * destinations set, only the outputs to those addresses are visited.
+ * Coins come out in mapWallet order either way.
+ */
+void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, bool fIncludeCoinBase, const std::set<CTxDestination>* destinations) const
 {
     uint64_t interest,*ptr;
     vCoins.clear();
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
-                continue;
+        RebuildWalletUTXOs();
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+        std::vector<std::map<COutPoint, CWalletUTXO>::iterator> vCandidates;
+        if (destinations != NULL) {
+            for (const CTxDestination& dest : *destinations) {
+                std::map<CTxDestination, std::set<COutPoint>>::const_iterator di = mapWalletUTXOsByDest.find(dest);
+                if (di == mapWalletUTXOsByDest.end())
+                    continue;
+                for (const COutPoint& outpoint : di->second)
+                    vCandidates.push_back(mapWalletUTXOs.find(outpoint));
+            }
+            std::sort(vCandidates.begin(), vCandidates.end(),
+                      [](const std::map<COutPoint, CWalletUTXO>::iterator& a, const std::map<COutPoint, CWalletUTXO>::iterator& b) {
+                          return a->first < b->first;
+                      });
+        } else {
+            vCandidates.reserve(mapWalletUTXOs.size());
+            for (std::map<COutPoint, CWalletUTXO>::iterator it = mapWalletUTXOs.begin(); it != mapWalletUTXOs.end(); ++it)
+                vCandidates.push_back(it);
+        }
 
-            if (pcoin->IsCoinBase() && !fIncludeCoinBase)
-                continue;
+        const CWalletTx* pcoin = NULL;
+        bool fSkipTx = true;
+        int nDepth = -1;
+        int32_t wtxheight = -1;
+        for (std::map<COutPoint, CWalletUTXO>::iterator utxo : vCandidates)
+        {
+            const uint256 wtxid = utxo->first.hash;
+            const int i = utxo->first.n;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+            // outputs of the same tx are next to each other, check it once
+            if (utxo->second.pwtx != pcoin)
+            {
+                pcoin = utxo->second.pwtx;
+                wtxheight = -1;
+                fSkipTx = !CheckFinalTx(*pcoin) ||
+                          (fOnlyConfirmed && !pcoin->IsTrusted()) ||
+                          (pcoin->IsCoinBase() && (!fIncludeCoinBase || pcoin->GetBlocksToMaturity() > 0));
+                nDepth = fSkipTx ? -1 : pcoin->GetDepthInMainChain();
+                fSkipTx = fSkipTx || nDepth < 0;
+            }
+            if (fSkipTx)
                 continue;
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
+            bool fSpentInBlock;
+            if (IsWalletUTXOSpent(utxo->first, fSpentInBlock))
+            {
+                if (fSpentInBlock)
+                    EraseWalletUTXO(utxo);
                 continue;
- 
-            for (int i = 0; i < pcoin->vout.size(); i++)
+            }
+            isminetype mine = utxo->second.mine;
+            if (!IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
             {
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                if ( SAFECOIN_EXCHANGEWALLET == 0 )
                 {
-                    if ( SAFECOIN_EXCHANGEWALLET == 0 )
+                    uint32_t locktime; int32_t txheight; CBlockIndex *tipindex;
+                    if ( ASSETCHAINS_SYMBOL[0] == 0 && chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() >= 60000 )
                     {
-                        uint32_t locktime; int32_t txheight; CBlockIndex *tipindex;
-                        if ( ASSETCHAINS_SYMBOL[0] == 0 && chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() >= 60000 )
+                        if ( pcoin->vout[i].nValue >= 10*COIN )
                         {
-                            if ( pcoin->vout[i].nValue >= 10*COIN )
+                            if ( (tipindex= chainActive.LastTip()) != 0 )
                             {
-                                if ( (tipindex= chainActive.LastTip()) != 0 )
-                                {
-                                    safecoin_accrued_interest(&txheight,&locktime,wtxid,i,0,pcoin->vout[i].nValue,(int32_t)tipindex->GetHeight());
-                                    interest = safecoin_interestnew(txheight,pcoin->vout[i].nValue,locktime,tipindex->nTime);
-                                } else interest = 0;
-                                //interest = safecoin_interestnew(chainActive.LastTip()->GetHeight()+1,pcoin->vout[i].nValue,pcoin->nLockTime,chainActive.LastTip()->nTime);
-                                if ( interest != 0 )
-                                {
-                                    //printf("wallet nValueRet %.8f += interest %.8f ht.%d lock.%u/%u tip.%u\n",(double)pcoin->vout[i].nValue/COIN,(double)interest/COIN,txheight,locktime,pcoin->nLockTime,tipindex->nTime);
-                                    //fprintf(stderr,"wallet nValueRet %.8f += interest %.8f ht.%d lock.%u tip.%u\n",(double)pcoin->vout[i].nValue/COIN,(double)interest/COIN,chainActive.LastTip()->GetHeight()+1,pcoin->nLockTime,chainActive.LastTip()->nTime);
-                                    //ptr = (uint64_t *)&pcoin->vout[i].nValue;
-                                    //(*ptr) += interest;
-                                    ptr = (uint64_t *)&pcoin->vout[i].interest;
-                                    (*ptr) = interest;
-                                    //pcoin->vout[i].nValue += interest;
-                                }
-                                else
+                                // the wallet already holds the funding tx, so height and locktime come from it instead of a GetTransaction per output
+                                if ( wtxheight < 0 )
                                 {
-                                    ptr = (uint64_t *)&pcoin->vout[i].interest;
-                                    (*ptr) = 0;
+                                    BlockMap::const_iterator mi = mapBlockIndex.find(pcoin->hashBlock);
+                                    wtxheight = (mi != mapBlockIndex.end() && mi->second != 0 && chainActive.Contains(mi->second)) ? mi->second->GetHeight() : 0;
                                 }
+                                txheight = wtxheight, locktime = pcoin->nLockTime;
+                                interest = safecoin_interestnew(txheight,pcoin->vout[i].nValue,locktime,tipindex->nTime);
+                            } else interest = 0;
+                            //interest = safecoin_interestnew(chainActive.LastTip()->GetHeight()+1,pcoin->vout[i].nValue,pcoin->nLockTime,chainActive.LastTip()->nTime);
+                            if ( interest != 0 )
+                            {
+                                //printf("wallet nValueRet %.8f += interest %.8f ht.%d lock.%u/%u tip.%u\n",(double)pcoin->vout[i].nValue/COIN,(double)interest/COIN,txheight,locktime,pcoin->nLockTime,tipindex->nTime);
+                                //fprintf(stderr,"wallet nValueRet %.8f += interest %.8f ht.%d lock.%u tip.%u\n",(double)pcoin->vout[i].nValue/COIN,(double)interest/COIN,chainActive.LastTip()->GetHeight()+1,pcoin->nLockTime,chainActive.LastTip()->nTime);
+                                //ptr = (uint64_t *)&pcoin->vout[i].nValue;
+                                //(*ptr) += interest;
+                                ptr = (uint64_t *)&pcoin->vout[i].interest;
+                                (*ptr) = interest;
+                                //pcoin->vout[i].nValue += interest;
                             }
                             else
                             {
@@ -3264,8 +3768,13 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
                             (*ptr) = 0;
                         }
                     }
-                    vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+                    else
+                    {
+                        ptr = (uint64_t *)&pcoin->vout[i].interest;
+                        (*ptr) = 0;
+                    }
                 }
+                vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
     }
@@ -3449,8 +3958,11 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
     //    *interestp = 0;
     //}
     vector<COutput> vCoinsNoCoinbase, vCoinsWithCoinbase;
-    AvailableCoins(vCoinsNoCoinbase, true, coinControl, false, false);
     AvailableCoins(vCoinsWithCoinbase, true, coinControl, false, true);
+    for (const COutput& out : vCoinsWithCoinbase) {
+        if (!out.tx->IsCoinBase())
+            vCoinsNoCoinbase.push_back(out);
+    }
     fOnlyCoinbaseCoinsRet = vCoinsNoCoinbase.size() == 0 && vCoinsWithCoinbase.size() > 0;
 
     // If coinbase utxos can only be sent to zaddrs, exclude any coinbase utxos from coin selection.
@@ -4507,18 +5019,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    NotifyStakingChange(output.hash);
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    NotifyStakingChange(output.hash);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    InvalidateStakingCandidates();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -715,6 +715,39 @@ private:
 };
 
 
+/**
+ * A wallet output of ours that is not known to be spent in a block, with what
+ * coin selection and the interest sum filter on, taken from the wallet
+ * transaction when it is added. See CWallet::mapWalletUTXOs.
+ */
+struct CWalletUTXO
+{
+    COutPoint outpoint;
+    const CWalletTx* pwtx;
+    CAmount nValue;
+    uint32_t nLockTime;
+    const CBlockIndex* pindex; //!< block the tx was in when added, if it is in the index
+    bool fCoinBase;
+    int64_t nUnlockTime;       //!< coinbase only, CTransaction::UnlockTime(0)
+    isminetype mine;
+    CTxDestination dest;       //!< CNoDestination if the script has none
+};
+
+/**
+ * The part of AddToWalletIfInvolvingMe that only depends on the wallet's keys, so that a rescan can
+ * work it out for blocks ahead of the one it is adding to the wallet.
+ */
+struct CWalletTxScan
+{
+    bool fIsMine;
+    mapSproutNoteData_t sproutNoteData;
+    mapSaplingNoteData_t saplingNoteData;
+    SaplingIncomingViewingKeyMap saplingAddressesToAdd;
+
+    CWalletTxScan() : fIsMine(false) {}
+};
+
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -753,6 +786,29 @@ private:
     TxNullifiers mapTxSproutNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
 
+    /**
+     * Sapling trial decryption results for the block SyncTransaction is going
+     * through, worked out for all of its outputs at once.
+     */
+    uint256 hashSaplingBatchBlock;
+    size_t nSaplingBatchKeys;
+    std::map<uint256, std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> mapSaplingBatchNotes;
+
+    /**
+     * UTXO index: the outputs of mapWallet that are ours, by outpoint and by
+     * address, kept from AddToWallet so that AvailableCoins and the interest
+     * sum only visit candidates. Outputs spent in a block are dropped when a
+     * lookup comes across them. Rebuilt from mapWallet while fWalletUTXOsDirty.
+     */
+    mutable std::map<COutPoint, CWalletUTXO> mapWalletUTXOs;
+    mutable std::map<CTxDestination, std::set<COutPoint>> mapWalletUTXOsByDest;
+    mutable bool fWalletUTXOsDirty;
+
+    void UpdateWalletUTXOs(const CWalletTx& wtx) const;
+    void RebuildWalletUTXOs() const;
+    std::map<COutPoint, CWalletUTXO>::iterator EraseWalletUTXO(std::map<COutPoint, CWalletUTXO>::iterator it) const;
+    bool IsWalletUTXOSpent(const COutPoint& outpoint, bool& fSpentInBlock) const;
+
     void AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSproutSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
@@ -766,6 +822,20 @@ public:
      */
     int64_t nWitnessCacheSize;
     bool needsRescan = false;
+    /*
+     * Set while ScanForWalletTransactions runs. While it waits for blocks with
+     * cs_main and cs_wallet released, nRescanHeight is the last block it has
+     * added, and tip updates leave notes witnessed at or below it to the rescan.
+     */
+    bool fRescanInProgress;
+    int nRescanHeight;
+    /*
+     * The witness cache size of the notes the rescan moves on, -1 outside a
+     * rescan. Tip disconnects while the locks are released only shrink the
+     * caches of the notes ahead of the rescan, so they change nWitnessCacheSize
+     * and leave this one alone. The larger of the two is kept when it ends.
+     */
+    int64_t nRescanWitnessCacheSize;
 
     void ClearNoteWitnessCache();
 
@@ -886,6 +956,13 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fTrackStakingChanges = false;
+        fStakingChangesOverflow = false;
+        fRescanInProgress = false;
+        nRescanHeight = -1;
+        nRescanWitnessCacheSize = -1;
+        nSaplingBatchKeys = 0;
+        fWalletUTXOsDirty = true;
     }
 
     /**
@@ -955,12 +1032,18 @@ public:
 
     int64_t nTimeFirstKey;
 
+    //! Journal of txids added to or updated in mapWallet, consumed by the staking candidate set in
+    //! rpcwallet.cpp. Only kept once fTrackStakingChanges is set; fStakingChangesOverflow asks for a rebuild.
+    bool fTrackStakingChanges;
+    bool fStakingChangesOverflow;
+    std::vector<uint256> vStakingChanges;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
-    void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true) const;
+    void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true, const std::set<CTxDestination>* destinations = NULL) const;
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
@@ -1105,8 +1188,13 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void EraseFromWallet(const uint256 &hash);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void NotifyStakingChange(const uint256& hash);
+    void InvalidateStakingCandidates();
+    void InvalidateWalletUTXOs();
+    void AvailableInterestInputs(std::vector<CWalletUTXO>& vInputs);
     void RescanWallet();
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, CWalletTxScan& scan);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<SproutWitness>>& witnesses,
@@ -1150,7 +1238,15 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
+    mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivks) const;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(
+        const std::vector<const CTransaction*>& vtx,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivks,
+        int nThreads) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotesInBlock(const CTransaction& tx, const CBlock& block);
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
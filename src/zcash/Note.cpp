@@ -184,21 +184,16 @@ boost::optional<SaplingOutgoingPlaintext> SaplingOutgoingPlaintext::decrypt(
     return ret;
 }
 
-boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
-    const SaplingEncCiphertext &ciphertext,
+// Checks a plaintext decrypted with ivk against the output's note commitment
+static boost::optional<SaplingNotePlaintext> SaplingNotePlaintextForCmu(
+    const SaplingEncPlaintext &pt,
     const uint256 &ivk,
-    const uint256 &epk,
     const uint256 &cmu
 )
 {
-    auto pt = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
-    if (!pt) {
-        return boost::none;
-    }
-
     // Deserialize from the plaintext
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << pt.get();
+    ss << pt;
 
     SaplingNotePlaintext ret;
     ss >> ret;
@@ -229,6 +224,46 @@ boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     return ret;
 }
 
+boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    auto pt = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
+    if (!pt) {
+        return boost::none;
+    }
+
+    return SaplingNotePlaintextForCmu(pt.get(), ivk, cmu);
+}
+
+boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::trial_decrypt(
+    const SaplingEncCiphertext &ciphertext,
+    const std::vector<SaplingIncomingViewingKey> &ivks,
+    const uint256 &epk,
+    const uint256 &cmu,
+    size_t &ivkIndex
+)
+{
+    for (ivkIndex = 0; ivkIndex < ivks.size(); ivkIndex++) {
+        bool fInvalidEpk;
+        auto pt = AttemptSaplingEncDecryption(ciphertext, ivks[ivkIndex], epk, fInvalidEpk);
+        if (fInvalidEpk) {
+            break;
+        }
+        if (!pt) {
+            continue;
+        }
+        auto ret = SaplingNotePlaintextForCmu(pt.get(), ivks[ivkIndex], cmu);
+        if (ret) {
+            return ret;
+        }
+    }
+    return boost::none;
+}
+
 boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
@@ -7,6 +7,7 @@
 #include "NoteEncryption.hpp"
 
 #include <array>
+#include <vector>
 #include <boost/optional.hpp>
 
 namespace libzcash {
@@ -142,6 +143,17 @@ public:
         const uint256 &cmu
     );
 
+    // Tries each of ivks in turn and returns the first note that decrypts,
+    // setting ivkIndex to its key. Gives up on the output as soon as key
+    // agreement fails, since that does not depend on the key.
+    static boost::optional<SaplingNotePlaintext> trial_decrypt(
+        const SaplingEncCiphertext &ciphertext,
+        const std::vector<SaplingIncomingViewingKey> &ivks,
+        const uint256 &epk,
+        const uint256 &cmu,
+        size_t &ivkIndex
+    );
+
     boost::optional<SaplingNote> note(const SaplingIncomingViewingKey& ivk) const;
 
     virtual ~SaplingNotePlaintext() {}
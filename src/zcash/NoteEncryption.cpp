@@ -157,10 +157,23 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &ivk,
     const uint256 &epk
 )
+{
+    bool fInvalidEpk;
+    return AttemptSaplingEncDecryption(ciphertext, ivk, epk, fInvalidEpk);
+}
+
+boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    bool &fInvalidEpk
+)
 {
     uint256 dhsecret;
 
+    fInvalidEpk = false;
     if (!librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin())) {
+        fInvalidEpk = true;
         return boost::none;
     }
 
@@ -73,6 +73,15 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// As above, setting fInvalidEpk when key agreement fails. That only depends
+// on epk, so trial decryption can skip the remaining keys for this output.
+boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    bool &fInvalidEpk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
@@ -1,8 +1,14 @@
+#include <atomic>
 #include <cstdio>
+#include <deque>
 #include <future>
 #include <map>
 #include <thread>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
 #include <boost/filesystem.hpp>
 
 #include "coins.h"
@@ -13,18 +19,23 @@
 #include "crypto/equihash.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "coincontrol.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "miner.h"
+#include "net.h"
+#include "netbase.h"
 #include "pow.h"
 #include "rpc/server.h"
 #include "script/sign.h"
 #include "sodium.h"
 #include "streams.h"
 #include "txdb.h"
+#include "undo.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
+#include "safecoin_structs.h"
 
 #include "zcbenchmarks.h"
 
@@ -438,8 +449,59 @@ double benchmark_connectblock_slow()
 extern UniValue getnewaddress(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue sendtoaddress(const UniValue& params, bool fHelp);
 
-double benchmark_sendtoaddress(CAmount amount)
+// A wallet with nUtxos confirmed outputs to key, ten to a transaction, with its UTXO index built
+static void benchmark_synthetic_wallet(CWallet& wallet, CKey& key, size_t nUtxos)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    if (chainActive.Tip() == NULL) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "No blocks to confirm the synthetic wallet transactions in");
+    }
+    key.MakeNewKey(true);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    for (size_t i = 0; i < nUtxos; i += 10) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        for (size_t j = i; j < std::min(nUtxos, i + 10); j++) {
+            mtx.vout.push_back(CTxOut(COIN + GetRand(100 * COIN), scriptPubKey));
+        }
+        CWalletTx wtx(&wallet, mtx);
+        wtx.hashBlock = chainActive.Tip()->GetBlockHash();
+        wtx.nIndex = 1;
+        wtx.fMerkleVerified = true; // not in the block, there is no branch to check
+        wallet.AddToWallet(wtx, true, NULL);
+    }
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, false, NULL, true);
+}
+
+double benchmark_sendtoaddress(CAmount amount, size_t nUtxos)
 {
+    if (nUtxos > 0) {
+        // coin selection and signing over a large wallet, without committing
+        CWallet wallet;
+        CKey key;
+        benchmark_synthetic_wallet(wallet, key, nUtxos);
+        CCoinControl coinControl;
+        coinControl.destChange = key.GetPubKey().GetID();
+        CKey keyTo;
+        keyTo.MakeNewKey(true);
+        std::vector<CRecipient> vecSend = {{GetScriptForDestination(keyTo.GetPubKey().GetID()), amount, false}};
+        CWalletTx wtx;
+        CReserveKey reservekey(&wallet);
+        CAmount nFee;
+        int nChangePos;
+        std::string strError;
+
+        struct timeval tv_start;
+        timer_start(tv_start);
+        if (!wallet.CreateTransaction(vecSend, wtx, reservekey, nFee, nChangePos, strError, &coinControl)) {
+            throw JSONRPCError(RPC_WALLET_ERROR, strError);
+        }
+        return timer_stop(tv_start);
+    }
+
     UniValue params(UniValue::VARR);
     auto addr = getnewaddress(params, false);
 
@@ -467,8 +529,20 @@ double benchmark_loadwallet()
 
 extern UniValue listunspent(const UniValue& params, bool fHelp);
 
-double benchmark_listunspent()
+double benchmark_listunspent(size_t nUtxos)
 {
+    if (nUtxos > 0) {
+        CWallet wallet;
+        CKey key;
+        benchmark_synthetic_wallet(wallet, key, nUtxos);
+        std::vector<COutput> vCoins;
+        LOCK2(cs_main, wallet.cs_wallet);
+        struct timeval tv_start;
+        timer_start(tv_start);
+        wallet.AvailableCoins(vCoins, false, NULL, true);
+        return timer_stop(tv_start);
+    }
+
     UniValue params(UniValue::VARR);
     struct timeval tv_start;
     timer_start(tv_start);
@@ -631,3 +705,332 @@ double benchmark_verify_sapling_output()
     }
     return timer_stop(tv_start);
 }
+
+void safecoin_notarized_update(struct safecoin_state *sp,int32_t nHeight,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid,uint256 MoM,int32_t MoMdepth);
+struct notarized_checkpoint *safecoin_npptr_scan(struct safecoin_state *sp,int32_t height,int *idx);
+struct notarized_checkpoint *safecoin_npptr_search(struct safecoin_state *sp,int32_t height,int *idx);
+
+double benchmark_npptr_lookup(size_t nPoints, bool fIndexed)
+{
+    // Synthetic notarization history: one checkpoint every 10 blocks, each covering the 10 blocks before it
+    struct safecoin_state sp;
+    memset(&sp, 0, sizeof(sp));
+    uint256 MoM = uint256S("01");
+    for (size_t i = 1; i <= nPoints; i++) {
+        safecoin_notarized_update(&sp, i * 10 + 5, i * 10, GetRandHash(), GetRandHash(), MoM, 10);
+    }
+
+    int idx;
+    size_t nFound = 0;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (size_t i = 0; i < 10000; i++) {
+        int32_t height = 1 + GetRand(nPoints * 10);
+        if ((fIndexed ? safecoin_npptr_search(&sp, height, &idx) : safecoin_npptr_scan(&sp, height, &idx)) != 0) {
+            nFound++;
+        }
+    }
+    auto duration = timer_stop(tv_start);
+    assert(nFound > 0);
+
+    free(sp.NPOINTS);
+    free(sp.MoMPOINTS);
+    return duration;
+}
+
+int32_t safecoin_blockscan_bench(CBlockIndex *pindex,const CBlock &block,const CBlockUndo *blockundo);
+
+double benchmark_safecoin_blockscan(size_t nBlocks, bool fUndo)
+{
+    // Load the most recent blocks and their undo data up front so only the scan itself is timed
+    std::vector<std::pair<CBlockIndex*, CBlock> > blocks;
+    std::vector<CBlockUndo> undos;
+    {
+        LOCK(cs_main);
+        for (CBlockIndex *pindex = chainActive.Tip(); pindex != NULL && pindex->pprev != NULL && blocks.size() < nBlocks; pindex = pindex->pprev) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockFromDisk(block, pindex, false) || !UndoReadFromDisk(blockundo, pindex)) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to read block " + pindex->GetBlockHash().ToString());
+            }
+            blocks.push_back(std::make_pair(pindex, block));
+            undos.push_back(blockundo);
+        }
+    }
+
+    int64_t nVouts = 0;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    {
+        // Without undo data every vin is resolved through gettxout_scriptPubKey, as connectblock used to do
+        LOCK(cs_main);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            nVouts += safecoin_blockscan_bench(blocks[i].first, blocks[i].second, fUndo ? &undos[i] : NULL);
+        }
+    }
+    auto duration = timer_stop(tv_start);
+    LogPrint("bench", "%s: %d blocks, %d state vouts\n", __func__, blocks.size(), nVouts);
+    return duration;
+}
+
+double benchmark_tls_stalled_handshakes(size_t nStalled)
+{
+    // Park nStalled connections on our own listener that never send a ClientHello, then time how
+    // long a well behaved peer has to wait for its TLS handshake to complete behind them
+    CService addrLocal("127.0.0.1", GetListenPort());
+    std::vector<SOCKET> vStalled;
+    for (size_t i = 0; i < nStalled; i++) {
+        SOCKET hSocket;
+        if (!ConnectSocket(addrLocal, hSocket, DEFAULT_CONNECT_TIMEOUT)) {
+            break;
+        }
+        vStalled.push_back(hSocket);
+    }
+    MilliSleep(200);
+
+    SOCKET hSocket = INVALID_SOCKET;
+    SSL *ssl = NULL;
+    int nRet = 0;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (ConnectSocket(addrLocal, hSocket, DEFAULT_CONNECT_TIMEOUT)) {
+        SetSocketNonBlocking(hSocket, false);
+        if ((ssl = SSL_new(tls_ctx_client)) != NULL && SSL_set_fd(ssl, hSocket)) {
+            nRet = SSL_connect(ssl);
+        }
+    }
+    auto duration = timer_stop(tv_start);
+
+    if (ssl != NULL) {
+        if (nRet == 1) {
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+    }
+    if (hSocket != INVALID_SOCKET) {
+        CloseSocket(hSocket);
+    }
+    for (SOCKET& hStalled : vStalled) {
+        CloseSocket(hStalled);
+    }
+    if (nRet != 1) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "TLS handshake with the local listener failed");
+    }
+    LogPrint("bench", "%s: %d stalled handshakes\n", __func__, vStalled.size());
+    return duration;
+}
+
+double benchmark_socket_poll(size_t nPeers, bool fEpoll)
+{
+#ifdef __linux__
+    // nPeers idle socket pairs stand in for connected peers; each round one random peer sends a
+    // message header and the poller has to find it, which is what ThreadSocketHandler pays per wakeup
+    const size_t nMessages = 10000;
+    std::vector<std::pair<int, int> > vPairs;
+    int hEpoll = -1;
+    auto cleanup = [&]() {
+        for (auto& pair : vPairs) {
+            close(pair.first);
+            close(pair.second);
+        }
+        if (hEpoll != -1) {
+            close(hEpoll);
+        }
+    };
+
+    for (size_t i = 0; i < nPeers; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) {
+            cleanup();
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "socketpair failed, raise the file descriptor limit");
+        }
+        vPairs.push_back(std::make_pair(fds[0], fds[1]));
+        if (!fEpoll && fds[0] >= FD_SETSIZE) {
+            cleanup();
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "select() cannot watch descriptors beyond FD_SETSIZE");
+        }
+    }
+    if (fEpoll) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        for (size_t i = 0; i < vPairs.size(); i++) {
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLET;
+            event.data.u64 = i;
+            epoll_ctl(hEpoll, EPOLL_CTL_ADD, vPairs[i].first, &event);
+        }
+    }
+
+    unsigned char msg[24] = {0}, buf[24];
+    size_t nReceived = 0;
+    struct timespec ts_start, ts_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_start);
+    for (size_t n = 0; n < nMessages; n++) {
+        size_t nPeer = GetRand(vPairs.size());
+        if (write(vPairs[nPeer].second, msg, sizeof(msg)) != sizeof(msg)) {
+            continue;
+        }
+        if (fEpoll) {
+            struct epoll_event events[64];
+            int nEvents = epoll_wait(hEpoll, events, 64, 1000);
+            for (int i = 0; i < nEvents; i++) {
+                while (read(vPairs[events[i].data.u64].first, buf, sizeof(buf)) > 0) {
+                    nReceived++;
+                }
+            }
+        } else {
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            int hSocketMax = 0;
+            for (auto& pair : vPairs) {
+                FD_SET(pair.first, &fdsetRecv);
+                hSocketMax = std::max(hSocketMax, pair.first);
+            }
+            struct timeval timeout = {1, 0};
+            if (select(hSocketMax + 1, &fdsetRecv, NULL, NULL, &timeout) > 0) {
+                for (auto& pair : vPairs) {
+                    if (FD_ISSET(pair.first, &fdsetRecv)) {
+                        while (read(pair.first, buf, sizeof(buf)) > 0) {
+                            nReceived++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_end);
+    cleanup();
+
+    double cpu = (ts_end.tv_sec - ts_start.tv_sec) + (ts_end.tv_nsec - ts_start.tv_nsec) / 1000000000.0;
+    LogPrint("bench", "%s: %d peers, %d messages, %.3f us cpu per message\n", __func__, nPeers, nReceived, nReceived ? cpu * 1000000 / nReceived : 0);
+    return cpu;
+#else
+    throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark requires Linux");
+#endif
+}
+
+double benchmark_block_template(bool fCold)
+{
+    // A cold run rebuilds the template candidates from the whole mempool, as every call used to;
+    // a warm run follows a previous template and only pays for what changed since then
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    if (fCold) {
+        ResetBlockTemplateCandidates();
+    } else {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, 0));
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, 0));
+    auto duration = timer_stop(tv_start);
+    if (!pblocktemplate) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "CreateNewBlock failed");
+    }
+    LogPrint("bench", "%s: mempool %d txs, template %d txs\n", __func__, mempool.size(), pblocktemplate->block.vtx.size());
+    return duration;
+}
+
+double benchmark_sapling_trial_decryption(size_t nOutputs, size_t nKeys, int nThreads)
+{
+    // Outputs to addresses outside the wallet, so every key is tried on every output
+    CWallet wallet;
+    std::vector<libzcash::SaplingIncomingViewingKey> ivks;
+    for (size_t i = 0; i < nKeys; i++) {
+        ivks.push_back(libzcash::SaplingSpendingKey::random().full_viewing_key().in_viewing_key());
+    }
+
+    CMutableTransaction mtx;
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    for (size_t i = 0; i < nOutputs; i++) {
+        auto address = libzcash::SaplingSpendingKey::random().default_address();
+        SaplingNote note(address, GetRand(MAX_MONEY));
+        auto res = libzcash::SaplingNotePlaintext(note, memo).encrypt(note.pk_d);
+        if (!res) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "SaplingNotePlaintext::encrypt() failed");
+        }
+        OutputDescription odesc;
+        odesc.cm = note.cm().get();
+        odesc.ephemeralKey = res.get().second.get_epk();
+        odesc.encCiphertext = res.get().first;
+        mtx.vShieldedOutput.push_back(odesc);
+    }
+    CTransaction tx(mtx);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    auto results = wallet.FindMySaplingNotes(std::vector<const CTransaction*>(1, &tx), ivks, nThreads);
+    return timer_stop(tv_start);
+}
+
+extern int32_t SAFECOIN_CONNECTING;
+
+double benchmark_cc_eval(int nStartHeight, int nBlocks, int nThreads)
+{
+    // The CC input checks of a block range, run block by block on nThreads as ConnectBlock's script
+    // check threads run them. Spent outputs come from the undo data, so no txindex is needed.
+    LOCK(cs_main);
+    std::deque<CBlock> blocks;
+    std::deque<PrecomputedTransactionData> txdata;
+    std::vector<std::pair<int, std::vector<CScriptCheck>>> vBlockChecks;
+    size_t nChecks = 0;
+    for (int nHeight = nStartHeight; nHeight < nStartHeight + nBlocks && nHeight <= chainActive.Height(); nHeight++) {
+        CBlockIndex *pindex = chainActive[nHeight];
+        CBlockUndo blockundo;
+        blocks.emplace_back();
+        if (pindex == NULL || pindex->pprev == NULL || !ReadBlockFromDisk(blocks.back(), pindex, false) || !UndoReadFromDisk(blockundo, pindex)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to read block at height " + std::to_string(nHeight));
+        }
+        const CBlock& block = blocks.back();
+        uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
+        vBlockChecks.emplace_back(nHeight, std::vector<CScriptCheck>());
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            txdata.emplace_back(tx);
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxOut& prevout = txundo.vprevout[j].txout;
+                if (!prevout.scriptPubKey.IsPayToCryptoCondition()) {
+                    continue;
+                }
+                CCoins coins;
+                coins.vout.resize(tx.vin[j].prevout.n + 1);
+                coins.vout[tx.vin[j].prevout.n] = prevout;
+                vBlockChecks.back().second.emplace_back();
+                CScriptCheck check(coins, tx, j, MANDATORY_SCRIPT_VERIFY_FLAGS, false, consensusBranchId, &txdata.back());
+                check.swap(vBlockChecks.back().second.back());
+                nChecks++;
+            }
+        }
+    }
+
+    int32_t nConnecting = SAFECOIN_CONNECTING;
+    size_t nFailed = 0;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (auto& blockChecks : vBlockChecks) {
+        std::vector<CScriptCheck>& vChecks = blockChecks.second;
+        std::atomic<size_t> nNext(0), nBlockFailed(0);
+        auto runChecks = [&]() {
+            size_t k;
+            while ((k = nNext++) < vChecks.size()) {
+                if (!vChecks[k]()) {
+                    nBlockFailed++;
+                }
+            }
+        };
+        SAFECOIN_CONNECTING = blockChecks.first;
+        std::vector<std::thread> threads;
+        for (int i = 1; i < std::min<int>(nThreads, vChecks.size()); i++) {
+            threads.emplace_back(runChecks);
+        }
+        runChecks();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        nFailed += nBlockFailed;
+    }
+    auto duration = timer_stop(tv_start);
+    SAFECOIN_CONNECTING = nConnecting;
+    LogPrint("bench", "%s: %d blocks, %d CC inputs, %d failed, %d threads\n", __func__, vBlockChecks.size(), nChecks, nFailed, nThreads);
+    return duration;
+}
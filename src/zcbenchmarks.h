@@ -16,12 +16,19 @@ extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
 extern double benchmark_increment_note_witnesses(size_t nTxs);
 extern double benchmark_connectblock_slow();
-extern double benchmark_sendtoaddress(CAmount amount);
+extern double benchmark_sendtoaddress(CAmount amount, size_t nUtxos = 0);
 extern double benchmark_loadwallet();
-extern double benchmark_listunspent();
+extern double benchmark_listunspent(size_t nUtxos = 0);
 extern double benchmark_create_sapling_spend();
 extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
 extern double benchmark_verify_sapling_output();
+extern double benchmark_npptr_lookup(size_t nPoints, bool fIndexed);
+extern double benchmark_safecoin_blockscan(size_t nBlocks, bool fUndo);
+extern double benchmark_tls_stalled_handshakes(size_t nStalled);
+extern double benchmark_socket_poll(size_t nPeers, bool fEpoll);
+extern double benchmark_block_template(bool fCold);
+extern double benchmark_sapling_trial_decryption(size_t nOutputs, size_t nKeys, int nThreads);
+extern double benchmark_cc_eval(int nStartHeight, int nBlocks, int nThreads);
 
 #endif